@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui widgets serialport
+QT       += core gui widgets serialport concurrent
 CONFIG   += c++11
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
@@ -22,14 +22,67 @@ SOURCES += main.cpp\
     gcodeeditor.cpp \
     dlgserialport.cpp \
     jogging.cpp \
-    dlgconfig.cpp
+    dlgconfig.cpp \
+    gcodestate.cpp \
+    gcodeprogram.cpp \
+    gcodeestimator.cpp \
+    gcodefilter.cpp \
+    arcfitter.cpp \
+    decimator.cpp \
+    gcodebounds.cpp \
+    gcodeviewer.cpp \
+    gcodelineindex.cpp \
+    gcodetokenizer.cpp \
+    gcodehighlighter.cpp \
+    logview.cpp \
+    logrecord.cpp \
+    logwriter.cpp \
+    positionestimator.cpp \
+    toolpath.cpp \
+    toolpathview.cpp \
+    machinetrail.cpp \
+    jogcontroller.cpp \
+    jogsession.cpp \
+    joglatency.cpp \
+    heightmap.cpp \
+    heightcompensator.cpp \
+    probing.cpp \
+    probeplanner.cpp \
+    traveloptimizer.cpp \
+    aircutremover.cpp
 
 HEADERS  += mainwindow.h \
     grblcontrol.h \
     gcodesequencer.h \
     gcodeeditor.h \
     dlgserialport.h \
-    dlgconfig.h
+    dlgconfig.h \
+    gcodestate.h \
+    gcodeprogram.h \
+    gcodeestimator.h \
+    gcodefilter.h \
+    arcfitter.h \
+    decimator.h \
+    gcodebounds.h \
+    gcodeviewer.h \
+    gcodelineindex.h \
+    gcodetokenizer.h \
+    gcodehighlighter.h \
+    logview.h \
+    logrecord.h \
+    logwriter.h \
+    positionestimator.h \
+    toolpath.h \
+    toolpathview.h \
+    machinetrail.h \
+    jogcontroller.h \
+    jogsession.h \
+    joglatency.h \
+    heightmap.h \
+    heightcompensator.h \
+    probeplanner.h \
+    traveloptimizer.h \
+    aircutremover.h
 
 FORMS    += mainwindow.ui \
     dlgserialport.ui \
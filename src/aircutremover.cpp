@@ -0,0 +1,133 @@
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include "aircutremover.h"
+
+using namespace std;
+
+
+// the word is on the line, comments aside
+static bool hasWord(const char* code, char letter)
+{
+    for(const char* s = code; *s; ++s){
+        if(*s == '(')
+            while(s[1] && *s != ')') ++s;
+        else if(*s == ';')
+            break;
+        else if(::toupper(*s) == letter)
+            return true;
+    }
+    return false;
+}
+
+
+void AirCutRemover::reset()
+{
+    GCodeFilter::reset();
+    _state.reset();
+    _moves = 0;
+    _length = 0.0;
+    _feedTime = 0.0;
+}
+
+
+//////  p r o c e s s  //////
+void AirCutRemover::_process(int lineNumber, const char* code)
+{
+    // points are written with X, Y and Z, the tool must be where the program says on all of them
+    const bool known = _state.isKnown(0) && _state.isKnown(1) && _state.isKnown(2);
+    GCodeMove move;
+    const bool moved = _state.update(code, &move);
+
+    if(!moved){ // an arc mode restored here would want axis words, the next move restores it if needed
+        _emit(lineNumber, code);
+        return;
+    }
+    if(!known || !move.known || !_isCandidate(code, move)){
+        _emitOriginal(lineNumber, code, _state.motionMode());
+        return;
+    }
+
+    const bool feedWord = hasWord(code, 'F'); // modal, a rapid keeps it for the next feed move
+    double low[3], high[3];
+    move.boundingBox(low, high);
+    if(low[2] > _height){ // whole path above the stock, straight to its end
+        _emitPoint(lineNumber, GCodeState::Rapid, move.to, feedWord, move.feed);
+        const double chord = ::sqrt((move.to[0]-move.from[0])*(move.to[0]-move.from[0]) +
+                                    (move.to[1]-move.from[1])*(move.to[1]-move.from[1]) +
+                                    (move.to[2]-move.from[2])*(move.to[2]-move.from[2]));
+        _count(move, chord, move.length());
+        return;
+    }
+
+    // plunge or retract at feed, the part above the height can be a rapid
+    const bool down = (move.from[2] > _height && move.to[2] < _height);
+    const bool up = (move.from[2] < _height && move.to[2] > _height);
+    if(move.type == GCodeMove::Linear && (down || up)){
+        const double t = (_height - move.from[2]) / (move.to[2] - move.from[2]);
+        const double above = (down? t: 1.0 - t) * move.length();
+        if(above >= MIN_SPLIT){
+            double cross[3];
+            for(int i=0; i<3; ++i)
+                cross[i] = move.from[i] + (move.to[i] - move.from[i])*t;
+            cross[2] = _height; // exactly, not below
+            if(down){
+                _emitPoint(lineNumber, GCodeState::Rapid, cross, false, 0.0);
+                _emitPoint(lineNumber, GCodeState::Linear, move.to, feedWord, move.feed);
+            }
+            else{
+                _emitPoint(lineNumber, GCodeState::Linear, cross, feedWord, move.feed);
+                _emitPoint(lineNumber, GCodeState::Rapid, move.to, false, 0.0);
+            }
+            _count(move, above, above);
+            return;
+        }
+    }
+
+    _emitOriginal(lineNumber, code, _state.motionMode());
+}
+
+
+//////  i s  C a n d i d a t e  //////
+bool AirCutRemover::_isCandidate(const char* code, const GCodeMove& move) const
+{
+    if(move.type != GCodeMove::Linear && !move.isArc())
+        return false;
+    if(move.sync || move.machine || _state.isIncremental() || _state.isInverseTime() || move.feed <= 0.0)
+        return false;
+
+    // nothing but the motion, its coordinates and feed rate
+    for(const char* s = code; *s; ++s){
+        const char c = ::toupper(*s);
+        if(c == 'G'){
+            const char* end;
+            if(GCodeState::readNumber(s+1, &end) != _state.motionMode())
+                return false;
+        }
+        else if(c == '(' || c == ';')
+            return false;
+        else if(::isalpha(c) && !::strchr("XYZFNIJKR", c))
+            return false;
+    }
+    return true;
+}
+
+
+void AirCutRemover::_emitPoint(int lineNumber, int motion, const double* pos, bool feedWord, double feed)
+{
+    const double scale = _state.isImperial()? 25.4: 1.0;
+    char buf[96];
+    int n = ::sprintf(buf, "G%dX%.4fY%.4fZ%.4f", motion, pos[0]/scale, pos[1]/scale, pos[2]/scale);
+    if(feedWord)
+        ::sprintf(buf + n, "F%g", feed/scale);
+    _emitMotion(lineNumber, buf, motion);
+}
+
+
+void AirCutRemover::_count(const GCodeMove& move, double rapid, double feed)
+{
+    ++_moves;
+    _length += rapid;
+    _feedTime += 60.0 * feed / move.feed;
+}
@@ -0,0 +1,44 @@
+#ifndef GSHARPIE_AIRCUTREMOVER_H
+#define GSHARPIE_AIRCUTREMOVER_H
+#include <string>
+#include "gcodefilter.h"
+
+
+// feed moves which stay above the given height cannot touch the stock, they are sent as rapids;
+// straight feed moves crossing the height are split, the part above it becomes a rapid
+class AirCutRemover: public GCodeFilter
+{
+public:
+    static constexpr double MIN_SPLIT = 0.5; // mm, shorter parts above the height are not worth a line
+
+public:
+    explicit AirCutRemover(double height=1.0) {_height = height; reset();}
+
+    // mm, work Z of the stock top plus clearance, nothing above it is cut
+    inline void setHeight(double height) {_height = height;}
+
+    const char* name() const override {return "Air cut removal";}
+    void reset() override;
+
+    inline int moves() const {return _moves;} // converted or split
+    inline double rapidLength() const {return _length;} // mm, moved at rapid instead of feed
+    inline double feedTime() const {return _feedTime;} // sec, it took at feed
+
+protected:
+    void _process(int lineNumber, const char* code) override;
+
+private:
+    bool _isCandidate(const char* code, const GCodeMove& move) const;
+    void _emitPoint(int lineNumber, int motion, const double* pos, bool feedWord, double feed);
+    void _count(const GCodeMove& move, double rapid, double feed); // mm, of the path at each rate
+
+private:
+    double _height;
+    GCodeState _state; // of the input stream
+
+    int _moves;
+    double _length;
+    double _feedTime;
+};
+
+#endif // GSHARPIE_AIRCUTREMOVER_H
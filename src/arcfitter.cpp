@@ -0,0 +1,184 @@
+#include <cmath>
+#include <cstdio>
+#include "arcfitter.h"
+
+using namespace std;
+
+
+void ArcFitter::reset()
+{
+    GCodeFilter::reset();
+    _state.reset();
+    _points.clear();
+    _startX = _startY = 0.0;
+    _runZ = _runFeed = 0.0;
+    _runScale = 1.0;
+    _runFeedWord = false;
+}
+
+
+void ArcFitter::flush()
+{
+    _flushRun();
+    GCodeFilter::flush();
+}
+
+
+//////  p r o c e s s  //////
+void ArcFitter::_process(int lineNumber, const char* code)
+{
+    GCodeMove move;
+    _state.update(code, &move);
+
+    if(!_isCandidate(code, move)){
+        _flushRun();
+        _emitOriginal(lineNumber, code, _state.motionMode());
+        return;
+    }
+
+    if(!_points.empty() && (move.from[2] != _runZ || move.feed != _runFeed))
+        _flushRun();
+
+    if(_points.empty()){ // new chain
+        _startX = move.from[0];
+        _startY = move.from[1];
+        _runZ = move.from[2];
+        _runFeed = move.feed;
+        _runScale = _state.isImperial()? 25.4: 1.0;
+        _runFeedWord = (::strchr(code, 'F') != nullptr);
+    }
+
+    Point point = {move.to[0], move.to[1], lineNumber, code};
+    _points.push_back(point);
+
+    // the new point may break the chain: finish the arc before it or give up the first segment
+    double cx, cy, radius;
+    bool clockwise;
+    while(_points.size() > 2 && !_fitCircle(_points.size(), cx, cy, radius, clockwise)){
+        const int fitting = _points.size() - 1;
+        if(fitting >= MIN_SEGMENTS)
+            _emitArc(fitting);
+        else
+            _emitLines(1);
+    }
+
+    if(_points.size() >= MAX_SEGMENTS)
+        _emitArc(_points.size());
+}
+
+
+//////  i s  C a n d i d a t e  //////
+bool ArcFitter::_isCandidate(const char* code, const GCodeMove& move) const
+{
+    if(move.type != GCodeMove::Linear || move.sync || move.machine || move.from[2] != move.to[2] ||
+       _state.isIncremental() || _state.isInverseTime() || _state.plane() != 17)
+        return false;
+    if(!move.known || !_state.isKnown(0) || !_state.isKnown(1)) // arcs are written with both X and Y
+        return false;
+
+    return isPlainMove(code, GCodeState::Linear);
+}
+
+
+//////  f i t  C i r c l e  //////
+bool ArcFitter::_fitCircle(int count, double& cx, double& cy, double& radius, bool& clockwise) const
+{
+    // circle through the start and end points of the chain, centre on their bisector
+    // is the least squares fit of the points in between
+    const Point& end = _points[count-1];
+    const double dx = end.x - _startX, dy = end.y - _startY;
+    const double chordLength = ::hypot(dx, dy);
+    if(chordLength < 1e-6)
+        return false;
+    const double nx = -dy/chordLength, ny = dx/chordLength; // left of the chord
+    const double mx = 0.5*(_startX + end.x), my = 0.5*(_startY + end.y);
+    const double halfChord2 = 0.25*chordLength*chordLength;
+
+    double sumAB = 0.0, sumBB = 0.0, sumB = 0.0;
+    for(int i=0; i < count-1; ++i){
+        const double px = _points[i].x - mx, py = _points[i].y - my;
+        const double a = px*px + py*py - halfChord2;
+        const double b = nx*px + ny*py;
+        sumAB += a*b;
+        sumBB += b*b;
+        sumB += b;
+    }
+    if(sumBB <= 0.0)
+        return false; // collinear
+
+    const double t = 0.5*sumAB/sumBB;
+    cx = mx + t*nx;
+    cy = my + t*ny;
+    radius = ::hypot(_startX - cx, _startY - cy);
+    clockwise = (sumB > 0.0); // points bulge to the left of the chord
+    if(radius > MAX_RADIUS)
+        return false;
+
+    // every point on the circle, advancing around the centre in the arc direction
+    // and every segment close enough to the arc
+    double px = _startX - cx, py = _startY - cy, angle = 0.0;
+    for(int i=0; i < count; ++i){
+        const double qx = _points[i].x - cx, qy = _points[i].y - cy;
+        if(::fabs(::hypot(qx, qy) - radius) > _tolerance)
+            return false;
+
+        double step = ::atan2(px*qy - py*qx, px*qx + py*qy);
+        if(clockwise)
+            step = -step;
+        if(step <= 0.0)
+            return false;
+        if(radius*(1.0 - ::cos(0.5*step)) > _tolerance) // sagitta
+            return false;
+        angle += step;
+
+        px = qx; py = qy;
+    }
+    return angle < 1.9*M_PI; // almost full circles are ambiguous
+}
+
+
+//////  e m i t  A r c  //////
+void ArcFitter::_emitArc(int count)
+{
+    double cx, cy, radius;
+    bool clockwise;
+    _fitCircle(count, cx, cy, radius, clockwise); // has been checked when the points were added
+
+    const Point& end = _points[count-1];
+    char buf[128];
+    ::sprintf(buf, "G%dX%.4fY%.4fI%.4fJ%.4f", clockwise? 2: 3, end.x/_runScale, end.y/_runScale,
+              (cx - _startX)/_runScale, (cy - _startY)/_runScale);
+    string arc(buf);
+    if(_runFeedWord){
+        ::sprintf(buf, "F%g", _runFeed/_runScale);
+        arc += buf;
+    }
+    _emitMotion(end.lineNumber, arc, clockwise? GCodeState::ArcCW: GCodeState::ArcCCW);
+
+    _startX = end.x;
+    _startY = end.y;
+    _points.erase(_points.begin(), _points.begin() + count);
+    _runFeedWord = false;
+}
+
+
+//////  e m i t  L i n e s  //////
+void ArcFitter::_emitLines(int count)
+{
+    for(int i=0; i < count; ++i)
+        _emitOriginal(_points[i].lineNumber, _points[i].code.c_str(), GCodeState::Linear);
+
+    _startX = _points[count-1].x;
+    _startY = _points[count-1].y;
+    _points.erase(_points.begin(), _points.begin() + count);
+    _runFeedWord = false;
+}
+
+
+void ArcFitter::_flushRun()
+{
+    if(_points.size() >= MIN_SEGMENTS)
+        _emitArc(_points.size());
+    else if(!_points.empty())
+        _emitLines(_points.size());
+}
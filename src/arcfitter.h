@@ -0,0 +1,55 @@
+#ifndef GSHARPIE_ARCFITTER_H
+#define GSHARPIE_ARCFITTER_H
+#include <string>
+#include <vector>
+#include "gcodefilter.h"
+
+
+// replaces chains of short G1 moves lying on a circle with G2/G3 arcs
+class ArcFitter: public GCodeFilter
+{
+public:
+    static const int MIN_SEGMENTS = 3;   // shorter chains are left as they are
+    static const int MAX_SEGMENTS = 128; // window size, keeps memory bounded
+    static constexpr double MAX_RADIUS = 2000.0; // mm, flatter chains stay as lines
+
+public:
+    explicit ArcFitter(double tolerance=0.002) {_tolerance = tolerance; reset();}
+
+    // maximum deviation of the arc from the original points and segments, mm
+    inline void setTolerance(double tolerance) {_tolerance = tolerance;}
+
+    const char* name() const override {return "Arc fitting";}
+    void reset() override;
+    void flush() override;
+
+protected:
+    void _process(int lineNumber, const char* code) override;
+
+private:
+    struct Point
+    {
+        double x, y; // mm
+        int lineNumber;
+        std::string code;
+    };
+
+    bool _isCandidate(const char* code, const GCodeMove& move) const;
+    bool _fitCircle(int count, double& cx, double& cy, double& radius, bool& clockwise) const;
+    void _emitArc(int count);
+    void _emitLines(int count);
+    void _flushRun();
+
+private:
+    double _tolerance;
+    GCodeState _state; // of the input stream
+
+    // current chain: start point and the end points of its G1 moves
+    double _startX, _startY;
+    std::vector<Point> _points;
+    double _runZ, _runFeed; // mm, mm/min
+    double _runScale; // program units to mm
+    bool _runFeedWord; // first line of the chain sets feed rate
+};
+
+#endif // GSHARPIE_ARCFITTER_H
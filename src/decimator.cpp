@@ -0,0 +1,172 @@
+#include <cstdio>
+#include "decimator.h"
+
+using namespace std;
+
+
+void Decimator::reset()
+{
+    GCodeFilter::reset();
+    _state.reset();
+    _points.clear();
+    _runFeed = 0.0;
+    _runScale = 1.0;
+    _runFeedWord = false;
+    _sent[0] = _sent[1] = _sent[2] = 0.0;
+}
+
+
+void Decimator::flush()
+{
+    _flushRun(true);
+    GCodeFilter::flush();
+}
+
+
+//////  p r o c e s s  //////
+void Decimator::_process(int lineNumber, const char* code)
+{
+    GCodeMove move;
+    _state.update(code, &move);
+
+    if(!_isCandidate(code, move)){
+        _flushRun(true);
+        _emitOriginal(lineNumber, code, _state.motionMode());
+        return;
+    }
+
+    if(!_points.empty() && move.feed != _runFeed)
+        _flushRun(true);
+
+    if(_points.empty()){ // new chain
+        Point start = {{move.from[0], move.from[1], move.from[2]}, lineNumber, string(), true};
+        _points.push_back(start);
+        _runFeed = move.feed;
+        _runScale = _state.isImperial()? 25.4: 1.0;
+        _runFeedWord = (::strchr(code, 'F') != nullptr);
+        for(int i=0; i<3; ++i)
+            _sent[i] = move.from[i];
+    }
+
+    Point point = {{move.to[0], move.to[1], move.to[2]}, lineNumber, code, false};
+    _points.push_back(point);
+
+    if(_points.size() >= MAX_POINTS)
+        _flushRun(false);
+}
+
+
+//////  i s  C a n d i d a t e  //////
+bool Decimator::_isCandidate(const char* code, const GCodeMove& move) const
+{
+    // feed per line depends on its length in inverse time mode
+    if(move.type != GCodeMove::Linear || move.sync || move.machine || !move.known ||
+       _state.isIncremental() || _state.isInverseTime())
+        return false;
+
+    return isPlainMove(code, GCodeState::Linear);
+}
+
+
+//////  s i m p l i f y  //////
+void Decimator::_simplify(int first, int last)
+{
+    // every dropped point stays within the tolerance from the segment replacing it
+    _stack.clear();
+    _stack.push_back(make_pair(first, last));
+    while(!_stack.empty()){
+        const int a = _stack.back().first, b = _stack.back().second;
+        _stack.pop_back();
+        if(b - a < 2)
+            continue;
+
+        const double* p0 = _points[a].pos;
+        const double* p1 = _points[b].pos;
+        double d[3], length2 = 0.0;
+        for(int k=0; k<3; ++k){
+            d[k] = p1[k] - p0[k];
+            length2 += d[k]*d[k];
+        }
+
+        double maxDistance2 = -1.0;
+        int farthest = a;
+        for(int i = a+1; i < b; ++i){
+            const double* p = _points[i].pos;
+            double t = 0.0;
+            if(length2 > 0.0){
+                t = ((p[0] - p0[0])*d[0] + (p[1] - p0[1])*d[1] + (p[2] - p0[2])*d[2]) / length2;
+                t = (t < 0.0)? 0.0: (t > 1.0)? 1.0: t;
+            }
+            double distance2 = 0.0;
+            for(int k=0; k<3; ++k){
+                const double e = p[k] - (p0[k] + t*d[k]);
+                distance2 += e*e;
+            }
+            if(distance2 > maxDistance2){
+                maxDistance2 = distance2;
+                farthest = i;
+            }
+        }
+
+        if(maxDistance2 > _tolerance*_tolerance){
+            _points[farthest].keep = true;
+            _stack.push_back(make_pair(a, farthest));
+            _stack.push_back(make_pair(farthest, b));
+        }
+    }
+}
+
+
+//////  f l u s h  R u n  //////
+void Decimator::_flushRun(bool all)
+{
+    const int count = _points.size();
+    if(count < 2){
+        _points.clear();
+        return;
+    }
+
+    _points.back().keep = true;
+    _simplify(0, count-1);
+
+    static const char axis[3] = {'X', 'Y', 'Z'};
+    bool dropped = false;
+    for(int i=1; i < count; ++i){
+        Point& p = _points[i];
+        if(!p.keep){
+            dropped = true;
+            continue;
+        }
+
+        if(!dropped) // omitted words are the same as in the previous line, which has been sent
+            _emitOriginal(p.lineNumber, p.code.c_str(), GCodeState::Linear);
+        else{
+            string line;
+            char buf[32];
+            for(int k=0; k<3; ++k){
+                if(p.pos[k] != _sent[k]){
+                    ::sprintf(buf, "%c%.4f", axis[k], p.pos[k]/_runScale);
+                    line += buf;
+                }
+            }
+            if(_runFeedWord){
+                ::sprintf(buf, "F%g", _runFeed/_runScale);
+                line += buf;
+            }
+            if(!line.empty()) // zero length moves are left out
+                _emitOriginal(p.lineNumber, line.c_str(), GCodeState::Linear);
+        }
+
+        for(int k=0; k<3; ++k)
+            _sent[k] = p.pos[k];
+        _runFeedWord = false;
+        dropped = false;
+    }
+
+    if(all)
+        _points.clear();
+    else{ // the last point starts the next window
+        _points.erase(_points.begin(), _points.end() - 1);
+        _points.front().keep = true;
+    }
+}
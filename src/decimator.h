@@ -0,0 +1,53 @@
+#ifndef GSHARPIE_DECIMATOR_H
+#define GSHARPIE_DECIMATOR_H
+#include <string>
+#include <vector>
+#include "gcodefilter.h"
+
+
+// drops G1 points which do not change the path by more than the tolerance (Douglas-Peucker)
+class Decimator: public GCodeFilter
+{
+public:
+    static const int MAX_POINTS = 256; // window size, keeps memory bounded
+
+public:
+    explicit Decimator(double tolerance=0.01) {_tolerance = tolerance; reset();}
+
+    // maximum distance of the dropped points from the simplified path, mm
+    inline void setTolerance(double tolerance) {_tolerance = tolerance;}
+
+    const char* name() const override {return "Decimation";}
+    void reset() override;
+    void flush() override;
+
+protected:
+    void _process(int lineNumber, const char* code) override;
+
+private:
+    struct Point
+    {
+        double pos[3]; // mm
+        int lineNumber;
+        std::string code;
+        bool keep;
+    };
+
+    bool _isCandidate(const char* code, const GCodeMove& move) const;
+    void _simplify(int first, int last);
+    void _flushRun(bool all);
+
+private:
+    double _tolerance;
+    GCodeState _state; // of the input stream
+
+    // current chain, the first point is where it starts (already sent)
+    std::vector<Point> _points;
+    std::vector<std::pair<int, int>> _stack;
+    double _runFeed; // mm/min
+    double _runScale; // program units to mm
+    bool _runFeedWord; // feed rate is still to be sent
+    double _sent[3]; // last position sent, mm
+};
+
+#endif // GSHARPIE_DECIMATOR_H
@@ -20,10 +20,50 @@ DlgConfig::DlgConfig(GrblControl* grbl, QSettings* ini, QWidget *parent):
     _feedRate = _ini->value("feed_rate", 100).toInt();
     _ini->endGroup();
 
+    _ini->beginGroup("Optimization");
+    _arcFitting = _ini->value("arc_fitting", false).toBool();
+    _arcFitTolerance = _ini->value("arc_fitting_tolerance", 0.0).toDouble();
+    _decimation = _ini->value("decimation", false).toBool();
+    _decimationTolerance = _ini->value("decimation_tolerance", 0.01).toDouble();
+    _travelReversal = _ini->value("travel_reversal", true).toBool();
+    _airCutRemoval = _ini->value("air_cut_removal", false).toBool();
+    _airCutHeight = _ini->value("air_cut_height", 1.0).toDouble();
+    _ini->endGroup();
+
+    _ini->beginGroup("Probing");
+    _probeStep = _ini->value("probe_step", 10.0).toDouble();
+    _probeClearance = _ini->value("probe_clearance", 2.0).toDouble();
+    _probeDepth = _ini->value("probe_depth", -2.0).toDouble();
+    _probeFeed = _ini->value("probe_feed", 50.0).toDouble();
+    _probeThreshold = _ini->value("probe_threshold", 0.05).toDouble();
+    _ini->endGroup();
+
+    _ini->beginGroup("Resuming");
+    _resumeSafeZ = _ini->value("safe_z", -1.0).toDouble();
+    _plungeFeed = _ini->value("plunge_feed", 100.0).toDouble();
+    _ini->endGroup();
+
     ui->edit_refreshRate->setText(QString::number(_refreshRate));
     ui->edit_seekRate->setText(QString::number(_seekRate));
     ui->edit_workRate->setText(QString::number(_feedRate));
 
+    ui->check_arcFitting->setChecked(_arcFitting);
+    ui->edit_arcFitTolerance->setText(QString::number(_arcFitTolerance));
+    ui->check_decimation->setChecked(_decimation);
+    ui->edit_decimationTolerance->setText(QString::number(_decimationTolerance));
+    ui->check_travelReversal->setChecked(_travelReversal);
+    ui->check_airCutRemoval->setChecked(_airCutRemoval);
+    ui->edit_airCutHeight->setText(QString::number(_airCutHeight));
+
+    ui->edit_probeStep->setText(QString::number(_probeStep));
+    ui->edit_probeClearance->setText(QString::number(_probeClearance));
+    ui->edit_probeDepth->setText(QString::number(_probeDepth));
+    ui->edit_probeFeed->setText(QString::number(_probeFeed));
+    ui->edit_probeThreshold->setText(QString::number(_probeThreshold));
+
+    ui->edit_resumeSafeZ->setText(QString::number(_resumeSafeZ));
+    ui->edit_plungeFeed->setText(QString::number(_plungeFeed));
+
     _verbosityLevel = GSharpieReportLevel;
     ui->slider_verbosity->setValue(-_verbosityLevel);
     ui->label_verbosity->setText(verbosityName());
@@ -252,6 +292,46 @@ void DlgConfig::on_buttonBox_accepted()
     _ini->setValue("feed_rate", _feedRate);
     _ini->endGroup();
 
+    _arcFitting = ui->check_arcFitting->isChecked();
+    _arcFitTolerance = ui->edit_arcFitTolerance->text().toDouble();
+    _decimation = ui->check_decimation->isChecked();
+    _decimationTolerance = ui->edit_decimationTolerance->text().toDouble();
+    _travelReversal = ui->check_travelReversal->isChecked();
+    _airCutRemoval = ui->check_airCutRemoval->isChecked();
+    _airCutHeight = ui->edit_airCutHeight->text().toDouble();
+
+    _ini->beginGroup("Optimization");
+    _ini->setValue("arc_fitting", _arcFitting);
+    _ini->setValue("arc_fitting_tolerance", _arcFitTolerance);
+    _ini->setValue("decimation", _decimation);
+    _ini->setValue("decimation_tolerance", _decimationTolerance);
+    _ini->setValue("travel_reversal", _travelReversal);
+    _ini->setValue("air_cut_removal", _airCutRemoval);
+    _ini->setValue("air_cut_height", _airCutHeight);
+    _ini->endGroup();
+
+    _probeStep = ui->edit_probeStep->text().toDouble();
+    _probeClearance = ui->edit_probeClearance->text().toDouble();
+    _probeDepth = ui->edit_probeDepth->text().toDouble();
+    _probeFeed = ui->edit_probeFeed->text().toDouble();
+    _probeThreshold = ui->edit_probeThreshold->text().toDouble();
+
+    _ini->beginGroup("Probing");
+    _ini->setValue("probe_step", _probeStep);
+    _ini->setValue("probe_clearance", _probeClearance);
+    _ini->setValue("probe_depth", _probeDepth);
+    _ini->setValue("probe_feed", _probeFeed);
+    _ini->setValue("probe_threshold", _probeThreshold);
+    _ini->endGroup();
+
+    _resumeSafeZ = ui->edit_resumeSafeZ->text().toDouble();
+    _plungeFeed = ui->edit_plungeFeed->text().toDouble();
+
+    _ini->beginGroup("Resuming");
+    _ini->setValue("safe_z", _resumeSafeZ);
+    _ini->setValue("plunge_feed", _plungeFeed);
+    _ini->endGroup();
+
     if(_grbl->isActive()){
         GrblControl::Config conf;
         conf.imperial = ui->combo_units->currentIndex() != 0;
@@ -30,6 +30,14 @@ public:
     inline int seekRate() const {return _seekRate;}
     inline int feedRate() const {return _feedRate;}
 
+    inline bool arcFitting() const {return _arcFitting;}
+    inline double arcFitTolerance() const {return _arcFitTolerance;} // mm, 0 follows $12
+    inline bool decimation() const {return _decimation;}
+    inline double decimationTolerance() const {return _decimationTolerance;} // mm
+    inline bool travelReversal() const {return _travelReversal;}
+    inline bool airCutRemoval() const {return _airCutRemoval;}
+    inline double airCutHeight() const {return _airCutHeight;} // mm, work Z
+
 private:
     void _disableControls();
 
@@ -54,6 +62,23 @@ private:
     int _refreshRate;
     int _seekRate;
     int _feedRate;
+
+    bool _arcFitting;
+    double _arcFitTolerance;
+    bool _decimation;
+    double _decimationTolerance;
+    bool _travelReversal;
+    bool _airCutRemoval;
+    double _airCutHeight;
+
+    double _probeStep; // mm
+    double _probeClearance; // mm, work Z
+    double _probeDepth; // mm, work Z
+    double _probeFeed; // mm/min
+    double _probeThreshold; // mm, bend of the surface refined, 0 probes every point
+
+    double _resumeSafeZ; // mm, machine Z
+    double _plungeFeed; // mm/min
 };
 
 #endif // DLGCONFIG_H
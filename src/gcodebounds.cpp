@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <QtConcurrent>
+#include "gcodebounds.h"
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define GCODEBOUNDS_SSE
+#endif
+
+using namespace std;
+
+static const float SLACK = 1e-4f; // mm, rounding of the coordinates
+
+
+GCodeBounds::GCodeBounds()
+{
+    _useWorkArea = _useTravel = false;
+    for(int i=0; i<3; ++i){
+        _areaLow[i] = _travelLow[i] = -1e30f;
+        _areaHigh[i] = _travelHigh[i] = 1e30f;
+        _offset[i] = _maxTravel[i] = 0.0;
+    }
+}
+
+
+void GCodeBounds::setWorkArea(const double* low, const double* high)
+{
+    _useWorkArea = true;
+    for(int i=0; i<3; ++i){
+        _areaLow[i] = static_cast<float>(low[i]) - SLACK;
+        _areaHigh[i] = static_cast<float>(high[i]) + SLACK;
+    }
+}
+
+
+void GCodeBounds::setWorkOffset(const double* offset)
+{
+    for(int i=0; i<3; ++i)
+        _offset[i] = offset[i];
+    if(_useTravel)
+        setMachineTravel(_maxTravel);
+}
+
+
+void GCodeBounds::setMachineTravel(const double* maxTravel)
+{
+    _useTravel = true;
+    for(int i=0; i<3; ++i){
+        _maxTravel[i] = maxTravel[i];
+        _travelLow[i] = static_cast<float>(-maxTravel[i] - _offset[i]) - SLACK;
+        _travelHigh[i] = static_cast<float>(-_offset[i]) + SLACK;
+    }
+}
+
+
+//////  c h e c k  //////
+GCodeBounds::Result GCodeBounds::check(const GCodeProgram& program, int firstStep) const
+{
+    const int steps = program.size();
+    const int chunkSize = 16 * GCodeProgram::CHECKPOINT_INTERVAL;
+    vector<Chunk> chunks;
+    for(int begin = max(firstStep, 0); begin < steps; ){
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = min((begin/chunkSize + 1)*chunkSize, steps);
+        chunks.push_back(chunk);
+        begin = chunk.end;
+    }
+    QtConcurrent::blockingMap(chunks, [this, &program](Chunk& chunk){
+        _checkChunk(program, chunk);
+    });
+
+    Result result;
+    result.limitStep = result.travelStep = -1;
+    float low[3] = {1e30f, 1e30f, 1e30f}, high[3] = {-1e30f, -1e30f, -1e30f};
+    for(const Chunk& chunk: chunks){
+        for(int i=0; i<3; ++i){
+            low[i] = min(low[i], chunk.low[i]);
+            high[i] = max(high[i], chunk.high[i]);
+        }
+        if(result.limitStep < 0)
+            result.limitStep = chunk.limitStep;
+        if(result.travelStep < 0)
+            result.travelStep = chunk.travelStep;
+    }
+    result.empty = (low[0] > high[0]);
+    for(int i=0; i<3; ++i){
+        result.low[i] = result.empty? 0.0: low[i];
+        result.high[i] = result.empty? 0.0: high[i];
+    }
+    return result;
+}
+
+
+//////  c h e c k  C h u n k  //////
+void GCodeBounds::_checkChunk(const GCodeProgram& program, Chunk& chunk) const
+{
+    for(int i=0; i<3; ++i){
+        chunk.low[i] = 1e30f;
+        chunk.high[i] = -1e30f;
+    }
+    chunk.limitStep = chunk.travelStep = -1;
+
+    Batch batch;
+    for(int i=0; i<3; ++i){
+        batch.low[i].resize(BATCH_SIZE + 3); // room for padding to the vector size
+        batch.high[i].resize(BATCH_SIZE + 3);
+    }
+    batch.step.resize(BATCH_SIZE);
+    batch.count = 0;
+
+    GCodeState state = program.stateAt(chunk.begin);
+    GCodeMove move;
+    for(int step = chunk.begin; step < chunk.end; ++step){
+        if(!state.update(program.codePtr(step), &move) || move.type == GCodeMove::Dwell)
+            continue;
+
+        double low[3], high[3];
+        if(move.machine){ // G53 target is in machine coordinates on the axes written, the others stay
+            for(int i=0; i<3; ++i)
+                low[i] = high[i] = move.hasAxis[i]? move.to[i] - _offset[i]: move.from[i];
+        }
+        else if(move.isArc())
+            move.boundingBox(low, high);
+        else{ // the start point is the end of the previous move
+            for(int i=0; i<3; ++i)
+                low[i] = high[i] = move.to[i];
+        }
+
+        const int n = batch.count++;
+        for(int i=0; i<3; ++i){
+            batch.low[i][n] = static_cast<float>(low[i]);
+            batch.high[i][n] = static_cast<float>(high[i]);
+        }
+        batch.step[n] = step;
+        if(batch.count == BATCH_SIZE)
+            _reduceBatch(batch, chunk);
+    }
+    _reduceBatch(batch, chunk);
+}
+
+
+//////  r e d u c e  B a t c h  //////
+void GCodeBounds::_reduceBatch(Batch& batch, Chunk& chunk) const
+{
+    const int count = batch.count;
+    if(count == 0)
+        return;
+
+    // pad to a multiple of four with copies of the last move
+    const int padded = (count + 3) & ~3;
+    for(int i=0; i<3; ++i){
+        for(int n = count; n < padded; ++n){
+            batch.low[i][n] = batch.low[i][count-1];
+            batch.high[i][n] = batch.high[i][count-1];
+        }
+    }
+
+    for(int i=0; i<3; ++i){
+        const float* low = batch.low[i].data();
+        const float* high = batch.high[i].data();
+#ifdef GCODEBOUNDS_SSE
+        __m128 vlow = _mm_set1_ps(chunk.low[i]), vhigh = _mm_set1_ps(chunk.high[i]);
+        for(int n=0; n < padded; n += 4){
+            vlow = _mm_min_ps(vlow, _mm_loadu_ps(low + n));
+            vhigh = _mm_max_ps(vhigh, _mm_loadu_ps(high + n));
+        }
+        float l[4], h[4];
+        _mm_storeu_ps(l, vlow);
+        _mm_storeu_ps(h, vhigh);
+        chunk.low[i] = min(min(l[0], l[1]), min(l[2], l[3]));
+        chunk.high[i] = max(max(h[0], h[1]), max(h[2], h[3]));
+#else
+        for(int n=0; n < padded; ++n){
+            chunk.low[i] = min(chunk.low[i], low[n]);
+            chunk.high[i] = max(chunk.high[i], high[n]);
+        }
+#endif
+    }
+
+    if(_useWorkArea && chunk.limitStep < 0){
+        const int n = _firstOutside(batch, _areaLow, _areaHigh);
+        if(n >= 0)
+            chunk.limitStep = batch.step[min(n, count-1)];
+    }
+    if(_useTravel && chunk.travelStep < 0){
+        const int n = _firstOutside(batch, _travelLow, _travelHigh);
+        if(n >= 0)
+            chunk.travelStep = batch.step[min(n, count-1)];
+    }
+    batch.count = 0;
+}
+
+
+//////  f i r s t  O u t s i d e  //////
+int GCodeBounds::_firstOutside(const Batch& batch, const float* low, const float* high)
+{
+    const int padded = (batch.count + 3) & ~3;
+#ifdef GCODEBOUNDS_SSE
+    const __m128 lowX = _mm_set1_ps(low[0]), lowY = _mm_set1_ps(low[1]), lowZ = _mm_set1_ps(low[2]);
+    const __m128 highX = _mm_set1_ps(high[0]), highY = _mm_set1_ps(high[1]), highZ = _mm_set1_ps(high[2]);
+    for(int n=0; n < padded; n += 4){
+        __m128 out = _mm_or_ps(_mm_cmplt_ps(_mm_loadu_ps(batch.low[0].data() + n), lowX),
+                               _mm_cmpgt_ps(_mm_loadu_ps(batch.high[0].data() + n), highX));
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(_mm_loadu_ps(batch.low[1].data() + n), lowY),
+                                       _mm_cmpgt_ps(_mm_loadu_ps(batch.high[1].data() + n), highY)));
+        out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(_mm_loadu_ps(batch.low[2].data() + n), lowZ),
+                                       _mm_cmpgt_ps(_mm_loadu_ps(batch.high[2].data() + n), highZ)));
+        const int mask = _mm_movemask_ps(out);
+        if(mask != 0){
+            int k = 0;
+            while(!(mask & (1 << k)))
+                ++k;
+            return n + k;
+        }
+    }
+#else
+    for(int n=0; n < padded; ++n){
+        for(int i=0; i<3; ++i){
+            if(batch.low[i][n] < low[i] || batch.high[i][n] > high[i])
+                return n;
+        }
+    }
+#endif
+    return -1;
+}
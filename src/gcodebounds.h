@@ -0,0 +1,64 @@
+#ifndef GSHARPIE_GCODEBOUNDS_H
+#define GSHARPIE_GCODEBOUNDS_H
+#include <vector>
+#include "gcodeprogram.h"
+
+
+// extents of the program and the first moves leaving the work area or the machine travel;
+// moves are collected in batches which are reduced and tested four coordinates at a time
+class GCodeBounds
+{
+public:
+    static const int BATCH_SIZE = 1024; // moves
+
+    struct Result
+    {
+        double low[3], high[3]; // mm, program coordinates
+        bool empty; // no motion at all
+        int limitStep; // first step outside the work area, -1 if none
+        int travelStep; // first step outside the machine travel, -1 if none
+    };
+
+public:
+    GCodeBounds();
+
+    // in program coordinates, mm
+    void setWorkArea(const double* low, const double* high);
+
+    // machine coordinates of the program origin (grbl's WCO), mm
+    void setWorkOffset(const double* offset);
+
+    // grbl's soft limits, machine space is [-maxTravel, 0] after homing ($130-132), mm
+    void setMachineTravel(const double* maxTravel);
+
+    // thread-safe, can be called from a worker thread as long as the program is not modified
+    Result check(const GCodeProgram& program, int firstStep=0) const;
+
+private:
+    struct Batch // move extents, one array per axis
+    {
+        std::vector<float> low[3], high[3];
+        std::vector<int> step;
+        int count;
+    };
+
+    struct Chunk // part of the program processed by one thread
+    {
+        int begin, end; // steps
+        float low[3], high[3];
+        int limitStep, travelStep;
+    };
+
+    void _checkChunk(const GCodeProgram& program, Chunk& chunk) const;
+    void _reduceBatch(Batch& batch, Chunk& chunk) const;
+    static int _firstOutside(const Batch& batch, const float* low, const float* high);
+
+private:
+    bool _useWorkArea, _useTravel;
+    float _areaLow[3], _areaHigh[3]; // program coordinates
+    float _travelLow[3], _travelHigh[3]; // program coordinates
+    double _offset[3];
+    double _maxTravel[3];
+};
+
+#endif // GSHARPIE_GCODEBOUNDS_H
@@ -1,5 +1,8 @@
+#include <limits>
 #include <QtWidgets>
 #include "gcodeeditor.h"
+#include "gcodeviewer.h"
+#include "gcodehighlighter.h"
 
 
 GCodeEditor::GCodeEditor(QWidget *parent) : QPlainTextEdit(parent)
@@ -16,13 +19,258 @@ GCodeEditor::GCodeEditor(QWidget *parent) : QPlainTextEdit(parent)
 
     setWordWrapMode(QTextOption::NoWrap);
     lineNumberArea = new LineNumberArea(this);
+    _viewer = new GCodeViewer(this);
+    _viewer->hide();
+    _highlighter = new GCodeHighlighter(this);
 
     connect(this, SIGNAL(blockCountChanged(int)), this, SLOT(updateLineNumberAreaWidth(int)));
     connect(this, SIGNAL(updateRequest(QRect,int)), this, SLOT(updateLineNumberArea(QRect,int)));
     connect(this, SIGNAL(cursorPositionChanged()), this, SLOT(highlightCurrentLine()));
+    connect(document(), SIGNAL(contentsChange(int,int,int)), this, SLOT(_trackChange(int,int,int)));
+    connect(this, SIGNAL(updateRequest(QRect,int)), _highlighter, SLOT(highlightVisible()));
 
     updateLineNumberAreaWidth(0);
     _highlightEnabled = false;
+    _executing = -1;
+    clearDirty();
+}
+
+
+
+void GCodeEditor::enableHighlight(bool enable)
+{
+    _highlightEnabled = enable;
+    _viewer->enableHighlight(enable);
+}
+
+
+
+bool GCodeEditor::openFile(const QString& fileName, QString* errorMsg)
+{
+    if(!isReadOnly()){ // being edited, keep editing the new program
+        QFile file(fileName);
+        if(!file.open(QFile::ReadOnly | QFile::Text)){
+            if(errorMsg)
+                *errorMsg = file.errorString();
+            return false;
+        }
+        _viewer->close();
+        _viewer->hide();
+        setPlainText(QString(file.readAll()));
+        return true;
+    }
+
+    if(!_viewer->open(fileName, errorMsg)){
+        _viewer->hide();
+        return false;
+    }
+    setPlainText(QString()); // releases the blocks of the previous program
+    clearDirty();
+    _viewer->setGeometry(rect());
+    _viewer->show();
+    _viewer->raise();
+    return true;
+}
+
+
+
+bool GCodeEditor::isViewing() const
+{
+    return _viewer->isOpen();
+}
+
+
+
+QString GCodeEditor::fileName() const
+{
+    return _viewer->fileName();
+}
+
+
+
+bool GCodeEditor::isEditable() const
+{
+    return !_viewer->isOpen() || _viewer->size() <= std::numeric_limits<int>::max();
+}
+
+
+
+void GCodeEditor::startEditing()
+{
+    if(!_viewer->isOpen() || !isEditable())
+        return;
+
+    const int line = _viewer->currentLine();
+    setPlainText(QString::fromUtf8(_viewer->data(), static_cast<int>(_viewer->size())).remove(QLatin1Char('\r')));
+    clearDirty(); // same program, nothing to interpret again
+    _viewer->close();
+    _viewer->hide();
+    setTextCursor(QTextCursor(document()->findBlockByNumber(line)));
+}
+
+
+
+//////  s a v e  F i l e  //////
+// written aside and renamed over the file when complete, the file viewed is unmapped only for the rename
+bool GCodeEditor::saveFile(const QString& fileName, QString* errorMsg)
+{
+    const bool viewing = _viewer->isOpen();
+    QSaveFile file(fileName);
+    if(!file.open(viewing? QIODevice::WriteOnly: QIODevice::WriteOnly | QIODevice::Text)){ // mapped file has its own line ends
+        if(errorMsg)
+            *errorMsg = file.errorString();
+        return false;
+    }
+
+    QByteArray buffer;
+    size_t length;
+    const char* text = programText(length, buffer);
+    for(size_t done = 0; done < length; ){
+        const qint64 written = file.write(text + done, static_cast<qint64>(length - done));
+        if(written <= 0){
+            if(errorMsg)
+                *errorMsg = file.errorString();
+            file.cancelWriting();
+            return false;
+        }
+        done += static_cast<size_t>(written);
+    }
+
+    const bool over = viewing && QFileInfo(fileName) == QFileInfo(_viewer->fileName());
+    const int line = _viewer->currentLine();
+    if(over)
+        _viewer->close(); // a mapped file cannot be replaced everywhere
+    const bool saved = file.commit();
+    if(!saved && errorMsg)
+        *errorMsg = file.errorString();
+    if(over){
+        QString reopenError;
+        if(!_viewer->open(fileName, &reopenError)){
+            _viewer->hide();
+            if(saved && errorMsg)
+                *errorMsg = reopenError;
+            return false;
+        }
+        _viewer->setCurrentLine(line);
+    }
+    return saved;
+}
+
+
+
+int GCodeEditor::lineCount() const
+{
+    return _viewer->isOpen()? _viewer->lineCount(): blockCount();
+}
+
+
+
+int GCodeEditor::currentLine() const
+{
+    return (_viewer->isOpen()? _viewer->currentLine(): textCursor().blockNumber()) + 1;
+}
+
+
+
+void GCodeEditor::gotoLine(int lineNumber)
+{
+    if(_viewer->isOpen())
+        _viewer->setCurrentLine(lineNumber-1);
+    else
+        setTextCursor(QTextCursor(document()->findBlockByNumber(lineNumber-1))); // block map lookup, no layout needed
+}
+
+
+
+void GCodeEditor::setExecutingLine(int lineNumber)
+{
+    if(_viewer->isOpen()){
+        _viewer->setExecutingLine(lineNumber-1);
+        return;
+    }
+    if(lineNumber-1 == _executing)
+        return;
+
+    _executing = lineNumber-1;
+    if(_executing >= 0){ // one block per line without wrapping, the scroll bar counts blocks
+        const int first = verticalScrollBar()->value();
+        const int visible = qMax(1, viewport()->height() / fontMetrics().height());
+        if(_executing < first || _executing >= first + visible)
+            verticalScrollBar()->setValue(_executing - visible/3);
+    }
+    highlightCurrentLine();
+}
+
+
+
+void GCodeEditor::setSelectedLines(const std::vector<std::pair<int, int>>& ranges)
+{
+    _selected.clear();
+    for(const std::pair<int, int>& range: ranges)
+        _selected.push_back(std::make_pair(range.first-1, range.second-1));
+    if(_viewer->isOpen())
+        _viewer->setSelectedLines(_selected);
+    if(!ranges.empty())
+        gotoLine(ranges.front().first);
+    if(!_viewer->isOpen())
+        highlightCurrentLine();
+}
+
+
+
+const char* GCodeEditor::programText(size_t& length, QByteArray& buffer) const
+{
+    if(_viewer->isOpen()){
+        length = static_cast<size_t>(_viewer->size());
+        return _viewer->data();
+    }
+    buffer = document()->toPlainText().toUtf8();
+    length = static_cast<size_t>(buffer.size());
+    return buffer.constData();
+}
+
+
+
+bool GCodeEditor::isProgramEmpty() const
+{
+    return _viewer->isOpen()? _viewer->isEmpty(): document()->isEmpty();
+}
+
+
+
+void GCodeEditor::clearDirty()
+{
+    _dirtyFirst = _dirtyLast = -1;
+    _dirtyDelta = 0;
+    _blockCount = blockCount();
+}
+
+
+
+void GCodeEditor::_trackChange(int position, int /* charsRemoved */, int charsAdded)
+{
+    if(_highlighter->isFormatting())
+        return; // colors only, the program is the same
+
+    // the document has already been changed, blocks after the changed ones have moved by delta
+    const int first = document()->findBlock(position).blockNumber();
+    int last = document()->findBlock(position + charsAdded).blockNumber();
+    if(last < first) // past the end of the document
+        last = blockCount() - 1;
+    const int delta = blockCount() - _blockCount;
+    _blockCount = blockCount();
+
+    if(_dirtyFirst < 0){
+        _dirtyFirst = first;
+        _dirtyLast = last;
+    }
+    else{
+        if(_dirtyLast >= first)
+            _dirtyLast += delta;
+        _dirtyFirst = qMin(_dirtyFirst, first);
+        _dirtyLast = qMax(_dirtyLast, last);
+    }
+    _dirtyDelta += delta;
 }
 
 
@@ -69,6 +317,7 @@ void GCodeEditor::resizeEvent(QResizeEvent *e)
 
     QRect cr = contentsRect();
     lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
+    _viewer->setGeometry(rect());
 }
 
 
@@ -89,6 +338,27 @@ void GCodeEditor::highlightCurrentLine()
         extraSelections.append(selection);
     }
 
+    const int blocks = blockCount();
+    for(size_t i=0; i < _selected.size() && i < MAX_SELECTIONS; ++i){
+        if(_selected[i].first >= blocks)
+            break;
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(QColor(255, 160, 0).lighter(170));
+        selection.format.setProperty(QTextFormat::FullWidthSelection, true);
+        selection.cursor = QTextCursor(document()->findBlockByNumber(_selected[i].first));
+        const QTextBlock last = document()->findBlockByNumber(qMin(_selected[i].second, blocks-1));
+        selection.cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+        extraSelections.append(selection);
+    }
+
+    if(_executing >= 0 && _executing < blockCount()){
+        QTextEdit::ExtraSelection selection;
+        selection.format.setBackground(QColor(Qt::green).lighter(170));
+        selection.format.setProperty(QTextFormat::FullWidthSelection, true);
+        selection.cursor = QTextCursor(document()->findBlockByNumber(_executing));
+        extraSelections.append(selection);
+    }
+
     setExtraSelections(extraSelections);
 }
 
@@ -1,6 +1,7 @@
 #ifndef GSHARPIE_GCODEEDITOR_H
 #define GSHARPIE_GCODEEDITOR_H
 
+#include <vector>
 #include <QObject>
 #include <QPlainTextEdit>
 
@@ -10,19 +11,48 @@ class QSize;
 class QWidget;
 
 class LineNumberArea;
+class GCodeViewer;
+class GCodeHighlighter;
 
 
 class GCodeEditor : public QPlainTextEdit
 {
     Q_OBJECT
 
+public:
+    static const int MAX_SELECTIONS = 1000; // line ranges highlighted in the document, extra selections are slow
+
 public:
     GCodeEditor(QWidget *parent = 0);
 
     void lineNumberAreaPaintEvent(QPaintEvent *event);
     int  lineNumberAreaWidth();
 
-    inline void enableHighlight(bool enable=true) {_highlightEnabled = enable;}
+    void enableHighlight(bool enable=true);
+
+    // files are shown by a mapped viewer, the document is filled when editing starts
+    bool openFile(const QString& fileName, QString* errorMsg=nullptr);
+    bool isViewing() const;
+    QString fileName() const; // being viewed
+    bool isEditable() const; // the file viewed fits in the document
+    void startEditing();
+    bool saveFile(const QString& fileName, QString* errorMsg=nullptr); // the file viewed may be saved over
+
+    // program lines in either mode
+    int lineCount() const;
+    int currentLine() const; // from 1
+    void gotoLine(int lineNumber); // from 1
+    void setExecutingLine(int lineNumber); // from 1, 0 for none; follows it without moving the cursor
+    void setSelectedLines(const std::vector<std::pair<int, int>>& ranges); // from 1, first and last, in order; goes to the first
+    const char* programText(size_t& length, QByteArray& buffer) const; // utf-8, the document is converted into buffer
+    bool isProgramEmpty() const;
+
+    // blocks changed since the last clearDirty(), in the current numbering (from 0)
+    inline bool isDirty() const {return _dirtyFirst >= 0;}
+    inline int dirtyFirst() const {return _dirtyFirst;}
+    inline int dirtyLast() const {return _dirtyLast;}
+    inline int dirtyDelta() const {return _dirtyDelta;} // blocks added minus blocks removed
+    void clearDirty();
 
 protected:
     void resizeEvent(QResizeEvent *event) override;
@@ -31,11 +61,19 @@ private slots:
     void updateLineNumberAreaWidth(int newBlockCount);
     void highlightCurrentLine();
     void updateLineNumberArea(const QRect &, int);
+    void _trackChange(int position, int charsRemoved, int charsAdded);
 
 private:
     QWidget *lineNumberArea;
+    GCodeViewer *_viewer;
+    GCodeHighlighter *_highlighter;
 
     bool _highlightEnabled;
+    int _executing; // block, or -1
+    std::vector<std::pair<int, int>> _selected; // blocks, picked on the toolpath
+
+    int _dirtyFirst, _dirtyLast, _dirtyDelta;
+    int _blockCount; // before the change
 };
 
 
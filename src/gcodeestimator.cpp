@@ -0,0 +1,284 @@
+#include <cmath>
+#include <algorithm>
+#include <QtConcurrent>
+#include "gcodeestimator.h"
+
+using namespace std;
+
+
+GCodeEstimator::GCodeEstimator(const GrblControl::Config& config)
+{
+    // grbl defaults are used until the configuration is retrieved from the controller
+    for(int i=0; i<3; ++i){
+        _maxRate[i] = (config.maxFeedRate[i] > 0.0)? config.maxFeedRate[i]: 500.0;
+        _acceleration[i] = ((config.acceleration[i] > 0.0)? config.acceleration[i]: 10.0) * 3600.0; // mm/sec^2 -> mm/min^2
+    }
+    _junctionDeviation = (config.junctionDeviation > 0.0)? config.junctionDeviation: 0.01;
+    _arcTolerance = (config.arcTolerance > 0.0)? config.arcTolerance: 0.002;
+}
+
+
+//////  e s t i m a t e  //////
+GCodeEstimator::Result GCodeEstimator::estimate(const GCodeProgram& program) const
+{
+    Result result;
+    result.totalTime = result.feedLength = result.rapidLength = 0.0;
+
+    const int steps = program.size();
+    result.stepTime.assign(steps, 0.0f);
+    float* stepTime = result.stepTime.data();
+
+    // parse in parallel, every chunk starts at a checkpoint with known modal state
+    const int chunkSize = 16 * GCodeProgram::CHECKPOINT_INTERVAL;
+    vector<Chunk> chunks;
+    for(int begin = 0; begin < steps; begin += chunkSize){
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = min(begin + chunkSize, steps);
+        chunks.push_back(chunk);
+    }
+    QtConcurrent::blockingMap(chunks, [this, &program, stepTime](Chunk& chunk){
+        _parseChunk(program, chunk, stepTime);
+    });
+
+    // join the chunks, carrying planner stops over the chunk boundaries
+    size_t count = 0;
+    for(const Chunk& chunk: chunks)
+        count += chunk.blocks.size();
+
+    vector<Block> blocks;
+    blocks.reserve(count);
+    bool stop = true; // program starts from standstill
+    for(Chunk& chunk: chunks){
+        if(!chunk.blocks.empty()){
+            chunk.blocks.front().stopBefore |= stop;
+            stop = chunk.trailingStop;
+        }
+        else
+            stop |= chunk.trailingStop;
+        blocks.insert(blocks.end(), chunk.blocks.begin(), chunk.blocks.end());
+        vector<Block>().swap(chunk.blocks);
+
+        result.feedLength += chunk.feedLength;
+        result.rapidLength += chunk.rapidLength;
+    }
+
+    // velocity profiles of runs between stops are independent, plan them in parallel
+    vector<pair<int, int>> runs; // first block, number of blocks
+    int runBegin = 0;
+    for(int i=1; i < static_cast<int>(blocks.size()); ++i){
+        if(blocks[i].stopBefore){
+            runs.push_back(make_pair(runBegin, i - runBegin));
+            runBegin = i;
+        }
+    }
+    if(!blocks.empty())
+        runs.push_back(make_pair(runBegin, static_cast<int>(blocks.size()) - runBegin));
+
+    const Block* first = blocks.data();
+    QtConcurrent::blockingMap(runs, [this, first, stepTime](const pair<int, int>& run){
+        _planRun(first + run.first, run.second, stepTime);
+    });
+
+    // per source line totals
+    int maxLine = 0;
+    for(int step=0; step < steps; ++step)
+        maxLine = max(maxLine, program.lineNumber(step));
+    result.lineTime.assign(maxLine + 1, 0.0f);
+    for(int step=0; step < steps; ++step){
+        result.totalTime += stepTime[step];
+        result.lineTime[program.lineNumber(step)] += stepTime[step];
+    }
+
+    return result;
+}
+
+
+//////  p a r s e  C h u n k  //////
+void GCodeEstimator::_parseChunk(const GCodeProgram& program, Chunk& chunk, float* stepTime) const
+{
+    chunk.feedLength = chunk.rapidLength = 0.0;
+
+    GCodeState state = program.stateAt(chunk.begin);
+    GCodeMove move;
+    bool stop = false; // next block starts from standstill
+
+    for(int step = chunk.begin; step < chunk.end; ++step){
+        const bool motion = state.update(program.codePtr(step), &move);
+        if(move.sync)
+            stop = true;
+        if(!motion)
+            continue;
+
+        switch(move.type){
+            case GCodeMove::Dwell:
+                stepTime[step] += move.dwell;
+                break;
+
+            case GCodeMove::Rapid:
+                _addBlock(chunk, move.from, move.to, 0.0, true, step, stop);
+                break;
+
+            case GCodeMove::Linear:
+                _addBlock(chunk, move.from, move.to, move.feed, false, step, stop);
+                break;
+
+            case GCodeMove::Probe:
+                _addBlock(chunk, move.from, move.to, move.feed, false, step, stop);
+                stop = true; // probing cycle always ends in standstill
+                break;
+
+            case GCodeMove::ArcCW:
+            case GCodeMove::ArcCCW:{
+                // same segmentation as grbl's mc_arc()
+                int a0, a1, lin;
+                move.planeAxes(a0, a1, lin);
+                const double radius = move.radius();
+                const double angle = move.angularTravel();
+                int segments = 0;
+                if(2.0*radius > _arcTolerance)
+                    segments = static_cast<int>(::floor(::fabs(0.5*angle*radius) /
+                                                        ::sqrt(_arcTolerance*(2.0*radius - _arcTolerance))));
+
+                const double rx = move.from[a0] - move.center[a0];
+                const double ry = move.from[a1] - move.center[a1];
+                double prev[3] = {move.from[0], move.from[1], move.from[2]};
+                for(int i=1; i < segments; ++i){
+                    const double theta = angle*i/segments;
+                    double point[3];
+                    point[a0] = move.center[a0] + rx*::cos(theta) - ry*::sin(theta);
+                    point[a1] = move.center[a1] + rx*::sin(theta) + ry*::cos(theta);
+                    point[lin] = move.from[lin] + (move.to[lin] - move.from[lin])*i/segments;
+                    _addBlock(chunk, prev, point, move.feed, false, step, stop);
+                    prev[0] = point[0]; prev[1] = point[1]; prev[2] = point[2];
+                }
+                _addBlock(chunk, prev, move.to, move.feed, false, step, stop);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    chunk.trailingStop = stop;
+}
+
+
+//////  a d d  B l o c k  //////
+void GCodeEstimator::_addBlock(Chunk& chunk, const double* from, const double* to, double feed, bool rapid,
+                               int step, bool& stop) const
+{
+    double delta[3], length = 0.0;
+    for(int i=0; i<3; ++i){
+        delta[i] = to[i] - from[i];
+        length += delta[i]*delta[i];
+    }
+    length = ::sqrt(length);
+    if(length < 1e-6)
+        return; // grbl ignores zero-length blocks
+
+    Block block;
+    for(int i=0; i<3; ++i)
+        block.unit[i] = static_cast<float>(delta[i]/length);
+    block.length = static_cast<float>(length);
+    block.acceleration = _limitByAxes(_acceleration, block.unit);
+    const float rapidRate = _limitByAxes(_maxRate, block.unit);
+    block.nominalSpeed = (rapid || feed <= 0.0)? rapidRate: min(static_cast<float>(feed), rapidRate);
+    block.step = step;
+    block.stopBefore = stop;
+    block.rapid = rapid;
+    chunk.blocks.push_back(block);
+    stop = false;
+
+    if(rapid)
+        chunk.rapidLength += length;
+    else
+        chunk.feedLength += length;
+}
+
+
+//////  p l a n  R u n  //////
+void GCodeEstimator::_planRun(const Block* blocks, int count, float* stepTime) const
+{
+    // squared speeds at the entry of every block, the run ends in standstill
+    vector<double> maxEntry(count), entry(count + 1, 0.0);
+
+    // junction speed limits, as in grbl's plan_buffer_line()
+    maxEntry[0] = 0.0;
+    for(int i=1; i < count; ++i){
+        const Block& prev = blocks[i-1];
+        const Block& cur = blocks[i];
+
+        double cosTheta = 0.0;
+        float junction[3];
+        for(int k=0; k<3; ++k){
+            cosTheta -= prev.unit[k]*cur.unit[k];
+            junction[k] = cur.unit[k] - prev.unit[k];
+        }
+
+        double junctionSpeed2;
+        if(cosTheta > 0.999999) // reversal
+            junctionSpeed2 = 0.0;
+        else if(cosTheta < -0.999999) // straight line
+            junctionSpeed2 = 1e30;
+        else{
+            const float norm = ::sqrt(junction[0]*junction[0] + junction[1]*junction[1] + junction[2]*junction[2]);
+            for(int k=0; k<3; ++k)
+                junction[k] /= norm;
+            const double sinThetaD2 = ::sqrt(0.5*(1.0 - cosTheta));
+            junctionSpeed2 = _limitByAxes(_acceleration, junction)*_junctionDeviation*sinThetaD2 / (1.0 - sinThetaD2);
+        }
+
+        const double nominal2 = min(static_cast<double>(prev.nominalSpeed)*prev.nominalSpeed,
+                                    static_cast<double>(cur.nominalSpeed)*cur.nominalSpeed);
+        maxEntry[i] = min(junctionSpeed2, nominal2);
+    }
+
+    // grbl plans only the blocks in its buffer, the last of them has to end in standstill
+    double window = 0.0;
+    for(int i = count-1; i >= 0; --i){
+        window += blocks[i].length;
+        if(i + PLANNER_BLOCKS < count)
+            window -= blocks[i + PLANNER_BLOCKS].length;
+        maxEntry[i] = min(maxEntry[i], 2.0*blocks[i].acceleration*window);
+    }
+
+    // backward pass: deceleration limit
+    for(int i = count-1; i >= 0; --i)
+        entry[i] = min(maxEntry[i], entry[i+1] + 2.0*blocks[i].acceleration*blocks[i].length);
+
+    // forward pass: acceleration limit
+    for(int i=0; i < count-1; ++i)
+        entry[i+1] = min(entry[i+1], entry[i] + 2.0*blocks[i].acceleration*blocks[i].length);
+
+    // trapezoidal profiles
+    for(int i=0; i < count; ++i){
+        const Block& b = blocks[i];
+        const double a = b.acceleration;
+        const double nominal = b.nominalSpeed;
+        const double v0 = ::sqrt(entry[i]), v1 = ::sqrt(entry[i+1]);
+        const double accelDist = (nominal*nominal - entry[i]) / (2.0*a);
+        const double decelDist = (nominal*nominal - entry[i+1]) / (2.0*a);
+
+        double time; // min
+        if(accelDist + decelDist <= b.length)
+            time = (nominal - v0)/a + (nominal - v1)/a + (b.length - accelDist - decelDist)/nominal;
+        else{ // triangle, nominal speed is never reached
+            const double peak = ::sqrt(max(0.5*(2.0*a*b.length + entry[i] + entry[i+1]), max(entry[i], entry[i+1])));
+            time = (peak - v0)/a + (peak - v1)/a;
+        }
+        stepTime[b.step] += static_cast<float>(time*60.0);
+    }
+}
+
+
+float GCodeEstimator::_limitByAxes(const double* maxValue, const float* unit) const
+{
+    double limit = 1e30;
+    for(int i=0; i<3; ++i){
+        if(unit[i] != 0.0f)
+            limit = min(limit, ::fabs(maxValue[i]/unit[i]));
+    }
+    return static_cast<float>(limit);
+}
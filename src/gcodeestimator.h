@@ -0,0 +1,64 @@
+#ifndef GSHARPIE_GCODEESTIMATOR_H
+#define GSHARPIE_GCODEESTIMATOR_H
+#include <vector>
+#include "grblcontrol.h"
+#include "gcodeprogram.h"
+
+
+// run-time estimation following grbl's planner: junction deviation,
+// trapezoidal velocity profiles, limited look-ahead and arc segmentation
+class GCodeEstimator
+{
+public:
+    static const int PLANNER_BLOCKS = 15; // look-ahead of grbl's planner (BLOCK_BUFFER_SIZE-1)
+
+    struct Result
+    {
+        double totalTime; // sec
+        double feedLength; // mm, G1/G2/G3
+        double rapidLength; // mm, G0
+        std::vector<float> stepTime; // sec, for every step of the program
+        std::vector<float> lineTime; // sec, for every source line (loops are accumulated)
+    };
+
+public:
+    explicit GCodeEstimator(const GrblControl::Config& config);
+
+    // thread-safe, can be called from a worker thread as long as the program is not modified
+    Result estimate(const GCodeProgram& program) const;
+
+private:
+    struct Block // planner block, arcs are split into several
+    {
+        float unit[3];
+        float length; // mm
+        float nominalSpeed; // mm/min
+        float acceleration; // mm/min^2
+        int step;
+        bool stopBefore; // planner is emptied before this block
+        bool rapid;
+    };
+
+    struct Chunk // part of the program processed by one thread
+    {
+        int begin, end; // steps
+        std::vector<Block> blocks;
+        bool trailingStop;
+        double feedLength, rapidLength;
+    };
+
+    void _parseChunk(const GCodeProgram& program, Chunk& chunk, float* stepTime) const;
+    void _addBlock(Chunk& chunk, const double* from, const double* to, double feed, bool rapid,
+                   int step, bool& stop) const;
+    void _planRun(const Block* blocks, int count, float* stepTime) const;
+
+    float _limitByAxes(const double* maxValue, const float* unit) const;
+
+private:
+    double _maxRate[3]; // mm/min
+    double _acceleration[3]; // mm/min^2
+    double _junctionDeviation; // mm
+    double _arcTolerance; // mm
+};
+
+#endif // GSHARPIE_GCODEESTIMATOR_H
@@ -0,0 +1,81 @@
+#include <cctype>
+#include <cstdio>
+#include "gcodefilter.h"
+
+using namespace std;
+
+
+bool GCodeFilter::hasMotionWord(const char* code)
+{
+    for(const char* s = code; *s; ++s){
+        if(*s == '(')
+            while(s[1] && *s != ')') ++s;
+        else if(*s == ';')
+            break;
+        else if(::toupper(*s) == 'G'){
+            const char* end;
+            int g = static_cast<int>(GCodeState::readNumber(s+1, &end));
+            if(end != s+1 && (g <= GCodeState::ArcCCW || g == GCodeState::Probe || g == GCodeState::Cancel))
+                return true;
+        }
+    }
+    return false;
+}
+
+
+bool GCodeFilter::hasModalMove(const char* code)
+{
+    bool axis = false;
+    for(const char* s = code; *s; ++s){
+        const char c = ::toupper(*s);
+        if(c == '(')
+            while(s[1] && *s != ')') ++s;
+        else if(c == ';')
+            break;
+        else if(c == 'X' || c == 'Y' || c == 'Z')
+            axis = true;
+        else if(c == 'G'){
+            const char* end;
+            const int g = static_cast<int>(GCodeState::readNumber(s+1, &end) * 10.0 + 0.5);
+            if(g == 100 || g == 280 || g == 300 || g == 920)
+                return false; // the axis words are theirs
+        }
+    }
+    return axis;
+}
+
+
+bool GCodeFilter::isPlainMove(const char* code, int motion)
+{
+    for(const char* s = code; *s; ++s){
+        const char c = ::toupper(*s);
+        if(c == 'G'){
+            const char* end;
+            if(GCodeState::readNumber(s+1, &end) != motion)
+                return false;
+        }
+        else if(c == '(' || c == ';')
+            return false;
+        else if(::isalpha(c) && c != 'X' && c != 'Y' && c != 'Z' && c != 'F' && c != 'N')
+            return false;
+    }
+    return true;
+}
+
+
+void GCodeFilter::_emitOriginal(int lineNumber, const char* code, int motion)
+{
+    if(!hasMotionWord(code) && !hasModalMove(code)){
+        _emit(lineNumber, code); // "M3S1000" does not want G1 in front, the output mode stays what it was
+        return;
+    }
+
+    if(motion != _outMotion && motion != GCodeState::Probe && !hasMotionWord(code)){
+        char prefix[8];
+        ::sprintf(prefix, "G%d", motion);
+        _emit(lineNumber, prefix + string(code));
+    }
+    else
+        _emit(lineNumber, code);
+    _outMotion = motion;
+}
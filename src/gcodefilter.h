@@ -0,0 +1,82 @@
+#ifndef GSHARPIE_GCODEFILTER_H
+#define GSHARPIE_GCODEFILTER_H
+#include <cstring>
+#include <string>
+#include "gcodeprogram.h"
+
+
+// streaming transformation of the expanded program, filters can be chained;
+// output lines keep the source line number of the input they were made from
+class GCodeFilter
+{
+public:
+    struct Statistics
+    {
+        int linesIn, linesOut;
+        size_t bytesIn, bytesOut; // including line ends
+    };
+
+public:
+    GCodeFilter() {_next = nullptr; _program = nullptr; reset();}
+    virtual ~GCodeFilter() {}
+
+    virtual const char* name() const = 0;
+
+    inline void setOutput(GCodeFilter* next) {_next = next; _program = nullptr;}
+    inline void setOutput(GCodeProgram* program) {_program = program; _next = nullptr;}
+
+    // prepares for a new program
+    virtual void reset() {_stats = Statistics(); _outMotion = GCodeState::Rapid;}
+
+    inline void push(int lineNumber, const char* code)
+    {
+        ++_stats.linesIn;
+        _stats.bytesIn += ::strlen(code) + 1;
+        _process(lineNumber, code);
+    }
+
+    // end of the program, buffered lines are passed further
+    virtual void flush() {if(_next) _next->flush();}
+
+    inline const Statistics& statistics() const {return _stats;}
+
+    // line contains G0, G1, G2, G3, G38.x or G80
+    static bool hasMotionWord(const char* code);
+
+    // line contains X, Y or Z words for the modal motion (not for G10, G28, G30 or G92)
+    static bool hasModalMove(const char* code);
+
+    // line contains nothing but G<motion>, coordinates and feed rate
+    static bool isPlainMove(const char* code, int motion);
+
+protected:
+    virtual void _process(int lineNumber, const char* code) = 0;
+
+    // passes the line through, restoring the motion mode (of the input) if the filter has changed it and the line moves
+    void _emitOriginal(int lineNumber, const char* code, int motion);
+
+    // generated line with explicit motion word
+    inline void _emitMotion(int lineNumber, const std::string& code, int motion)
+    {
+        _outMotion = motion;
+        _emit(lineNumber, code);
+    }
+
+    inline void _emit(int lineNumber, const std::string& code)
+    {
+        ++_stats.linesOut;
+        _stats.bytesOut += code.size() + 1;
+        if(_next)
+            _next->push(lineNumber, code.c_str());
+        else if(_program)
+            _program->append(lineNumber, code);
+    }
+
+private:
+    GCodeFilter* _next;
+    GCodeProgram* _program;
+    Statistics _stats;
+    int _outMotion; // motion mode of the output stream
+};
+
+#endif // GSHARPIE_GCODEFILTER_H
@@ -0,0 +1,121 @@
+#include <QtWidgets>
+#include <QtConcurrent>
+#include "gcodehighlighter.h"
+
+
+// tokens of a block, valid while its revision does not change
+class TokenData : public QTextBlockUserData
+{
+public:
+    int revision;
+    std::vector<GCodeTokenizer::Token> tokens;
+};
+
+
+GCodeHighlighter::GCodeHighlighter(QPlainTextEdit* editor) : QObject(editor)
+{
+    _editor = editor;
+    _pending = false;
+    _formatting = false;
+
+    _watcher = new QFutureWatcher<std::vector<Job>>(this);
+    connect(_watcher, SIGNAL(finished()), this, SLOT(_tokenized()));
+}
+
+
+GCodeHighlighter::~GCodeHighlighter()
+{
+    _watcher->waitForFinished();
+}
+
+
+QColor GCodeHighlighter::color(GCodeTokenizer::TYPE type)
+{
+    switch(type){
+        case GCodeTokenizer::Command:   return QColor(0, 0, 192);
+        case GCodeTokenizer::Parameter: return QColor(128, 0, 128);
+        case GCodeTokenizer::Flow:      return QColor(176, 96, 0);
+        case GCodeTokenizer::Comment:   return QColor(128, 128, 128);
+    }
+    return QColor(Qt::black);
+}
+
+
+//////  h i g h l i g h t  V i s i b l e  //////
+void GCodeHighlighter::highlightVisible()
+{
+    if(_watcher->isRunning()){
+        _pending = true; // comes back when finished
+        return;
+    }
+
+    // visible blocks which have changed since they were tokenized
+    std::vector<Job> jobs;
+    const int bottom = _editor->viewport()->height();
+    QTextBlock block = _editor->document()->findBlockByNumber(_editor->verticalScrollBar()->value());
+    for(int top = 0; block.isValid() && top <= bottom; block = block.next()){
+        const TokenData* data = static_cast<const TokenData*>(block.userData());
+        if(!data || data->revision != block.revision()){
+            Job job;
+            job.block = block.blockNumber();
+            job.revision = block.revision();
+            job.text = block.text().toLatin1();
+            jobs.push_back(job);
+        }
+        top += _editor->fontMetrics().height();
+    }
+    if(jobs.empty())
+        return;
+
+    _watcher->setFuture(QtConcurrent::run([jobs]() mutable {
+        for(size_t i=0; i < jobs.size(); ++i)
+            GCodeTokenizer::tokenize(jobs[i].text.constData(), jobs[i].text.size(), jobs[i].tokens);
+        return jobs;
+    }));
+}
+
+
+//////  t o k e n i z e d  //////
+void GCodeHighlighter::_tokenized()
+{
+    const std::vector<Job> jobs = _watcher->result();
+    for(size_t i=0; i < jobs.size(); ++i){
+        QTextBlock block = _editor->document()->findBlockByNumber(jobs[i].block);
+        if(!block.isValid() || block.revision() != jobs[i].revision)
+            continue; // edited meanwhile, tokenized again below
+
+        TokenData* data = static_cast<TokenData*>(block.userData());
+        if(!data){
+            data = new TokenData;
+            block.setUserData(data); // owned by the block
+        }
+        data->revision = jobs[i].revision;
+        data->tokens = jobs[i].tokens;
+        _apply(block);
+    }
+
+    if(_pending){
+        _pending = false;
+        highlightVisible();
+    }
+}
+
+
+void GCodeHighlighter::_apply(const QTextBlock& block)
+{
+    const TokenData* data = static_cast<const TokenData*>(block.userData());
+    QVector<QTextLayout::FormatRange> formats;
+    for(size_t i=0; i < data->tokens.size(); ++i){
+        QTextLayout::FormatRange range;
+        range.start = data->tokens[i].start;
+        range.length = data->tokens[i].length;
+        range.format.setForeground(color(data->tokens[i].type));
+        formats.append(range);
+    }
+
+    // colors only, the block keeps its geometry
+    _formatting = true;
+    block.layout()->setFormats(formats);
+    _editor->document()->markContentsDirty(block.position(), block.length());
+    _formatting = false;
+}
@@ -0,0 +1,53 @@
+#ifndef GSHARPIE_GCODEHIGHLIGHTER_H
+#define GSHARPIE_GCODEHIGHLIGHTER_H
+
+#include <vector>
+#include <QObject>
+#include <QColor>
+#include <QByteArray>
+#include <QFutureWatcher>
+#include <QTextBlockUserData>
+#include "gcodetokenizer.h"
+
+class QPlainTextEdit;
+
+
+// colors the visible blocks of an editor, lines are tokenized in background and cached with their blocks
+class GCodeHighlighter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Job
+    {
+        int block; // number
+        int revision; // of the block when its text was taken
+        QByteArray text; // latin1, one character per position
+        std::vector<GCodeTokenizer::Token> tokens;
+    };
+
+public:
+    GCodeHighlighter(QPlainTextEdit* editor);
+    ~GCodeHighlighter();
+
+    static QColor color(GCodeTokenizer::TYPE type);
+
+    inline bool isFormatting() const {return _formatting;} // document changes are formats only
+
+public slots:
+    void highlightVisible();
+
+private slots:
+    void _tokenized();
+
+private:
+    void _apply(const QTextBlock& block);
+
+private:
+    QPlainTextEdit* _editor;
+    QFutureWatcher<std::vector<Job>>* _watcher;
+    bool _pending; // visible blocks have changed while tokenizing
+    bool _formatting;
+};
+
+#endif // GSHARPIE_GCODEHIGHLIGHTER_H
@@ -0,0 +1,72 @@
+#include <cstring>
+#include "gcodelineindex.h"
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GCODELINEINDEX_SSE
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+#ifdef GCODELINEINDEX_SSE
+static inline int lowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return static_cast<int>(bit);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+
+void GCodeLineIndex::clear()
+{
+    std::vector<int64_t>().swap(_starts);
+    _starts.push_back(0); // no lines
+    _longest = 0;
+}
+
+
+//////  b u i l d  //////
+void GCodeLineIndex::build(const char* text, int64_t size)
+{
+    _starts.clear();
+    _starts.reserve(static_cast<size_t>(size/16 + 2));
+    _starts.push_back(0);
+    int64_t longest = 0;
+
+    int64_t i = 0;
+#ifdef GCODELINEINDEX_SSE
+    // 16 characters compared at once, one bit per new line
+    const __m128i newLine = _mm_set1_epi8('\n');
+    for(; i + 16 <= size; i += 16){
+        const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, newLine)));
+        while(mask){
+            const int64_t start = i + lowestBit(mask) + 1;
+            if(start - _starts.back() > longest)
+                longest = start - _starts.back();
+            _starts.push_back(start);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i < size; ++i){
+        const char* s = static_cast<const char*>(::memchr(text + i, '\n', static_cast<size_t>(size - i)));
+        if(!s)
+            break;
+        i = s - text;
+        if(i + 1 - _starts.back() > longest)
+            longest = i + 1 - _starts.back();
+        _starts.push_back(i + 1);
+    }
+
+    if(size - _starts.back() > longest)
+        longest = size - _starts.back();
+    _starts.push_back(size); // last line, empty after a final new line
+    _longest = static_cast<int>(longest);
+}
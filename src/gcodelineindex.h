@@ -0,0 +1,27 @@
+#ifndef GSHARPIE_GCODELINEINDEX_H
+#define GSHARPIE_GCODELINEINDEX_H
+
+#include <cstdint>
+#include <vector>
+
+
+// offsets of the line starts in a text, any line is found in constant time
+class GCodeLineIndex
+{
+public:
+    GCodeLineIndex() {clear();}
+
+    void build(const char* text, int64_t size);
+    void clear();
+
+    inline int lineCount() const {return static_cast<int>(_starts.size()) - 1;}
+    inline int64_t lineStart(int index) const {return _starts[index];}
+    inline int64_t lineEnd(int index) const {return _starts[index+1];} // after the end of line
+    inline int longestLine() const {return _longest;} // characters, with the end of line
+
+private:
+    std::vector<int64_t> _starts; // and the end of the text
+    int _longest;
+};
+
+#endif // GSHARPIE_GCODELINEINDEX_H
@@ -0,0 +1,214 @@
+#include <cstring>
+#include <algorithm>
+#include "gcodeprogram.h"
+
+using namespace std;
+
+static const int MIN_GAP_STEPS = 1024; // room made at once, the tables grow by a quarter at least
+static const size_t MIN_GAP_BYTES = 65536;
+
+
+void GCodeProgram::clear()
+{
+    _text.clear();
+    _textGap = _textGapSize = 0;
+    _bytes = 0;
+    _offsets.clear();
+    _lines.clear();
+    _size = _gap = _gapSteps = _lineShift = 0;
+    _state.reset();
+    _checkpoints.assign(1, Checkpoint(0, _state));
+    _ordered = true;
+    _firstStep.clear();
+}
+
+
+void GCodeProgram::append(int lineNumber, const string& code)
+{
+    if(_size - _checkpoints.back().first >= CHECKPOINT_INTERVAL)
+        _checkpoints.push_back(Checkpoint(_size, _state));
+
+    if(_ordered && _size > 0 && lineNumber < this->lineNumber(_size - 1)){ // loops or subroutines
+        _ordered = false;
+        _indexLines();
+    }
+    if(!_ordered)
+        _firstStep.insert(make_pair(lineNumber, _size)); // keeps the first one
+
+    _moveGap(_size);
+    _insert(lineNumber, code);
+    _state.update(code);
+}
+
+
+vector<int> GCodeProgram::lineNumbers() const
+{
+    vector<int> numbers;
+    numbers.reserve(_size);
+    for(int step=0; step < _size; ++step)
+        numbers.push_back(lineNumber(step));
+    return numbers;
+}
+
+
+//////  s p l i c e  //////
+void GCodeProgram::splice(int step, int count, const vector<pair<int, string>>& lines, int lineDelta)
+{
+    // removed steps join the gap, the ones behind it move by lineDelta
+    _moveGap(step);
+    const size_t end = (step + count < _size)? _offsets[step + count + _gapSteps]: _text.size();
+    _bytes -= end - (_textGap + _textGapSize);
+    _textGapSize = end - _textGap;
+    _gapSteps += count;
+    _size -= count;
+    _lineShift += lineDelta;
+    for(const auto& line: lines)
+        _insert(line.first, line.second);
+
+    const int changedEnd = step + static_cast<int>(lines.size());
+    if(_ordered){
+        for(int i = max(step, 1); i <= changedEnd && i < _size && _ordered; ++i)
+            _ordered = (lineNumber(i-1) <= lineNumber(i));
+        if(!_ordered)
+            _indexLines();
+    }
+    else
+        _indexLines(); // programs with G# constructs are loaded again rather than edited
+
+    // checkpoints before the change stay, the ones inside it are made again, the ones after it move with the steps
+    auto byStep = [](int s, const Checkpoint& checkpoint){return s < checkpoint.first;};
+    auto keep = upper_bound(_checkpoints.begin(), _checkpoints.end(), step, byStep);
+    auto after = keep;
+    const int stepDelta = changedEnd - (step + count);
+    while(after != _checkpoints.end() && (after->first < step + count || after->first + stepDelta <= (keep-1)->first))
+        ++after;
+    for(auto it = after; it != _checkpoints.end(); ++it)
+        it->first += stepDelta;
+
+    GCodeState state = (keep-1)->second;
+    int last = (keep-1)->first;
+    vector<Checkpoint> fresh;
+    int i = last;
+    for(; i < changedEnd; ++i){
+        if(i - last >= CHECKPOINT_INTERVAL){
+            fresh.push_back(Checkpoint(i, state));
+            last = i;
+        }
+        state.update(codePtr(i));
+    }
+    const size_t at = (keep - _checkpoints.begin()) + fresh.size();
+    _checkpoints.insert(_checkpoints.erase(keep, after), fresh.begin(), fresh.end());
+
+    // modal state differs from the change on until it meets an old checkpoint again, the rest is as it was
+    for(size_t k = at; i < _size; ++i){
+        if(k < _checkpoints.size() && _checkpoints[k].first == i){
+            if(_checkpoints[k].second == state)
+                return;
+            _checkpoints[k++].second = state;
+        }
+        state.update(codePtr(i));
+    }
+    _state = state;
+}
+
+
+int GCodeProgram::findStep(int lineNumber) const
+{
+    if(!_ordered){
+        auto it = _firstStep.find(lineNumber);
+        return (it != _firstStep.end())? it->second: -1;
+    }
+    const int step = lowerStep(lineNumber);
+    return (step < _size && this->lineNumber(step) == lineNumber)? step: -1;
+}
+
+
+int GCodeProgram::lowerStep(int lineNumber) const
+{
+    int low = 0, high = _size;
+    while(low < high){
+        const int middle = low + (high - low)/2;
+        if(this->lineNumber(middle) < lineNumber)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+
+GCodeState GCodeProgram::stateAt(int step) const
+{
+    if(step >= size())
+        return _state;
+
+    auto it = upper_bound(_checkpoints.begin(), _checkpoints.end(), step,
+                          [](int s, const Checkpoint& checkpoint){return s < checkpoint.first;}) - 1;
+    GCodeState state = it->second;
+    for(int i = it->first; i < step; ++i)
+        state.update(codePtr(i));
+    return state;
+}
+
+
+//////  g a p  //////
+void GCodeProgram::_moveGap(int step)
+{
+    if(step < _gap){ // steps [step, _gap) go behind the gap
+        const size_t begin = _offsets[step];
+        ::memmove(&_text[begin + _textGapSize], &_text[begin], _textGap - begin);
+        for(int i = _gap-1; i >= step; --i){
+            _offsets[i + _gapSteps] = _offsets[i] + _textGapSize;
+            _lines[i + _gapSteps] = _lines[i] - _lineShift;
+        }
+        _textGap = begin;
+    }
+    else if(step > _gap){ // steps [_gap, step) go in front of it
+        const size_t begin = _textGap + _textGapSize;
+        const size_t end = (step < _size)? _offsets[step + _gapSteps]: _text.size();
+        ::memmove(&_text[_textGap], &_text[begin], end - begin);
+        for(int i = _gap; i < step; ++i){
+            _offsets[i] = _offsets[i + _gapSteps] - _textGapSize;
+            _lines[i] = _lines[i + _gapSteps] + _lineShift;
+        }
+        _textGap += end - begin;
+    }
+    _gap = step;
+}
+
+
+void GCodeProgram::_insert(int lineNumber, const string& code)
+{
+    const size_t length = code.size() + 1;
+    if(_gapSteps < 1){ // the steps behind the gap move, the tables grow by a quarter
+        const int grow = max(MIN_GAP_STEPS, _size/4);
+        _offsets.insert(_offsets.begin() + _gap, grow, 0);
+        _lines.insert(_lines.begin() + _gap, grow, 0);
+        _gapSteps += grow;
+    }
+    if(_textGapSize < length){
+        const size_t grow = max(max(MIN_GAP_BYTES, _bytes/4), length);
+        _text.insert(_textGap + _textGapSize, grow, '\0');
+        for(int i = _gap + _gapSteps; i < static_cast<int>(_offsets.size()); ++i)
+            _offsets[i] += grow;
+        _textGapSize += grow;
+    }
+
+    ::memcpy(&_text[_textGap], code.c_str(), length);
+    _offsets[_gap] = _textGap;
+    _lines[_gap] = lineNumber;
+    ++_gap;
+    --_gapSteps;
+    ++_size;
+    _textGap += length;
+    _textGapSize -= length;
+    _bytes += length;
+}
+
+
+void GCodeProgram::_indexLines()
+{
+    _firstStep.clear();
+    for(int step = _size-1; step >= 0; --step)
+        _firstStep[lineNumber(step)] = step;
+}
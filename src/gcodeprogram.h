@@ -0,0 +1,68 @@
+#ifndef GSHARPIE_GCODEPROGRAM_H
+#define GSHARPIE_GCODEPROGRAM_H
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "gcodestate.h"
+
+
+// expanded (plain g-code) program as it is streamed to grbl,
+// each step keeps reference to the source line it was generated from
+class GCodeProgram
+{
+public:
+    static const int CHECKPOINT_INTERVAL = 1024; // steps between modal state snapshots
+
+public:
+    GCodeProgram() {clear();}
+
+    void clear();
+    void append(int lineNumber, const std::string& code);
+
+    // replaces count steps from the given one with new lines, source lines of the following steps move by lineDelta;
+    // it costs the new lines plus the steps between this edit and the previous one
+    void splice(int step, int count, const std::vector<std::pair<int, std::string>>& lines, int lineDelta);
+
+    inline int size() const {return _size;}
+    inline bool isEmpty() const {return _size == 0;}
+    inline size_t byteSize() const {return _bytes;} // as sent, with line ends
+
+    inline int lineNumber(int step) const {return (step < _gap)? _lines[step]: _lines[step + _gapSteps] + _lineShift;}
+    std::vector<int> lineNumbers() const; // of all steps
+    inline const char* codePtr(int step) const {return _text.data() + _offsets[(step < _gap)? step: step + _gapSteps];} // null-terminated
+    inline std::string code(int step) const {return std::string(codePtr(step));}
+
+    // first step generated from the source line, or -1 if not expanded (yet)
+    int findStep(int lineNumber) const;
+    // first step of the source line or of a later one, size() if none; the steps must follow the source lines
+    int lowerStep(int lineNumber) const;
+
+    // modal state before executing the step: nearest checkpoint plus a few replayed lines
+    GCodeState stateAt(int step) const;
+
+    // state after the last appended step
+    inline const GCodeState& finalState() const {return _state;}
+
+private:
+    typedef std::pair<int, GCodeState> Checkpoint; // state before the step
+
+    void _moveGap(int step); // in front of the step
+    void _insert(int lineNumber, const std::string& code); // into the gap, as the step in front of it
+    void _indexLines(); // _firstStep of all steps
+
+private:
+    // the tables have a gap where the last edit was, moving it costs only the steps it passes
+    std::string _text; // all steps back to back, null-terminated; _textGapSize free bytes at _textGap
+    size_t _textGap, _textGapSize;
+    size_t _bytes; // in use
+    std::vector<size_t> _offsets; // of every step in _text; _gapSteps free entries at _gap
+    std::vector<int> _lines; // source line of every step, the ones behind the gap are _lineShift lower
+    int _size, _gap, _gapSteps, _lineShift;
+
+    std::vector<Checkpoint> _checkpoints; // about every CHECKPOINT_INTERVAL steps, the first one at step 0
+    bool _ordered; // source lines of the steps never go back, steps are found by bisection
+    std::unordered_map<int, int> _firstStep; // source line -> first step, if not ordered
+    GCodeState _state;
+};
+
+#endif // GSHARPIE_GCODEPROGRAM_H
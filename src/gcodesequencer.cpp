@@ -1,8 +1,50 @@
 #include <string>
+#include <cstdio>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
 #include <QDebug>
 #include "gcodesequencer.h"
 #include "grblcontrol.h"
 
+static const int MAX_LINE_NUMBER = 9999999; // grbl rejects larger N words
+static const size_t MAX_LINE_LENGTH = 79;   // grbl line buffer
+
+
+// parameters, expressions or O-words (subroutines, loops, conditions) make lines depend on each other
+static bool usesGSharp(const char* text, const char* end)
+{
+    for(const char* s = text; s < end; ++s){
+        switch(*s){
+            case '(':
+                while(s+1 < end && *s != ')' && *s != '\n') ++s;
+                break;
+            case ';':
+                while(s+1 < end && *s != '\n') ++s;
+                break;
+            case '#': case '[': case 'O': case 'o':
+                return true;
+        }
+    }
+    return false;
+}
+
+
+// axis words outside comments, the line moves in the modal motion mode unless it has a motion word
+static bool hasAxisWord(const std::string& line)
+{
+    for(const char* s = line.c_str(); *s; ++s){
+        if(*s == '(')
+            while(s[1] && *s != ')') ++s;
+        else if(*s == ';')
+            break;
+        else if(::strchr("XYZxyz", *s))
+            return true;
+    }
+    return false;
+}
+
 
 void GCodeSequencer::setGrblControl(GrblControl* grbl)
 {
@@ -13,10 +55,32 @@ void GCodeSequencer::setGrblControl(GrblControl* grbl)
 
 
 int GCodeSequencer::loadProgram(const QString& program, QString* errorMsg)
+{
+    const std::string text = program.toStdString();
+    return loadProgram(text.data(), text.size(), errorMsg);
+}
+
+
+int GCodeSequencer::loadProgram(const char* program, size_t length, QString* errorMsg)
 {
     _ready = false;
+    _source.clear();
+    _program.clear();
+    _filtered = false;
+    _filters.clear();
+    _travelOptimizer.clearPlan();
+    _step = 0;
+    _resumeMotion.clear();
+    _expanded = false;
+    _cancel = false;
+    _progress = 0;
+    _issues.clear();
+    std::string text;
+    text.reserve(length);
+    std::remove_copy(program, program + length, std::back_inserter(text), '\r');
+    _plain = !usesGSharp(text.data(), text.data() + text.size());
     try{
-        _interp.Load(program.toStdString());
+        _interp.Load(text);
     }
     catch(std::exception& e){
         if(errorMsg)
@@ -31,18 +95,297 @@ int GCodeSequencer::loadProgram(const QString& program, QString* errorMsg)
 
 void GCodeSequencer::rewindProgram()
 {
-    _interp.Rewind();
+    _step = 0; // already expanded lines are replayed from the cache
+    _resumeMotion.clear();
 }
 
 
 bool GCodeSequencer::nextLine(int& lineNumber, std::string& line, QString* errorMsg)
 {
+    if(_filtered){
+        if(_step >= _program.size())
+            return false; // finished
+    }
+    else if(_step >= _source.size() && !_expandNext(lineNumber, errorMsg))
+        return false; // finished or error
+
+//qDebug() << "Next cmd in sequence:" << line.c_str();
+    lineNumber = program().lineNumber(_step);
+    line = program().code(_step);
+
+    if(!_resumeMotion.empty()){ // resumed inside an arc mode, its first move has to set it again
+        if(GCodeFilter::hasMotionWord(line.c_str()))
+            _resumeMotion.clear();
+        else if(hasAxisWord(line)){
+            size_t at = 0;
+            if(line[0] == 'N' || line[0] == 'n') // line number stays first
+                for(at = 1; at < line.size() && ::isdigit(line[at]); ++at) ;
+            line.insert(at, _resumeMotion);
+            _resumeMotion.clear();
+        }
+    }
+
+    // executed line is reported as N word, numbers wrap around on very long programs
+    char number[16];
+    const int length = ::sprintf(number, "N%d", _step % MAX_LINE_NUMBER + 1);
+    if(line[0] != 'N' && line.size() + length <= MAX_LINE_LENGTH)
+        line.insert(0, number, length);
+
+    ++_step;
+    return true;
+}
+
+
+int GCodeSequencer::executedStep(int lineNumber) const
+{
+    if(lineNumber <= 0 || _step <= 0)
+        return -1;
+
+    // executed step is behind the last sent one, at most grbl's buffers apart
+    const int lastNumber = (_step - 1) % MAX_LINE_NUMBER + 1;
+    const int behind = (lastNumber - lineNumber + MAX_LINE_NUMBER) % MAX_LINE_NUMBER;
+    return (behind < _step)? _step - 1 - behind: -1;
+}
+
+
+//////  u p d a t e  P r o g r a m  //////
+bool GCodeSequencer::updateProgram(const QString& fragment, int firstLine, int lastLine, int lineDelta,
+                                   int& errorLine, QString* errorMsg)
+{
+    errorLine = 0;
+    if(!isReady() || !_plain)
+        return false;
+    _travelOptimizer.clearPlan(); // made for the program before the change
+
+    // changed lines only, plain g-code does not depend on the rest of the program
+    const std::string text = fragment.toStdString();
+    if(usesGSharp(text.data(), text.data() + text.size())){
+        _plain = false;
+        return false;
+    }
+
+    std::vector<std::pair<int, std::string>> lines;
+    std::vector<Issue> issues;
+    gsharp::Interpreter interp;
+    interp.EnablePrettyFormat(false);
+    try{
+        interp.Load(text);
+        std::string line;
+        gsharp::ExtraInfo extra;
+        while(interp.Step(line, extra)){
+            if(line.empty())
+                continue;
+            const int lineNumber = interp.GetCurrentLineNumber() + firstLine - 1;
+            lines.push_back(std::make_pair(lineNumber, line));
+            const char* error = GCodeState::grblError(line.c_str());
+            if(error){
+                Issue issue = {lineNumber, QString(error)};
+                issues.push_back(issue);
+            }
+        }
+    }
+    catch(std::exception& e){
+        if(errorMsg)
+            *errorMsg = QString(e.what());
+        errorLine = interp.GetCurrentLineNumber() + firstLine - 1;
+        _ready = false; // the whole program is loaded again after the next edit
+        return true;
+    }
+
+    // steps of plain g-code follow the source lines
+    const int oldLast = lastLine - lineDelta;
+    const int first = _source.lowerStep(firstLine);
+    const int last = _source.lowerStep(oldLast + 1);
+    _source.splice(first, last - first, lines, lineDelta);
+
+    std::vector<Issue> merged;
+    for(const Issue& issue: _issues){
+        if(issue.lineNumber < firstLine)
+            merged.push_back(issue);
+    }
+    merged.insert(merged.end(), issues.begin(), issues.end());
+    for(const Issue& issue: _issues){
+        if(issue.lineNumber > oldLast){
+            merged.push_back(issue);
+            merged.back().lineNumber += lineDelta;
+        }
+    }
+    _issues.swap(merged);
+
+    // the interpreter keeps the old text, it is not needed as the program is expanded
+    _program.clear();
+    _filtered = false;
+    _step = 0;
+    _resumeMotion.clear();
+    return true;
+}
+
+
+//////  e x p a n d  P r o g r a m  //////
+int GCodeSequencer::expandProgram(QString* errorMsg)
+{
+    int errorLine = 0;
+    while(!_cancel && _expandNext(errorLine, errorMsg))
+        ;
+    return errorLine;
+}
+
+
+//////  a p p l y  F i l t e r s  //////
+bool GCodeSequencer::applyFilters()
+{
+    _filters.clear();
+    if(_travelOptimizer.isReady())
+        _filters.push_back(&_travelOptimizer);
+    if(_airCutRemoval)
+        _filters.push_back(&_airCutRemover);
+    if(_arcFitting){
+        double tolerance = _arcFitTolerance;
+        if(tolerance <= 0.0 && _grbl)
+            tolerance = _grbl->getConfiguration().arcTolerance;
+        _arcFitter.setTolerance((tolerance > 0.0)? tolerance: 0.002);
+        _filters.push_back(&_arcFitter);
+    }
+    if(_decimation)
+        _filters.push_back(&_decimator);
+    _compensationRefusal.lineNumber = 0;
+    const char* reason = nullptr;
+    const int refused = (_compensation && _compensator.isReady())? HeightCompensator::unsupportedLine(_source, &reason): 0;
+    if(refused > 0){ // the whole program or nothing, a move left above or below the surface could break the tool
+        _compensationRefusal.lineNumber = refused;
+        _compensationRefusal.message = QString(reason);
+    }
+    else if(_compensation && _compensator.isReady()){
+        double tolerance = _grbl? _grbl->getConfiguration().arcTolerance: 0.0;
+        _compensator.setTolerance((tolerance > 0.0)? tolerance: 0.002); // arcs are flattened
+        _filters.push_back(&_compensator);
+    }
+
+    _program.clear();
+    _filtered = _expanded && !_filters.empty(); // filters need the whole program
+    _step = 0;
+    _resumeMotion.clear();
+    if(!_filtered)
+        return false;
+
+    for(size_t i=0; i < _filters.size(); ++i){
+        _filters[i]->reset();
+        if(i+1 < _filters.size())
+            _filters[i]->setOutput(_filters[i+1]);
+        else
+            _filters[i]->setOutput(&_program);
+    }
+
+    GCodeFilter* first = _filters.front();
+    for(int step=0; step < _source.size(); ++step)
+        first->push(_source.lineNumber(step), _source.codePtr(step));
+    first->flush();
+    return true;
+}
+
+
+GCodeSequencer::LaterFilters GCodeSequencer::laterFilters() const
+{
+    LaterFilters later;
+    later.airCutRemover = _airCutRemover;
+    later.arcFitter = _arcFitter;
+    later.decimator = _decimator;
+    later.compensator = _compensator;
+    later.airCutRemoval = later.arcFitting = later.decimation = later.compensation = false;
+    for(const GCodeFilter* filter: _filters){
+        later.airCutRemoval = later.airCutRemoval || filter == &_airCutRemover;
+        later.arcFitting = later.arcFitting || filter == &_arcFitter;
+        later.decimation = later.decimation || filter == &_decimator;
+        later.compensation = later.compensation || filter == &_compensator;
+    }
+    if(later.compensation)
+        later.heightMap = *_compensator.heightMap(); // the map may be probed again meanwhile
+    return later;
+}
+
+
+bool GCodeSequencer::LaterFilters::apply(const GCodeProgram& program, GCodeProgram& filtered)
+{
+    std::vector<GCodeFilter*> chain; // in the order of applyFilters()
+    if(airCutRemoval)
+        chain.push_back(&airCutRemover);
+    if(arcFitting)
+        chain.push_back(&arcFitter);
+    if(decimation)
+        chain.push_back(&decimator);
+    if(compensation){
+        compensator.setHeightMap(&heightMap);
+        chain.push_back(&compensator);
+    }
+
+    filtered.clear();
+    if(chain.empty())
+        return false;
+    for(size_t i=0; i < chain.size(); ++i){
+        chain[i]->reset();
+        if(i+1 < chain.size())
+            chain[i]->setOutput(chain[i+1]);
+        else
+            chain[i]->setOutput(&filtered);
+    }
+    for(int step=0; step < program.size(); ++step)
+        chain.front()->push(program.lineNumber(step), program.codePtr(step));
+    chain.front()->flush();
+    return true;
+}
+
+
+//////  s e e k  L i n e  //////
+bool GCodeSequencer::seekLine(int lineNumber, double safeZ, double plungeFeed, std::vector<std::string>& preamble,
+                              QString* errorMsg)
+{
+    int step = program().findStep(lineNumber);
+    int errorLine;
+    while(step < 0 && !_filtered && _expandNext(errorLine, errorMsg)){
+        if(_source.lineNumber(_source.size()-1) == lineNumber)
+            step = _source.size()-1;
+    }
+
+    if(step < 0){
+        if(errorMsg && errorMsg->isEmpty())
+            *errorMsg = QString("line ") + QString::number(lineNumber) + QString(" has no g-code to execute");
+        return false;
+    }
+
+    const GCodeState state = program().stateAt(step);
+    const char* reason = nullptr;
+    if(!state.preamble(safeZ, plungeFeed, preamble, &reason)){
+        if(errorMsg)
+            *errorMsg = QString(reason);
+        return false;
+    }
+    _resumeMotion.clear();
+    if(state.motionMode() == GCodeState::ArcCW || state.motionMode() == GCodeState::ArcCCW)
+        _resumeMotion = (state.motionMode() == GCodeState::ArcCW)? "G2": "G3"; // the preamble ends in G1
+    _step = step;
+    return true;
+}
+
+
+//////  e x p a n d  N e x t  //////
+bool GCodeSequencer::_expandNext(int& lineNumber, QString* errorMsg)
+{
+    if(_expanded)
+        return false;
+
+    std::string line;
     gsharp::ExtraInfo extra;
     try{
         while(_interp.Step(line, extra)){
             if(!line.empty()){
-//qDebug() << "Next cmd in sequence:" << line.c_str();
-                lineNumber = _interp.GetCurrentLineNumber();
+                const int lineNumber = _interp.GetCurrentLineNumber();
+                _source.append(lineNumber, line);
+                _progress = lineNumber;
+                const char* error = GCodeState::grblError(line.c_str());
+                if(error){
+                    Issue issue = {lineNumber, QString(error)};
+                    _issues.push_back(issue);
+                }
                 return true;
             }
         }
@@ -51,7 +394,14 @@ bool GCodeSequencer::nextLine(int& lineNumber, std::string& line, QString* error
         if(errorMsg)
             *errorMsg = QString(e.what());
         lineNumber = _interp.GetCurrentLineNumber();
+        // interpreter cannot continue after an error, start from scratch next time
+        _interp.Rewind();
+        _source.clear();
+        _step = 0;
+        _resumeMotion.clear();
         return false; // error line
     }
+
+    _expanded = true;
     return false; // finished
 }
@@ -1,9 +1,17 @@
 #ifndef GSHARPIE_GCODESEQUENCER_H
 #define GSHARPIE_GCODESEQUENCER_H
+#include <vector>
+#include <atomic>
 #include <QObject>
 #include <QString>
 #include "gsharp.h"
 #include "grblcontrol.h"
+#include "gcodeprogram.h"
+#include "arcfitter.h"
+#include "decimator.h"
+#include "heightcompensator.h"
+#include "traveloptimizer.h"
+#include "aircutremover.h"
 
 
 
@@ -12,24 +20,124 @@ class GCodeSequencer: public QObject
     Q_OBJECT
 
 public:
-    GCodeSequencer() {_grbl = nullptr;}
+    struct Issue // line which grbl would reject
+    {
+        int lineNumber;
+        QString message;
+    };
+
+    // copies of the filters applied after the travel ordering last time, with their settings and height map;
+    // they may run on another thread while the sequencer changes
+    struct LaterFilters
+    {
+        AirCutRemover airCutRemover;
+        ArcFitter arcFitter;
+        Decimator decimator;
+        HeightCompensator compensator;
+        HeightMap heightMap;
+        bool airCutRemoval, arcFitting, decimation, compensation;
+
+        // returns false (and leaves filtered empty) if none is enabled
+        bool apply(const GCodeProgram& program, GCodeProgram& filtered);
+    };
+
+public:
+    GCodeSequencer() {_grbl = nullptr; _ready = _expanded = _cancel = _plain = false; _progress = 0;
+                      _filtered = false; _arcFitting = false; _arcFitTolerance = 0.0; _decimation = false;
+                      _airCutRemoval = false; _compensation = false; _compensationRefusal.lineNumber = 0;}
 
     void setGrblControl(GrblControl* grbl);
 
     // returns error line number or 0 if no errors
     int loadProgram(const QString& program, QString* errorMsg=nullptr);
+    int loadProgram(const char* program, size_t length, QString* errorMsg=nullptr); // utf-8, any line ends
 
     void rewindProgram();
 
-    inline bool isReady() const {return _ready;}
+    // loaded and completely interpreted without errors
+    inline bool isReady() const {return _ready && _expanded;}
 
     bool nextLine(int& lineNumber, std::string& line, QString* errorMsg=nullptr);
 
+    // interprets the rest of the program in advance, returns error line number or 0 if no errors;
+    // may run on a worker thread, nothing else may use the sequencer until it returns
+    int expandProgram(QString* errorMsg=nullptr);
+    inline void cancelExpansion() {_cancel = true;} // thread-safe
+    inline int expansionProgress() const {return _progress;} // thread-safe, source line reached
+    inline const std::vector<Issue>& issues() const {return _issues;} // found while expanding
+
+    // re-interprets only the changed source lines [firstLine, lastLine] (the fragment) of a program without G# constructs,
+    // the following lines have moved by lineDelta; returns false if the whole program has to be loaded again
+    bool updateProgram(const QString& fragment, int firstLine, int lastLine, int lineDelta,
+                       int& errorLine, QString* errorMsg=nullptr);
+
+    // continues from the first command generated by the source line,
+    // preamble restores modal state and tool position (from the nearest checkpoint), see GCodeState::preamble()
+    bool seekLine(int lineNumber, double safeZ, double plungeFeed, std::vector<std::string>& preamble,
+                  QString* errorMsg=nullptr);
+
+    // tolerance 0 follows grbl's arc tolerance ($12)
+    void enableArcFitting(bool enable, double tolerance=0.0) {_arcFitting = enable; _arcFitTolerance = tolerance;}
+    void enableDecimation(bool enable, double tolerance) {_decimation = enable; _decimator.setTolerance(tolerance);}
+    // feed moves above the height (mm, work Z) become rapids
+    void enableAirCutRemoval(bool enable, double height) {_airCutRemoval = enable; _airCutRemover.setHeight(height);}
+    inline const AirCutRemover& airCutRemover() const {return _airCutRemover;} // what it has converted
+    // applied first, to the program it was planned for; cleared when the program changes
+    void setTravelPlan(const TravelOptimizer::Plan& plan) {_travelOptimizer.setPlan(plan);}
+    void clearTravelPlan() {_travelOptimizer.clearPlan();}
+    bool hasTravelPlan() const {return _travelOptimizer.isReady();}
+    // applied last, while the map is complete; it must not change until the filters are applied again
+    void enableHeightCompensation(bool enable, const HeightMap* map) {_compensation = enable; _compensator.setHeightMap(map);}
+    // line which kept the compensation out of the filters applied last time, line number 0 if none;
+    // the program must not run while the compensation is asked for and refused
+    inline const Issue& compensationRefusal() const {return _compensationRefusal;}
+
+    // passes the expanded program through the enabled filters, returns false if none is enabled
+    bool applyFilters();
+    inline const std::vector<GCodeFilter*>& filters() const {return _filters;} // applied last time
+    LaterFilters laterFilters() const;
+
+    // everything expanded so far, as it is going to be sent
+    inline const GCodeProgram& program() const {return _filtered? _program: _source;}
+    inline const GCodeProgram& source() const {return _source;} // interpreter output
+    inline int currentStep() const {return _step;} // next step to be sent
+
+    // sent lines are numbered by their steps (N word), grbl reports the executed one in the status;
+    // returns the step of the reported number, or -1 if it has not been sent
+    int executedStep(int lineNumber) const;
+
+private:
+    bool _expandNext(int& lineNumber, QString* errorMsg);
+
 private:
     GrblControl* _grbl;
     gsharp::Interpreter _interp;
 
+    GCodeProgram _source; // interpreter output cache
+    GCodeProgram _program; // filtered program
+    bool _filtered; // _program is in use
+    int _step; // next step to be sent
+    std::string _resumeMotion; // arc mode the preamble cannot restore, added to the first arc sent
+    std::atomic<bool> _expanded; // interpreter has reached the end of the program
+    std::atomic<bool> _cancel; // stops expandProgram()
+    std::atomic<int> _progress;
+    std::vector<Issue> _issues;
+    bool _plain; // no G# constructs, every line can be interpreted on its own
+
     bool _ready;
+
+    std::vector<GCodeFilter*> _filters; // chain in use
+    TravelOptimizer _travelOptimizer;
+    AirCutRemover _airCutRemover;
+    bool _airCutRemoval;
+    ArcFitter _arcFitter;
+    bool _arcFitting;
+    double _arcFitTolerance;
+    Decimator _decimator;
+    bool _decimation;
+    HeightCompensator _compensator;
+    bool _compensation;
+    Issue _compensationRefusal;
 };
 
 #endif // GSHARPIE_GCODESEQUENCER_H
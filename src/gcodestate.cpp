@@ -0,0 +1,651 @@
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "gcodestate.h"
+
+using namespace std;
+
+
+void GCodeMove::planeAxes(int& axis0, int& axis1, int& linear) const
+{
+    if(plane == 18){ // ZX
+        axis0 = 2; axis1 = 0; linear = 1;
+    }
+    else if(plane == 19){ // YZ
+        axis0 = 1; axis1 = 2; linear = 0;
+    }
+    else{ // XY
+        axis0 = 0; axis1 = 1; linear = 2;
+    }
+}
+
+
+double GCodeMove::radius() const
+{
+    int a0, a1, lin;
+    planeAxes(a0, a1, lin);
+    return ::hypot(from[a0] - center[a0], from[a1] - center[a1]);
+}
+
+
+double GCodeMove::angularTravel() const
+{
+    int a0, a1, lin;
+    planeAxes(a0, a1, lin);
+
+    // same as in grbl's mc_arc()
+    const double r0x = from[a0] - center[a0], r0y = from[a1] - center[a1];
+    const double r1x = to[a0] - center[a0],   r1y = to[a1] - center[a1];
+    double angle = ::atan2(r0x*r1y - r0y*r1x, r0x*r1x + r0y*r1y);
+    if(type == ArcCW){
+        if(angle >= -5e-7)
+            angle -= 2*M_PI;
+    }
+    else if(angle <= 5e-7)
+        angle += 2*M_PI;
+    return angle;
+}
+
+
+double GCodeMove::length() const
+{
+    if(isArc()){
+        int a0, a1, lin;
+        planeAxes(a0, a1, lin);
+        return ::hypot(angularTravel()*radius(), to[lin] - from[lin]);
+    }
+    if(type == Rapid || type == Linear || type == Probe){
+        const double dx = to[0]-from[0], dy = to[1]-from[1], dz = to[2]-from[2];
+        return ::sqrt(dx*dx + dy*dy + dz*dz);
+    }
+    return 0.0;
+}
+
+
+void GCodeMove::boundingBox(double* low, double* high) const
+{
+    for(int i=0; i<3; ++i){
+        low[i] = (from[i] < to[i])? from[i]: to[i];
+        high[i] = (from[i] < to[i])? to[i]: from[i];
+    }
+    if(!isArc())
+        return;
+
+    // arc reaches the extremes of its circle at multiples of 90 degrees
+    int a0, a1, lin;
+    planeAxes(a0, a1, lin);
+    const double r = radius();
+    const double start = ::atan2(from[a1] - center[a1], from[a0] - center[a0]);
+    const double travel = angularTravel();
+    for(int quadrant = 0; quadrant < 4; ++quadrant){
+        const double angle = quadrant*0.5*M_PI;
+        double delta = ::fmod(angle - start, 2*M_PI); // from the start in the direction of the arc
+        if(travel > 0.0){
+            if(delta < 0.0) delta += 2*M_PI;
+        }
+        else if(delta > 0.0)
+            delta -= 2*M_PI;
+        if(::fabs(delta) >= ::fabs(travel))
+            continue;
+
+        const double p0 = center[a0] + r*::cos(angle), p1 = center[a1] + r*::sin(angle);
+        if(p0 < low[a0]) low[a0] = p0;
+        if(p0 > high[a0]) high[a0] = p0;
+        if(p1 < low[a1]) low[a1] = p1;
+        if(p1 > high[a1]) high[a1] = p1;
+    }
+}
+
+
+void GCodeState::reset()
+{
+    // grbl power-up defaults
+    _motion = Rapid;
+    _plane = 17;
+    _wcs = 54;
+    _imperial = false;
+    _incremental = false;
+    _inverseTime = false;
+    _feed = 0.0;
+    _speed = 0.0;
+    _spindle = 5;
+    _flood = false;
+    _mist = false;
+    for(int i=0; i<3; ++i){
+        _pos[i] = 0.0;
+        _frame[i] = Unknown; // wherever the machine is
+        _offset[i] = 0.0;
+        _offsetKnown[i] = true;
+        for(int system=0; system<6; ++system){
+            _origin[system][i] = 0.0;
+            _originState[system][i] = Kept;
+        }
+    }
+    _offsetUsed = false;
+}
+
+
+bool GCodeState::operator==(const GCodeState& other) const
+{
+    for(int i=0; i<3; ++i){
+        if(_pos[i] != other._pos[i] || _frame[i] != other._frame[i]) return false;
+        if(_offset[i] != other._offset[i] || _offsetKnown[i] != other._offsetKnown[i]) return false;
+        for(int system=0; system<6; ++system)
+            if(_origin[system][i] != other._origin[system][i] || _originState[system][i] != other._originState[system][i])
+                return false;
+    }
+    return _offsetUsed == other._offsetUsed && _motion == other._motion && _plane == other._plane && _wcs == other._wcs && _imperial == other._imperial &&
+           _incremental == other._incremental && _inverseTime == other._inverseTime && _feed == other._feed &&
+           _speed == other._speed && _spindle == other._spindle && _flood == other._flood && _mist == other._mist;
+}
+
+
+////////  u p d a t e  ////////
+double GCodeState::readNumber(const char* s, const char** end)
+{
+    const char* start = s;
+    bool negative = false;
+    if(*s == '-' || *s == '+')
+        negative = (*s++ == '-');
+
+    uint64_t mantissa = 0;
+    int decimals = 0, digits = 0;
+    for(; ::isdigit(*s); ++s, ++digits)
+        mantissa = mantissa*10 + (*s - '0');
+    if(*s == '.'){
+        for(++s; ::isdigit(*s); ++s, ++digits, ++decimals)
+            mantissa = mantissa*10 + (*s - '0');
+    }
+
+    if(digits == 0){
+        *end = start;
+        return 0.0;
+    }
+    *end = s;
+
+    static const double scale[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12};
+    double value = (decimals <= 12)? mantissa/scale[decimals]: mantissa/::pow(10.0, decimals);
+    return negative? -value: value;
+}
+
+
+const char* GCodeState::grblError(const char* line)
+{
+    int length = 0; // as stored by grbl: no spaces, no comments
+    for(const char* s = line; *s; ){
+        const char letter = ::toupper(*s++);
+        if(letter == '('){
+            while(*s && *s++ != ')') ;
+            continue;
+        }
+        if(letter == ';')
+            break;
+        if(letter == ' ' || letter == '\t')
+            continue;
+        ++length;
+        if(!::isalpha(letter))
+            continue;
+        if(!::strchr("FGIJKLMNPRSTXYZ", letter))
+            return "unsupported word";
+
+        const char* end;
+        const double value = readNumber(s, &end);
+        if(end == s)
+            return "letter without a number";
+        length += end - s;
+        s = end;
+
+        const int code = static_cast<int>(::lround(value*10.0)); // G38.2 -> 382
+        if(letter == 'G'){
+            switch(code){
+                case 0: case 10: case 20: case 30: case 40: case 100: case 170: case 180: case 190:
+                case 200: case 210: case 280: case 281: case 300: case 301: case 382: case 383: case 384:
+                case 385: case 400: case 431: case 490: case 530: case 540: case 550: case 560: case 570:
+                case 580: case 590: case 610: case 800: case 900: case 910: case 911: case 920: case 921:
+                case 930: case 940:
+                    break;
+                default:
+                    return "unsupported G command";
+            }
+        }
+        else if(letter == 'M'){
+            switch(code){
+                case 0: case 10: case 20: case 30: case 40: case 50: case 70: case 80: case 90:
+                case 300: case 560:
+                    break;
+                default:
+                    return "unsupported M command";
+            }
+        }
+    }
+
+    if(length >= 80) // LINE_BUFFER_SIZE, one is left for the terminating zero
+        return "line is longer than 79 characters";
+    return nullptr;
+}
+
+
+bool GCodeState::update(const char* line, GCodeMove* move)
+{
+    double axis[3] = {0.0, 0.0, 0.0};
+    bool hasAxis[3] = {false, false, false};
+    double offset[3] = {0.0, 0.0, 0.0}; // I, J, K
+    double radius = 0.0, p = 0.0;
+    bool hasRadius = false;
+    int l = 0;
+    int nonModal = 0; // G4, G10, G28, G30, G92 (and their fractional variants)
+    bool machine = false, sync = false;
+
+    const char* s = line;
+    while(*s){
+        const char letter = ::toupper(*s++);
+        if(letter == '('){ // comment
+            while(*s && *s != ')') ++s;
+            continue;
+        }
+        if(letter == ';')
+            break;
+        if(!::isalpha(letter))
+            continue;
+
+        const char* end;
+        const double value = readNumber(s, &end);
+        if(end == s)
+            continue; // letter without a number
+        s = end;
+
+        const int code = static_cast<int>(value);
+        const int fraction = static_cast<int>(::lround(value*10.0)) % 10;
+        switch(letter){
+            case 'G':
+                switch(code){
+                    case 0: case 1: case 2: case 3:
+                        _motion = code;
+                        break;
+                    case 38: _motion = Probe; break;
+                    case 80: _motion = Cancel; break;
+                    case 17: case 18: case 19: _plane = code; break;
+                    case 20: _imperial = true; break;
+                    case 21: _imperial = false; break;
+                    case 53: machine = true; break;
+                    case 54: case 55: case 56: case 57: case 58: case 59:
+                        if(fraction == 0) _selectSystem(code);
+                        break;
+                    case 90: if(fraction == 0) _incremental = false; break; // G90.1 is not supported by grbl
+                    case 91: if(fraction == 0) _incremental = true; break;  // G91.1 is the only arc mode
+                    case 93: _inverseTime = true; break;
+                    case 94: _inverseTime = false; break;
+                    case 4: case 10: case 28: case 30: case 92:
+                        nonModal = code*10 + fraction;
+                        break;
+                }
+                break;
+
+            case 'M':
+                switch(code){
+                    case 0: case 1: case 2: case 30: sync = true; break;
+                    case 3: case 4: case 5: _spindle = code; sync = true; break;
+                    case 7: _mist = true; sync = true; break;
+                    case 8: _flood = true; sync = true; break;
+                    case 9: _mist = _flood = false; sync = true; break;
+                }
+                break;
+
+            case 'X': axis[0] = value; hasAxis[0] = true; break;
+            case 'Y': axis[1] = value; hasAxis[1] = true; break;
+            case 'Z': axis[2] = value; hasAxis[2] = true; break;
+            case 'I': offset[0] = value; break;
+            case 'J': offset[1] = value; break;
+            case 'K': offset[2] = value; break;
+            case 'R': radius = value; hasRadius = true; break;
+            case 'F': _feed = value; break;
+            case 'S': _speed = value; break;
+            case 'P': p = value; break;
+            case 'L': l = static_cast<int>(value); break;
+        }
+    }
+
+    const double scale = _imperial? 25.4: 1.0;
+    const bool anyAxis = hasAxis[0] || hasAxis[1] || hasAxis[2];
+
+    double target[3];
+    for(int i=0; i<3; ++i){
+        target[i] = _pos[i];
+        if(hasAxis[i])
+            target[i] = (_incremental && !machine)? _pos[i] + axis[i]*scale: axis[i]*scale;
+    }
+
+    GCodeMove m;
+    m.type = GCodeMove::None;
+    m.plane = _plane;
+    m.machine = machine;
+    m.sync = sync;
+    m.dwell = 0.0;
+    m.feed = _feed*scale;
+    for(int i=0; i<3; ++i){
+        m.from[i] = _pos[i];
+        m.to[i] = target[i];
+        m.center[i] = _pos[i];
+        m.hasAxis[i] = hasAxis[i];
+    }
+
+    switch(nonModal){
+        case 40: // G4, dwell
+            m.type = GCodeMove::Dwell;
+            m.dwell = p;
+            m.sync = true;
+            break;
+
+        case 100: // G10, L2 writes the origin of the coordinate system P, L20 moves it under the tool
+            if((l == 2 || l == 20) && p >= 0.0 && p <= 6.0)
+                _writeOrigin((p == 0.0)? _wcs - 54: static_cast<int>(p) - 1, l, axis, hasAxis, scale);
+            m.sync = true;
+            break;
+
+        case 920: // G92, the tool is at the axis words: the offset is the rest of its position
+            for(int i=0; i<3; ++i)
+                if(hasAxis[i]){
+                    if(_frame[i] == Work)
+                        _offset[i] += _pos[i] - axis[i]*scale;
+                    else
+                        _offsetKnown[i] = false;
+                    _pos[i] = axis[i]*scale;
+                    _frame[i] = Work;
+                }
+            _offsetUsed = true;
+            m.sync = true;
+            break;
+
+        case 921: // G92.1, no offset
+            for(int i=0; i<3; ++i){
+                if(_frame[i] == Work && _offsetKnown[i])
+                    _pos[i] += _offset[i];
+                else if(_frame[i] == Work)
+                    _frame[i] = Unknown;
+                _offset[i] = 0.0;
+                _offsetKnown[i] = true;
+            }
+            _offsetUsed = true;
+            m.sync = true;
+            break;
+
+        case 280: // G28 and G30 go to the intermediate point first, home position is unknown here
+        case 300:
+            m.type = GCodeMove::Rapid; // without axis words straight home
+            m.sync = true;
+            break;
+
+        case 0: // regular motion
+            if(anyAxis){
+                if(_motion == Rapid)
+                    m.type = GCodeMove::Rapid;
+                else if(_motion == Linear)
+                    m.type = GCodeMove::Linear;
+                else if(_motion == ArcCW)
+                    m.type = GCodeMove::ArcCW;
+                else if(_motion == ArcCCW)
+                    m.type = GCodeMove::ArcCCW;
+                else if(_motion == Probe)
+                    m.type = GCodeMove::Probe;
+            }
+            break;
+    }
+
+    m.known = true;
+    for(int i=0; i<3; ++i)
+        if(hasAxis[i] && _frame[i] != Work) m.known = false;
+
+    if(m.isArc()){
+        int a0, a1, lin;
+        m.planeAxes(a0, a1, lin);
+        if(_frame[a0] != Work || _frame[a1] != Work)
+            m.known = false; // the center is relative to the start
+        if(hasRadius){ // radius format, same math as in grbl
+            const double x = target[a0] - _pos[a0];
+            const double y = target[a1] - _pos[a1];
+            const double r = radius*scale;
+            double h = 4.0*r*r - x*x - y*y;
+            h = (h > 0.0)? -::sqrt(h)/::hypot(x, y): 0.0;
+            if(m.type == GCodeMove::ArcCCW) h = -h;
+            if(r < 0.0) h = -h;
+            m.center[a0] = _pos[a0] + 0.5*(x - y*h);
+            m.center[a1] = _pos[a1] + 0.5*(y + x*h);
+        }
+        else{ // offset format, always incremental in grbl
+            m.center[a0] = _pos[a0] + offset[a0]*scale;
+            m.center[a1] = _pos[a1] + offset[a1]*scale;
+        }
+    }
+
+    if(_inverseTime && m.type != GCodeMove::Rapid && m.type != GCodeMove::None)
+        m.feed = m.length()*_feed; // F is 1/min
+
+    if(m.type != GCodeMove::None && m.type != GCodeMove::Dwell){
+        if(machine){ // the work offset is not known here, axes written on the line are at their machine coordinates
+            for(int i=0; i<3; ++i)
+                if(hasAxis[i]){
+                    _pos[i] = target[i];
+                    _frame[i] = Machine;
+                }
+        }
+        else if(nonModal == 280 || nonModal == 300){ // home of the axes written, all of them without axis words
+            for(int i=0; i<3; ++i){
+                _pos[i] = target[i]; // the intermediate point
+                if(hasAxis[i] || !anyAxis) _frame[i] = (nonModal == 280)? Home28: Home30;
+            }
+        }
+        else{
+            for(int i=0; i<3; ++i){
+                _pos[i] = target[i];
+                if(!hasAxis[i])
+                    continue;
+                if(!_incremental)
+                    _frame[i] = Work;
+                else if(_frame[i] != Work && _frame[i] != Machine)
+                    _frame[i] = Unknown; // a step from the home position, which is not known here
+                if(m.type == GCodeMove::Probe)
+                    _frame[i] = Unknown; // stops at the contact
+            }
+        }
+    }
+
+    if(move)
+        *move = m;
+    return m.type != GCodeMove::None;
+}
+
+
+//////  s e l e c t  S y s t e m  //////
+// the tool stays, its work position moves by the difference of the origins if the program has written both
+void GCodeState::_selectSystem(int wcs)
+{
+    const int from = _wcs - 54, to = wcs - 54;
+    _wcs = wcs;
+    if(from == to)
+        return;
+    for(int i=0; i<3; ++i){
+        if(_frame[i] != Work)
+            continue;
+        if(_originState[from][i] == Written && _originState[to][i] == Written)
+            _pos[i] += _origin[from][i] - _origin[to][i];
+        else
+            _frame[i] = Unknown; // the origins are grbl's
+    }
+}
+
+
+//////  w r i t e  O r i g i n  //////
+void GCodeState::_writeOrigin(int system, int l, const double* axis, const bool* hasAxis, double scale)
+{
+    const int current = _wcs - 54;
+    for(int i=0; i<3; ++i){
+        if(!hasAxis[i])
+            continue;
+        const double old = _origin[system][i];
+        const char oldState = _originState[system][i];
+
+        if(l == 2){
+            _origin[system][i] = axis[i]*scale;
+            _originState[system][i] = Written;
+        }
+        else if(_frame[i] == Work && (system == current? oldState: _originState[current][i]) == Written){
+            // L20: machine position of the tool less the G92 offset and the axis word
+            _origin[system][i] = ((system == current)? old: _origin[current][i]) + _pos[i] - axis[i]*scale;
+            _originState[system][i] = Written;
+        }
+        else
+            _originState[system][i] = Lost; // relative to an origin or position not known here
+
+        if(system != current)
+            continue;
+        if(l == 20){ // the tool is at the axis word now
+            _pos[i] = axis[i]*scale;
+            _frame[i] = Work;
+        }
+        else if(_frame[i] == Work){ // it stays, its work position moves with the origin
+            if(oldState == Written)
+                _pos[i] += old - _origin[system][i];
+            else
+                _frame[i] = Unknown;
+        }
+    }
+}
+
+
+////////  p r e a m b l e  ////////
+bool GCodeState::preamble(double safeZ, double plungeFeed, vector<string>& lines, const char** reason) const
+{
+    static const char axisName[3] = {'X', 'Y', 'Z'};
+    const char* why = nullptr;
+    for(int i=0; i<3 && !why; ++i){
+        if(!_offsetKnown[i])
+            why = "G92 has set an offset where the tool position was not known";
+        else if(_offset[i] != 0.0 && _frame[i] != Work)
+            why = "G92 offset on an axis whose work position is not known";
+        for(int system=0; system<6 && !why; ++system)
+            if(_originState[system][i] == Lost)
+                why = "G10 L20 has set a work origin from a position which was not known";
+    }
+    lines.clear();
+    if(why){
+        if(reason)
+            *reason = why;
+        return false;
+    }
+
+    char buf[96];
+
+    // positioning is done in absolute metric coordinates, the rest is restored at the end
+    ::sprintf(buf, "G21G90G%dG94G%d", _plane, _wcs);
+    lines.push_back(buf);
+
+    // origins the program has written, then no G92 offset until the tool is in place
+    for(int system=0; system<6; ++system){
+        const int length = ::sprintf(buf, "G10L2P%d", system+1);
+        string origin(buf);
+        for(int i=0; i<3; ++i){
+            if(_originState[system][i] == Written){
+                ::sprintf(buf, "%c%.4f", axisName[i], _origin[system][i]);
+                origin += buf;
+            }
+        }
+        if(static_cast<int>(origin.size()) > length)
+            lines.push_back(origin);
+    }
+    if(_offsetUsed)
+        lines.push_back("G92.1");
+
+    // retract above everything before the spindle starts
+    ::sprintf(buf, "G53G0Z%.4f", safeZ);
+    lines.push_back(buf);
+
+    if(_spindle == 5)
+        lines.push_back("M5");
+    else{
+        ::sprintf(buf, "S%gM%d", _speed, _spindle);
+        lines.push_back(buf);
+    }
+
+    if(_flood)
+        lines.push_back("M8");
+    if(_mist)
+        lines.push_back("M7");
+    if(!_flood && !_mist)
+        lines.push_back("M9");
+
+    // approach horizontally, then plunge at feed rate; homed axes go home again, those moved with G53 to their
+    // machine coordinates, axes the program has not set (or has left unknown) stay where they are
+    string home[2] = {"G91G28", "G91G30"}, machine("G53G0"), approach("G0");
+    for(int i=0; i<2; ++i){
+        if(_frame[i] == Home28 || _frame[i] == Home30){
+            ::sprintf(buf, "%c0", axisName[i]);
+            home[_frame[i] == Home30] += buf;
+        }
+        else if(_frame[i] == Machine){
+            ::sprintf(buf, "%c%.4f", axisName[i], _pos[i]);
+            machine += buf;
+        }
+        else if(_frame[i] == Work){
+            ::sprintf(buf, "%c%.4f", axisName[i], _pos[i] + _offset[i]);
+            approach += buf;
+        }
+    }
+    for(int k=0; k<2; ++k){
+        if(home[k].size() > 6){ // the intermediate point is where the tool is
+            lines.push_back(home[k]);
+            lines.push_back("G90");
+        }
+    }
+    if(machine.size() > 5)
+        lines.push_back(machine);
+    if(approach.size() > 2)
+        lines.push_back(approach);
+
+    const double feed = (!_inverseTime && _feed > 0.0)? feedRate(): plungeFeed;
+    if(_frame[2] == Work){
+        ::sprintf(buf, "G1Z%.4fF%.1f", _pos[2] + _offset[2], feed);
+        lines.push_back(buf);
+    }
+    else if(_frame[2] == Machine){
+        ::sprintf(buf, "G53G1Z%.4fF%.1f", _pos[2], feed);
+        lines.push_back(buf);
+    }
+    else if(_frame[2] == Home28 || _frame[2] == Home30){
+        lines.push_back((_frame[2] == Home28)? "G91G28Z0": "G91G30Z0");
+        lines.push_back("G90");
+    }
+
+    // G92 offset, the tool is where it reads the program's position
+    string offset("G92");
+    for(int i=0; i<3; ++i){
+        if(_offset[i] != 0.0){
+            ::sprintf(buf, "%c%.4f", axisName[i], _pos[i]);
+            offset += buf;
+        }
+    }
+    if(offset.size() > 3)
+        lines.push_back(offset);
+
+    string modal;
+    if(_imperial)
+        modal += "G20";
+    if(_incremental)
+        modal += "G91";
+    if(_inverseTime)
+        modal += "G93";
+    if(_motion == Rapid || _motion == Linear){ // arcs cannot be set without axis words, the first line sent restores them
+        ::sprintf(buf, "G%d", _motion);
+        modal += buf;
+    }
+    if(!_inverseTime && _feed > 0.0){
+        ::sprintf(buf, "F%g", _feed);
+        modal += buf;
+    }
+    if(!modal.empty())
+        lines.push_back(modal);
+
+    return true;
+}
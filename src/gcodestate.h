@@ -0,0 +1,100 @@
+#ifndef GSHARPIE_GCODESTATE_H
+#define GSHARPIE_GCODESTATE_H
+#include <string>
+#include <vector>
+
+
+struct GCodeMove
+{
+    enum TYPE{None, Rapid, Linear, ArcCW, ArcCCW, Probe, Dwell};
+
+    TYPE type;
+    double from[3]; // mm, program coordinates
+    double to[3];   // mm
+    double center[3]; // mm, arcs only
+    int plane; // 17, 18 or 19 (arcs only)
+    double feed; // mm/min, not used for rapids
+    double dwell; // seconds, G4 only
+    bool machine; // G53 move, coordinates are in machine space (the axes written on the line)
+    bool hasAxis[3]; // written on the line
+    bool known; // the tool is where 'from' says on the axes the move uses
+    bool sync; // grbl empties its planner before executing the line (spindle, coolant, M0, G4...)
+
+    inline bool isArc() const {return type == ArcCW || type == ArcCCW;}
+    void planeAxes(int& axis0, int& axis1, int& linear) const; // arc plane: first, second and normal axes
+    double radius() const;
+    double angularTravel() const; // radians, negative for clockwise arcs
+    double length() const; // path length, including arcs
+    void boundingBox(double* low, double* high) const; // of the path, including arcs
+};
+
+
+// modal g-code state as it would be in grbl after executing the given lines
+class GCodeState
+{
+public:
+    enum MOTION{Rapid=0, Linear=1, ArcCW=2, ArcCCW=3, Probe=38, Cancel=80};
+
+public:
+    GCodeState() {reset();}
+
+    void reset();
+
+    bool operator==(const GCodeState& other) const; // modal state and position
+    inline bool operator!=(const GCodeState& other) const {return !(*this == other);}
+
+    // processes one (tight) g-code line, returns true if the line results in motion or dwell
+    bool update(const char* line, GCodeMove* move=nullptr);
+    inline bool update(const std::string& line, GCodeMove* move=nullptr) {return update(line.c_str(), move);}
+
+    // decimal number as in g-code: no exponent, hexadecimal or inf ("G0X1" is not 0x1)
+    static double readNumber(const char* s, const char** end);
+
+    // reason why grbl 1.1 would reject the line, nullptr if it accepts it
+    static const char* grblError(const char* line);
+
+    // g-code lines to restore this state (and tool position) on a freshly reset controller: work offsets written
+    // by the program, retract to safeZ (mm, machine coordinates), spindle and coolant, rapid in XY, plunge at the modal
+    // feed or plungeFeed (mm/min), G92 offset; axes last moved with G53 or G28/G30 go there again the same way.
+    // The program is taken to start without a G92 offset, as grbl is after a reset; returns false (with the reason)
+    // if an offset was set where the tool position was not known, it cannot be restored then
+    bool preamble(double safeZ, double plungeFeed, std::vector<std::string>& lines, const char** reason=nullptr) const;
+
+    inline const double* position() const {return _pos;} // of the known axes, G53 leaves machine coordinates
+    inline bool isKnown(int axis) const {return _frame[axis] == Work;} // after G53, G28/G30 or probing it is not
+    inline bool isImperial() const {return _imperial;}
+    inline bool isIncremental() const {return _incremental;}
+    inline bool isInverseTime() const {return _inverseTime;}
+    inline int plane() const {return _plane;}
+    inline int motionMode() const {return _motion;}
+    inline double feedRate() const {return _imperial? _feed*25.4: _feed;} // mm/min
+
+private:
+    enum FRAME{Unknown, Work, Machine, Home28, Home30}; // what the position of an axis tells
+    enum ORIGIN{Kept, Written, Lost}; // coordinate system origin as the program has left it
+
+    void _selectSystem(int wcs);
+    void _writeOrigin(int system, int l, const double* axis, const bool* hasAxis, double scale); // G10 L2/L20
+
+private:
+    int _motion; // G0, G1, G2, G3, G38.x, G80
+    int _plane; // G17, G18, G19
+    int _wcs; // G54..G59
+    bool _imperial; // G20/G21
+    bool _incremental; // G90/G91
+    bool _inverseTime; // G93/G94
+    double _feed; // F, program units
+    double _speed; // S
+    int _spindle; // M3, M4 or M5
+    bool _flood; // M8
+    bool _mist; // M7
+    double _pos[3]; // mm, in the current coordinate system (machine coordinates after G53)
+    char _frame[3]; // FRAME, per axis
+    double _offset[3]; // mm, G92
+    bool _offsetKnown[3]; // set where the tool position was known
+    bool _offsetUsed; // G92 or G92.1 met
+    double _origin[6][3]; // mm, machine coordinates of the G54..G59 origins written by G10
+    char _originState[6][3]; // ORIGIN
+};
+
+#endif // GSHARPIE_GCODESTATE_H
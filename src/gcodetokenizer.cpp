@@ -0,0 +1,102 @@
+#include <cctype>
+#include "gcodetokenizer.h"
+
+
+static inline bool isNameChar(char c)
+{
+    return ::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+
+//////  t o k e n i z e  //////
+void GCodeTokenizer::tokenize(const char* line, int length, std::vector<Token>& tokens)
+{
+    tokens.clear();
+    bool flowKeyword = false; // after an O-word: sub, if, while, call...
+
+    int i = 0;
+    while(i < length){
+        const int start = i;
+        const char c = line[i];
+
+        if(c == '(' || c == ';'){ // till the closing bracket or the end of line
+            ++i;
+            while(i < length && (c == ';' || line[i] != ')'))
+                ++i;
+            if(i < length)
+                ++i;
+            Token token = {start, i - start, Comment};
+            tokens.push_back(token);
+            continue;
+        }
+
+        if(c == '#'){ // #5, #<name> or #name
+            ++i;
+            if(i < length && line[i] == '<'){
+                while(i < length && line[i] != '>')
+                    ++i;
+                if(i < length)
+                    ++i;
+            }
+            else{
+                while(i < length && isNameChar(line[i]))
+                    ++i;
+            }
+            Token token = {start, i - start, Parameter};
+            tokens.push_back(token);
+            continue;
+        }
+
+        // a word starts after anything but a letter (G-words inside names like "ARG1" are not commands)
+        const bool wordStart = (start == 0 || !(::isalpha(static_cast<unsigned char>(line[start-1])) || line[start-1] == '_'));
+        const char letter = static_cast<char>(::toupper(static_cast<unsigned char>(c)));
+
+        if(wordStart && letter == 'O'){ // O100, O<name>
+            ++i;
+            if(i < length && line[i] == '<'){
+                while(i < length && line[i] != '>')
+                    ++i;
+                if(i < length)
+                    ++i;
+            }
+            else{
+                while(i < length && ::isdigit(static_cast<unsigned char>(line[i])))
+                    ++i;
+            }
+            if(i - start > 1){
+                Token token = {start, i - start, Flow};
+                tokens.push_back(token);
+                flowKeyword = true;
+                continue;
+            }
+            i = start;
+        }
+
+        if(wordStart && flowKeyword && ::isalpha(static_cast<unsigned char>(c))){
+            while(i < length && isNameChar(line[i]))
+                ++i;
+            Token token = {start, i - start, Flow};
+            tokens.push_back(token);
+            flowKeyword = false;
+            continue;
+        }
+
+        if(wordStart && (letter == 'G' || letter == 'M')){ // G1, M3, G 38.2
+            ++i;
+            while(i < length && line[i] == ' ')
+                ++i;
+            if(i < length && ::isdigit(static_cast<unsigned char>(line[i]))){
+                while(i < length && (::isdigit(static_cast<unsigned char>(line[i])) || line[i] == '.'))
+                    ++i;
+                Token token = {start, i - start, Command};
+                tokens.push_back(token);
+                continue;
+            }
+            i = start;
+        }
+
+        if(c != ' ' && c != '\t')
+            flowKeyword = false;
+        ++i;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef GSHARPIE_GCODETOKENIZER_H
+#define GSHARPIE_GCODETOKENIZER_H
+#include <vector>
+
+
+// splits one source line into the parts shown in different colors, everything else is plain text
+class GCodeTokenizer
+{
+public:
+    enum TYPE{Command, Parameter, Flow, Comment}; // G/M words, #parameters, O-words, comments
+
+    struct Token
+    {
+        int start;
+        int length;
+        TYPE type;
+    };
+
+public:
+    static void tokenize(const char* line, int length, std::vector<Token>& tokens);
+};
+
+#endif // GSHARPIE_GCODETOKENIZER_H
@@ -0,0 +1,303 @@
+#include <climits>
+#include <algorithm>
+#include <QtWidgets>
+#include "gcodeviewer.h"
+#include "gcodehighlighter.h"
+
+static const int TEXT_MARGIN = 4; // same as the document margin of the editor
+static const int TAB_STOP = 4; // columns, same as the editor
+
+
+// utf-8 bytes as they are shown from the column on: tabs expanded to spaces, a character takes one column;
+// the column is advanced past them
+static QString displayedText(const char* text, int length, int& column)
+{
+    QString shown = QString::fromUtf8(text, length);
+    for(int i=0; i < shown.size(); ++i){
+        if(shown[i] == QLatin1Char('\t')){
+            const int spaces = TAB_STOP - column % TAB_STOP;
+            shown.replace(i, 1, QString(spaces, QLatin1Char(' ')));
+            column += spaces;
+            i += spaces - 1;
+        }
+        else if(!shown[i].isLowSurrogate()) // the pair is one character
+            ++column;
+    }
+    return shown;
+}
+
+
+GCodeViewer::GCodeViewer(QWidget *parent) : QAbstractScrollArea(parent)
+{
+    _lineNumberArea = new ViewerLineNumberArea(this);
+    _data = nullptr;
+    _size = 0;
+    _current = 0;
+    _executing = -1;
+    _highlightEnabled = false;
+
+    setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+}
+
+
+
+GCodeViewer::~GCodeViewer()
+{
+    close();
+}
+
+
+
+bool GCodeViewer::open(const QString& fileName, QString* errorMsg)
+{
+    close();
+
+    _file.setFileName(fileName);
+    if(!_file.open(QFile::ReadOnly)){
+        if(errorMsg)
+            *errorMsg = _file.errorString();
+        return false;
+    }
+    _size = _file.size();
+    if(_size > 0){
+        _data = reinterpret_cast<const char*>(_file.map(0, _size));
+        if(!_data){
+            if(errorMsg)
+                *errorMsg = _file.errorString();
+            _file.close();
+            _size = 0;
+            return false;
+        }
+    }
+
+    _index.build(_data, _size);
+
+    _current = 0;
+    setViewportMargins(lineNumberAreaWidth(), 0, 0, 0);
+    _updateScrollBars();
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    viewport()->update();
+    _lineNumberArea->update();
+    return true;
+}
+
+
+
+void GCodeViewer::close()
+{
+    if(_data)
+        _file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(_data)));
+    _file.close();
+    _data = nullptr;
+    _size = 0;
+    _index.clear();
+    _current = 0;
+    _executing = -1;
+    _selected.clear();
+}
+
+
+
+QByteArray GCodeViewer::line(int index) const
+{
+    if(index < 0 || index >= lineCount())
+        return QByteArray();
+
+    const qint64 begin = _index.lineStart(index);
+    qint64 end = _index.lineEnd(index);
+    while(end > begin && (_data[end-1] == '\n' || _data[end-1] == '\r'))
+        --end;
+    return QByteArray::fromRawData(_data + begin, static_cast<int>(end - begin));
+}
+
+
+
+void GCodeViewer::setCurrentLine(int index)
+{
+    _current = qBound(0, index, qMax(0, lineCount()-1));
+
+    const int visible = qMax(1, viewport()->height() / fontMetrics().height());
+    QScrollBar* scroll = verticalScrollBar();
+    if(_current < scroll->value())
+        scroll->setValue(_current);
+    else if(_current >= scroll->value() + visible)
+        scroll->setValue(_current - visible + 1);
+
+    viewport()->update();
+    _lineNumberArea->update();
+}
+
+
+
+void GCodeViewer::setExecutingLine(int index)
+{
+    if(index == _executing)
+        return;
+
+    const int visible = qMax(1, viewport()->height() / fontMetrics().height());
+    QScrollBar* scroll = verticalScrollBar();
+    if(index >= 0 && (index < scroll->value() || index >= scroll->value() + visible)){
+        _executing = index;
+        scroll->setValue(index - visible/3); // repaints everything, shows what comes next
+        return;
+    }
+
+    _updateLine(_executing); // only the two lines are repainted
+    _executing = index;
+    _updateLine(_executing);
+}
+
+
+
+void GCodeViewer::setSelectedLines(const std::vector<std::pair<int, int>>& ranges)
+{
+    _selected = ranges;
+    viewport()->update();
+}
+
+
+
+bool GCodeViewer::_isSelected(int index) const
+{
+    // last range starting at or before the line
+    auto it = std::upper_bound(_selected.begin(), _selected.end(), std::make_pair(index, INT_MAX));
+    return it != _selected.begin() && index <= (it-1)->second;
+}
+
+
+
+void GCodeViewer::_updateLine(int index)
+{
+    const int top = (index - verticalScrollBar()->value()) * fontMetrics().height();
+    if(index >= 0 && top >= 0 && top < viewport()->height())
+        viewport()->update(0, top, viewport()->width(), fontMetrics().height());
+}
+
+
+
+int GCodeViewer::lineNumberAreaWidth() const
+{
+    int digits = 1;
+    int max = qMax(1, lineCount());
+    while (max >= 10) {
+        max /= 10;
+        ++digits;
+    }
+
+    int space = 3 + fontMetrics().width(QLatin1Char('9')) * digits;
+
+    return space;
+}
+
+
+
+void GCodeViewer::_updateScrollBars()
+{
+    const int lineHeight = fontMetrics().height();
+    const int visible = qMax(1, viewport()->height() / lineHeight);
+    verticalScrollBar()->setRange(0, qMax(0, lineCount() - visible));
+    verticalScrollBar()->setPageStep(visible);
+    verticalScrollBar()->setSingleStep(1);
+
+    const int charWidth = fontMetrics().width(QLatin1Char('9'));
+    const int width = 2*TEXT_MARGIN + _index.longestLine()*charWidth;
+    horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setSingleStep(charWidth);
+}
+
+
+
+void GCodeViewer::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+
+    QRect cr = contentsRect();
+    _lineNumberArea->setGeometry(QRect(cr.left(), cr.top(), lineNumberAreaWidth(), cr.height()));
+    _updateScrollBars();
+}
+
+
+
+void GCodeViewer::scrollContentsBy(int /* dx */, int /* dy */)
+{
+    viewport()->update();
+    _lineNumberArea->update();
+}
+
+
+
+void GCodeViewer::mousePressEvent(QMouseEvent *event)
+{
+    const int index = verticalScrollBar()->value() + event->pos().y() / fontMetrics().height();
+    if(index < lineCount())
+        setCurrentLine(index);
+}
+
+
+
+void GCodeViewer::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), palette().color(QPalette::Base));
+
+    const int lineHeight = fontMetrics().height();
+    const int charWidth = fontMetrics().width(QLatin1Char('9'));
+    const int left = TEXT_MARGIN - horizontalScrollBar()->value();
+    const QColor textColor = palette().color(QPalette::Text);
+    std::vector<GCodeTokenizer::Token> tokens; // only visible lines are tokenized, nothing to cache
+    int index = verticalScrollBar()->value() + event->rect().top() / lineHeight;
+    int top = (index - verticalScrollBar()->value()) * lineHeight;
+
+    while(index < lineCount() && top <= event->rect().bottom()){
+        if(index == _executing)
+            painter.fillRect(0, top, viewport()->width(), lineHeight, QColor(Qt::green).lighter(170));
+        else if(index == _current && _highlightEnabled)
+            painter.fillRect(0, top, viewport()->width(), lineHeight, QColor(Qt::yellow).lighter(160));
+        else if(!_selected.empty() && _isSelected(index))
+            painter.fillRect(0, top, viewport()->width(), lineHeight, QColor(255, 160, 0).lighter(170));
+
+        const QByteArray text = line(index);
+        const int baseLine = top + fontMetrics().ascent();
+        GCodeTokenizer::tokenize(text.constData(), text.size(), tokens);
+        int done = 0, column = 0; // tokens are in bytes, they are placed by the columns shown before them
+        for(size_t i=0; i <= tokens.size(); ++i){
+            const int start = (i < tokens.size())? tokens[i].start: text.size();
+            if(start > done){ // plain text before the token
+                painter.setPen(textColor);
+                const int x = left + column*charWidth;
+                painter.drawText(x, baseLine, displayedText(text.constData() + done, start - done, column));
+            }
+            if(i < tokens.size()){
+                painter.setPen(GCodeHighlighter::color(tokens[i].type));
+                const int x = left + column*charWidth;
+                painter.drawText(x, baseLine, displayedText(text.constData() + start, tokens[i].length, column));
+                done = start + tokens[i].length;
+            }
+        }
+
+        top += lineHeight;
+        ++index;
+    }
+}
+
+
+
+void GCodeViewer::lineNumberAreaPaintEvent(QPaintEvent *event)
+{
+    QPainter painter(_lineNumberArea);
+    painter.fillRect(event->rect(), QColor(224, 224, 224));
+    painter.setPen(Qt::black);
+
+    const int lineHeight = fontMetrics().height();
+    int index = verticalScrollBar()->value() + event->rect().top() / lineHeight;
+    int top = (index - verticalScrollBar()->value()) * lineHeight;
+
+    while(index < lineCount() && top <= event->rect().bottom()){
+        painter.drawText(0, top, _lineNumberArea->width(), lineHeight, Qt::AlignRight, QString::number(index + 1));
+
+        top += lineHeight;
+        ++index;
+    }
+}
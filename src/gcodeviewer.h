@@ -0,0 +1,93 @@
+#ifndef GSHARPIE_GCODEVIEWER_H
+#define GSHARPIE_GCODEVIEWER_H
+
+#include <vector>
+#include <QFile>
+#include <QByteArray>
+#include <QAbstractScrollArea>
+#include "gcodelineindex.h"
+
+class QPaintEvent;
+class QResizeEvent;
+class QMouseEvent;
+
+
+// read-only view of a memory mapped file, only the visible lines are painted
+class GCodeViewer : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    GCodeViewer(QWidget *parent = 0);
+    ~GCodeViewer();
+
+    bool open(const QString& fileName, QString* errorMsg=nullptr);
+    void close();
+    inline bool isOpen() const {return _file.isOpen();}
+    inline QString fileName() const {return _file.fileName();}
+
+    inline int lineCount() const {return _index.lineCount();}
+    QByteArray line(int index) const; // from 0, without the end of line, valid while the file is open
+    inline const char* data() const {return _data;} // mapped, valid while the file is open
+    inline qint64 size() const {return _size;} // may be past what a QByteArray holds
+    inline bool isEmpty() const {return _size == 0;}
+
+    inline int currentLine() const {return _current;} // from 0
+    void setCurrentLine(int index); // and scrolls it into view
+
+    inline void enableHighlight(bool enable=true) {_highlightEnabled = enable; viewport()->update();}
+
+    void setExecutingLine(int index); // from 0, -1 for none; scrolls it into view but keeps the current line
+    void setSelectedLines(const std::vector<std::pair<int, int>>& ranges); // from 0, first and last, in order
+
+    void lineNumberAreaPaintEvent(QPaintEvent *event);
+    int  lineNumberAreaWidth() const;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private:
+    void _updateScrollBars();
+    void _updateLine(int index);
+    bool _isSelected(int index) const;
+
+private:
+    QWidget *_lineNumberArea;
+
+    QFile _file;
+    const char* _data; // mapped
+    qint64 _size;
+    GCodeLineIndex _index;
+
+    int _current;
+    int _executing;
+    bool _highlightEnabled;
+    std::vector<std::pair<int, int>> _selected;
+};
+
+
+
+class ViewerLineNumberArea : public QWidget
+{
+public:
+    ViewerLineNumberArea(GCodeViewer *viewer) : QWidget(viewer) {
+        codeViewer = viewer;
+    }
+
+    QSize sizeHint() const override {
+        return QSize(codeViewer->lineNumberAreaWidth(), 0);
+    }
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        codeViewer->lineNumberAreaPaintEvent(event);
+    }
+
+private:
+    GCodeViewer *codeViewer;
+};
+
+#endif // GSHARPIE_GCODEVIEWER_H
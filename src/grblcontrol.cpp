@@ -11,6 +11,9 @@ GrblControl::GrblControl()
     _connected = false;
 
     _status.state = Undef;
+    _status.line = 0;
+    _status.time = 0;
+    _clock.start();
 
     memset(&_config, 0, sizeof(Config));
 
@@ -89,11 +92,12 @@ quint32 GrblControl::issueCommand(const char* cmd, const QString& readableName)
     command.sent = false;
     _commands.enqueue(command);
 
-    emit report(-2, QString("Sending: ") + QString(cmd));
+    if(isReported(-2))
+        emit logged(LogRecord(-2, "Sending").add("code", cmd));
     _sendNextCommand();
 
-    emit report(-1, QString("Issued [") + QString::number(command.id) + QStringLiteral("] ") +
-                command.name + QStringLiteral(" (") + QString(cmd) + QStringLiteral(")"));
+    if(isReported(-1))
+        emit logged(LogRecord(-1, "Issued").add("id", static_cast<qint64>(command.id)).add("name", command.name).add("code", cmd));
     return command.id;
 }
 
@@ -104,10 +108,12 @@ bool GrblControl::issueRealtimeCommand(REALTIME_COMMAND cmd)
     if(!isActive())
         return false;
 
-    if(cmd != GET_STATUS)
-        emit report(-2, QString("Issuing realtime Grbl command: 0x") + QString::number(cmd, 16));
-    else
-        emit report(-3, QString("Issuing Grbl status command: 0x") + QString::number(cmd, 16));
+    if(cmd != GET_STATUS){
+        if(isReported(-2))
+            emit logged(LogRecord(-2, "Issuing realtime Grbl command").addHex("code", cmd));
+    }
+    else if(isReported(-3))
+        emit logged(LogRecord(-3, "Issuing Grbl status command").addHex("code", cmd));
 
     char data[2] = {static_cast<char>(cmd), 0};
     if(_port->write(data, 1) == 1 && _port->waitForBytesWritten(5)){
@@ -123,6 +129,26 @@ bool GrblControl::issueRealtimeCommand(REALTIME_COMMAND cmd)
 }
 
 
+//////  d i s c a r d  U n s e n t  //////
+int GrblControl::discardUnsent(const char* prefix)
+{
+    const size_t length = ::strlen(prefix);
+    int count = 0;
+    for(QQueue<Command>::iterator it = _commands.begin(); it != _commands.end(); ){
+        if(!it->sent && it->code.compare(0, length, prefix) == 0){
+            it = _commands.erase(it);
+            ++count;
+        }
+        else
+            ++it;
+    }
+
+    if(count > 0 && isReported(-2))
+        emit logged(LogRecord(-2, "Discarded").add("code", prefix).add("count", count));
+    return count;
+}
+
+
 //////  s e n d  N e x t  C o m m a n d  //////
 bool GrblControl::_sendNextCommand()
 {
@@ -173,6 +199,8 @@ bool GrblControl::_retrieveVersion(const QByteArray& line)
 ///////  r e t r i e v e  S t a t u s  ///////
 void GrblControl::_retrieveStatus(const QByteArray& line)
 {
+    _status.time = _clock.elapsed();
+
     // extract internal to <.> data and split into components
     QList<QByteArray> fields = line.mid(1, line.size()-2).split('|');
 
@@ -189,6 +217,7 @@ void GrblControl::_retrieveStatus(const QByteArray& line)
     else               _status.state = Undef;
 
     // process remaining fields
+    _status.line = 0; // not reported without a numbered block in the planner
     enum {UNDEF, MPOS, WPOS} defaultPos = UNDEF;
     for(auto field = fields.begin()+1; field < fields.end(); ++field){
         if(field->left(4) == "MPos"){ // Machine position
@@ -234,6 +263,10 @@ void GrblControl::_retrieveStatus(const QByteArray& line)
             _status.pos.mpos = _status.pos.wpos + _toolOffset;
     }
 
+    const float scale = _config.imperial? 25.4f: 1.0f;
+    const float pos[3] = {_status.pos.wpos.x()*scale, _status.pos.wpos.y()*scale, _status.pos.wpos.z()*scale};
+    _trail.append(_status.time, pos);
+
     emit statusUpdated();
 }
 
@@ -262,7 +295,8 @@ bool GrblControl::_retrieveParameter(const QByteArray& line)
     QList<QByteArray> fields = line.mid(1).split('='); // remove '$'
     if(fields.size() == 2 && fields[0].size() >= 1 && fields[0].size() <= 3){
         if(fields[0].at(0) == 'N'){ // startup block
-            emit report(-1, QString("Processing startup block line: ") + line);
+            if(isReported(-1))
+                emit logged(LogRecord(-1, "Processing startup block").add("line", line));
             if(fields[0].at(1) == '0')
                 _startup[0] = fields[1];
             else if(fields[0].at(1) == '1')
@@ -272,7 +306,8 @@ bool GrblControl::_retrieveParameter(const QByteArray& line)
             return true;
         }
         else if(::isdigit(fields[0].at(0))){
-            emit report(-1, QString("Processing parameter #") + fields[0] + QString(", value = ") + fields[1]);
+            if(isReported(-1))
+                emit logged(LogRecord(-1, "Processing parameter").add("id", fields[0]).add("value", fields[1]));
             bool ok;
             int id = fields[0].toInt(&ok); // parameter id
             if(ok){
@@ -561,11 +596,13 @@ void GrblControl::_handlePortRead()
         QByteArray line(_response.left(lineEnd-1)); // there is "\r\n" pair
         _response = _response.mid(lineEnd+1); // fast forward to the next line
         if(line.size()>=4 && line.left(4) == QStringLiteral("Grbl")){ // after reset
-            emit report(-1, QString("Retrieveing grbl version from line: ") + line);
+            if(isReported(-1))
+                emit logged(LogRecord(-1, "Retrieving grbl version").add("line", line));
             _retrieveVersion(line);
         }
         else if(line[0] == '<'){ // CNC status response
-            emit report(-3, QString("Retrieveing grbl status from line: ") + line);
+            if(isReported(-3))
+                emit logged(LogRecord(-3, "Retrieving grbl status").add("line", line));
             _retrieveStatus(line);
         }
         else if(line[0] == '$'){ // parameters
@@ -574,7 +611,8 @@ void GrblControl::_handlePortRead()
         }
         else{ // other commands
             if(!_commands.isEmpty()){
-                emit report(-2, QString("Grbl message: ") + line);
+                if(isReported(-2))
+                    emit logged(LogRecord(-2, "Grbl message").add("line", line).add("id", static_cast<qint64>(_commands.head().id)));
 
                 Command& cmd = _commands.head();
                 if(line[0] == 'o' || line[0] == 'e' || line[0] == 'A'){ // 'ok', 'error' or 'ALARM'
@@ -584,11 +622,12 @@ void GrblControl::_handlePortRead()
                     emit commandComplete(_commands.dequeue());
                     _sendNextCommand();
                 }
-                else if(line[0] != '[')
+                else if(line[0] != '[' || line.startsWith("[PRB:")) // probe result belongs to its G38
                     cmd.response.append(line);
             }
             else
-                emit report(-2, QString("Grbl message without command: ") + line);
+                if(isReported(-2))
+                    emit logged(LogRecord(-2, "Grbl message without command").add("line", line));
         }
     }
 }
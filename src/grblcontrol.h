@@ -5,6 +5,9 @@
 #include <QVector4D>
 #include <QtSerialPort/QSerialPort>
 #include <QQueue>
+#include <QElapsedTimer>
+#include "logrecord.h"
+#include "machinetrail.h"
 
 
 struct CncToolPosition // relative to the workpiece
@@ -40,6 +43,7 @@ public: // type definitions
         int32_t feedrate; // rate
         int32_t spindle; // speed
         int32_t line; // currently executed line
+        qint64 time; // msec when the report was received, see getTime()
     };
 
     struct Command
@@ -91,6 +95,9 @@ public:
     // returns command id for references when completed, or 0 if error
     quint32 issueCommand(const char* cmd, const QString& readableName); // cmd without '/n' at the end!
     bool issueRealtimeCommand(REALTIME_COMMAND cmd);
+    // commands still waiting for room in grbl's buffer whose code starts with the prefix are dropped,
+    // they will not complete; returns how many
+    int discardUnsent(const char* prefix);
 
     bool issueJogging(const QVector4D& steps, double feedrateAdjustment);
 
@@ -98,6 +105,9 @@ public:
 //    inline MACHINE_STATE getCurrentStatus(Status& status) const {status = _status; return _status.state;}
 
     inline const Status& getCurrentStatus() const {return _status;}
+    inline qint64 getTime() const {return _clock.elapsed();} // msec, monotonic
+    inline const MachineTrail& getTrail() const {return _trail;} // reported work positions
+    inline void clearTrail() {_trail.clear();}
 
     inline const Config& getConfiguration() const {return _config;}
     void updateConfiguration(const Config& conf);
@@ -115,6 +125,7 @@ public:
 
 signals:
     void report(int level, const QString& msg); // progressive levels: debug(-), information(0), errors(+)
+    void logged(const LogRecord& record); // only emitted if the level is reported
     void commandComplete(GrblControl::Command cmd); // keep cmd as copy, as it will be deleted from the queue!
     void statusUpdated();
 
@@ -135,6 +146,7 @@ private:
 
     QQueue<GrblControl::Command> _commands;
     QByteArray  _response;
+    QElapsedTimer _clock; // report timestamps
     quint32 _lastCmdId;
 
     const double MIN_SUPPORTED_VERSION = 1.1;
@@ -147,6 +159,7 @@ private:
 
     Status _status;
     QVector4D _toolOffset;
+    MachineTrail _trail;
 };
 
 #endif // GSHARPIE_GRBLCONTROL_H
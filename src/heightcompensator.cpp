@@ -0,0 +1,332 @@
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "heightcompensator.h"
+
+using namespace std;
+
+
+// words of a moving line which are not part of its move: what grbl executes before the motion (modal words,
+// spindle, coolant, tool, dwell) and the program stops after it; line numbers and comments are dropped
+struct Words
+{
+    string before, after;
+    int command; // 28, 30, 38 (probing) or 53 written on the line, 0 if none
+    bool feed; // F word
+};
+
+
+static Words splitWords(const char* code)
+{
+    Words words;
+    words.command = 0;
+    words.feed = false;
+    for(const char* s = code; *s; ){
+        const char letter = ::toupper(*s);
+        if(letter == '('){
+            while(*s && *s++ != ')') ;
+            continue;
+        }
+        if(letter == ';')
+            break;
+        const char* start = s++;
+        if(!::isalpha(letter))
+            continue;
+
+        const char* end;
+        const int number = static_cast<int>(GCodeState::readNumber(s, &end));
+        s = end;
+        const string word(start, end);
+        switch(letter){
+            case 'G':
+                if(number == 28 || number == 30 || number == 38 || number == 53)
+                    words.command = number;
+                else if(number > GCodeState::ArcCCW)
+                    words.before += word;
+                break;
+            case 'M':
+                if(number == 0 || number == 1 || number == 2 || number == 30)
+                    words.after += word;
+                else
+                    words.before += word;
+                break;
+            case 'F':
+                words.feed = true;
+                break;
+            case 'N': case 'X': case 'Y': case 'Z': case 'I': case 'J': case 'K': case 'R':
+                break;
+            default: // S, T, P, L
+                words.before += word;
+        }
+    }
+    return words;
+}
+
+
+// reason why the move cannot follow the surface, nullptr if it can; the state has the line applied,
+// known tells the axes known before it
+static const char* refusal(const GCodeState& state, const GCodeMove& move, int command, const bool* known)
+{
+    if(command == 38 || move.type == GCodeMove::Probe)
+        return "probing move, it stops wherever it touches";
+    if(command != 0 || move.type == GCodeMove::Dwell)
+        return nullptr; // machine coordinates or homing
+    if(state.isIncremental())
+        return (known[0] && known[1] && known[2])? nullptr: "incremental move from an unknown position";
+    if(move.type == GCodeMove::Rapid)
+        return nullptr; // axes which stay unknown are not compensated, Z above an unknown XY clears the whole map
+
+    // the start of a straight move may be unknown in Z, it is not split then
+    if(!known[0] || !known[1] || !state.isKnown(2) || (move.isArc() && !known[2]))
+        return "feed move from an unknown position";
+    return nullptr;
+}
+
+
+void HeightCompensator::reset()
+{
+    GCodeFilter::reset();
+    _state.reset();
+    _sent[0] = _sent[1] = _sent[2] = 0.0;
+    _known = false;
+    _high = 0.0;
+    if(isReady()){
+        double low;
+        _map->range(low, _high);
+    }
+}
+
+
+//////  u n s u p p o r t e d  L i n e  //////
+int HeightCompensator::unsupportedLine(const GCodeProgram& program, const char** reason)
+{
+    GCodeState state;
+    for(int step=0; step < program.size(); ++step){
+        const char* code = program.codePtr(step);
+        const bool known[3] = {state.isKnown(0), state.isKnown(1), state.isKnown(2)};
+        GCodeMove move;
+        if(!state.update(code, &move))
+            continue;
+
+        const char* why = refusal(state, move, splitWords(code).command, known);
+        if(why){
+            if(reason)
+                *reason = why;
+            return program.lineNumber(step);
+        }
+    }
+    return 0;
+}
+
+
+//////  p r o c e s s  //////
+void HeightCompensator::_process(int lineNumber, const char* code)
+{
+    const bool known[3] = {_state.isKnown(0), _state.isKnown(1), _state.isKnown(2)}; // where the move starts
+    GCodeMove move;
+    const bool moved = _state.update(code, &move);
+
+    if(!moved){ // an arc mode restored here would want axis words, the next move restores it if needed
+        _emit(lineNumber, code);
+        return;
+    }
+    const Words words = splitWords(code);
+    if(move.type == GCodeMove::Dwell || words.command == 53 || refusal(_state, move, words.command, known)){
+        _emitOriginal(lineNumber, code, _state.motionMode()); // refused programs are checked before filtering
+        if(move.type != GCodeMove::Dwell)
+            _known = false; // left where the program says
+        return;
+    }
+    if(words.command != 0){
+        _emitHome(lineNumber, code, move, known);
+        _known = false;
+        return;
+    }
+
+    if(!words.before.empty())
+        _emit(lineNumber, words.before);
+    if(_state.isKnown(0) && _state.isKnown(1) && _state.isKnown(2))
+        _emitPieces(lineNumber, move, words.feed, known[2]);
+    else
+        _emitPartial(lineNumber, move, words.feed);
+    if(!words.after.empty())
+        _emit(lineNumber, words.after);
+}
+
+
+//////  e m i t  P i e c e s  //////
+void HeightCompensator::_emitPieces(int lineNumber, const GCodeMove& move, bool feedWord, bool zKnown)
+{
+    const double scale = _state.isImperial()? 25.4: 1.0;
+    const bool rapid = (move.type == GCodeMove::Rapid);
+    const int motion = rapid? GCodeState::Rapid: GCodeState::Linear;
+    const bool incremental = _state.isIncremental();
+
+    // every piece takes its share of the move's time in inverse time mode
+    const int pieces = zKnown? _pieces(move): 1;
+    const bool inverseTime = _state.isInverseTime() && !rapid;
+    const double length = move.length();
+    const double inverseFeed = (length > 0.0)? move.feed / length * pieces: 0.0; // 1/min
+
+    // the output continues from where the program stands if it has passed unchanged (G92)
+    double prev[3];
+    for(int k=0; k<3; ++k)
+        prev[k] = _known? _sent[k]: move.from[k];
+
+    static const char axis[3] = {'X', 'Y', 'Z'};
+    for(int i=1; i <= pieces; ++i){
+        double pos[3];
+        _point(move, i, pieces, pos);
+        pos[2] += _map->height(pos[0], pos[1]);
+
+        char buf[32];
+        ::sprintf(buf, "G%d", motion);
+        string line(buf);
+        for(int k=0; k<3; ++k){
+            if(incremental){ // between the rounded positions, the rounding does not add up
+                const double delta = ::round(pos[k]/scale*1e4)/1e4 - ::round(prev[k]/scale*1e4)/1e4;
+                if(::fabs(delta) >= 0.5e-4){
+                    ::sprintf(buf, "%c%.4f", axis[k], delta);
+                    line += buf;
+                }
+            }
+            else if(!_known || pos[k] != _sent[k]){
+                ::sprintf(buf, "%c%.4f", axis[k], pos[k]/scale);
+                line += buf;
+            }
+        }
+        if(inverseTime && line.size() > 2){ // required on every feed move
+            ::sprintf(buf, "F%g", inverseFeed);
+            line += buf;
+        }
+        else if(feedWord && !inverseTime && i == 1){ // modal, once is enough
+            ::sprintf(buf, "F%g", move.feed/scale);
+            line += buf;
+        }
+        if(line.size() > 2) // zero length pieces are left out
+            _emitMotion(lineNumber, line, motion);
+
+        for(int k=0; k<3; ++k)
+            prev[k] = _sent[k] = pos[k];
+        _known = true;
+    }
+}
+
+
+//////  e m i t  P a r t i a l  //////
+// absolute rapid to a position not known on all axes, only the axes written on the line are sent
+void HeightCompensator::_emitPartial(int lineNumber, const GCodeMove& move, bool feedWord)
+{
+    const double scale = _state.isImperial()? 25.4: 1.0;
+    static const char axis[3] = {'X', 'Y', 'Z'};
+    char buf[32];
+    string line("G0");
+    for(int k=0; k<3; ++k){
+        if(move.hasAxis[k]){
+            const double value = (k == 2)? move.to[k] + _height(move.to, _state.isKnown(0) && _state.isKnown(1)):
+                                           move.to[k];
+            ::sprintf(buf, "%c%.4f", axis[k], value/scale);
+            line += buf;
+        }
+    }
+    if(feedWord){
+        ::sprintf(buf, "F%g", move.feed/scale);
+        line += buf;
+    }
+    _emitMotion(lineNumber, line, GCodeState::Rapid);
+    _known = false;
+}
+
+
+//////  e m i t  H o m e  //////
+// G28/G30 pass through the intermediate point, its Z is raised like a rapid to it; the home position is not
+// in work coordinates, so it cannot be compensated, nor can an incremental intermediate point
+void HeightCompensator::_emitHome(int lineNumber, const char* code, const GCodeMove& move, const bool* known)
+{
+    if(_state.isIncremental() || !move.hasAxis[2]){
+        _emit(lineNumber, code); // a motion word would conflict with the axes of G28/G30
+        return;
+    }
+
+    const Words words = splitWords(code);
+    if(!words.before.empty())
+        _emit(lineNumber, words.before);
+
+    const double scale = _state.isImperial()? 25.4: 1.0;
+    const bool xyKnown = (move.hasAxis[0] || known[0]) && (move.hasAxis[1] || known[1]);
+    static const char axis[3] = {'X', 'Y', 'Z'};
+    char buf[32];
+    ::sprintf(buf, "G%d", words.command);
+    string line(buf);
+    for(int k=0; k<3; ++k){
+        if(move.hasAxis[k]){
+            ::sprintf(buf, "%c%.4f", axis[k], ((k == 2)? move.to[k] + _height(move.to, xyKnown): move.to[k])/scale);
+            line += buf;
+        }
+    }
+    _emit(lineNumber, line);
+
+    if(!words.after.empty())
+        _emit(lineNumber, words.after);
+}
+
+
+double HeightCompensator::_height(const double* pos, bool xyKnown) const
+{
+    return xyKnown? _map->height(pos[0], pos[1]): _high;
+}
+
+
+//////  p i e c e s  //////
+int HeightCompensator::_pieces(const GCodeMove& move) const
+{
+    // rapids go to their end at once, the surface between matters while cutting
+    if(move.type == GCodeMove::Rapid)
+        return 1;
+
+    const double cell = min(_map->cell(0), _map->cell(1));
+    double length;
+    int pieces = 1;
+    if(move.isArc()){
+        int a0, a1, lin;
+        move.planeAxes(a0, a1, lin);
+        const double radius = move.radius();
+        const double angle = ::fabs(move.angularTravel());
+        if(2.0*radius > _tolerance) // chord deviation stays within the tolerance
+            pieces = static_cast<int>(::ceil(0.5*angle*radius / ::sqrt(_tolerance*(2.0*radius - _tolerance))));
+        length = angle*radius; // upper bound of the travel over the surface
+    }
+    else
+        length = ::hypot(move.to[0] - move.from[0], move.to[1] - move.from[1]);
+
+    pieces = max(pieces, static_cast<int>(::ceil(length / cell)));
+    return max(1, min(pieces, static_cast<int>(MAX_PIECES)));
+}
+
+
+void HeightCompensator::_point(const GCodeMove& move, int piece, int pieces, double* pos) const
+{
+    if(piece == pieces){ // exactly where the program ends the move
+        for(int k=0; k<3; ++k)
+            pos[k] = move.to[k];
+        return;
+    }
+
+    const double t = static_cast<double>(piece) / pieces;
+    if(!move.isArc()){
+        for(int k=0; k<3; ++k)
+            pos[k] = move.from[k] + (move.to[k] - move.from[k])*t;
+        return;
+    }
+
+    int a0, a1, lin;
+    move.planeAxes(a0, a1, lin);
+    const double theta = move.angularTravel()*t;
+    const double rx = move.from[a0] - move.center[a0];
+    const double ry = move.from[a1] - move.center[a1];
+    pos[a0] = move.center[a0] + rx*::cos(theta) - ry*::sin(theta);
+    pos[a1] = move.center[a1] + rx*::sin(theta) + ry*::cos(theta);
+    pos[lin] = move.from[lin] + (move.to[lin] - move.from[lin])*t;
+}
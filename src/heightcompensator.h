@@ -0,0 +1,54 @@
+#ifndef GSHARPIE_HEIGHTCOMPENSATOR_H
+#define GSHARPIE_HEIGHTCOMPENSATOR_H
+#include <string>
+#include "gcodefilter.h"
+#include "heightmap.h"
+
+
+// follows a probed surface: Z of every move is raised by the probed work Z of the surface under it;
+// feed moves are split at the grid spacing and arcs are flattened, so they follow the surface between the points;
+// other words of a moving line are sent on their own line, before the move (or after it for program stops);
+// G53 moves are in machine coordinates and pass unchanged, G28/G30 raise only their intermediate Z
+class HeightCompensator: public GCodeFilter
+{
+public:
+    static const int MAX_PIECES = 10000; // of one move
+
+public:
+    explicit HeightCompensator(double tolerance=0.002) {_map = nullptr; _tolerance = tolerance; reset();}
+
+    // complete map, it must not change while the program is filtered
+    inline void setHeightMap(const HeightMap* map) {_map = map;}
+    inline const HeightMap* heightMap() const {return _map;}
+    inline bool isReady() const {return _map && _map->isComplete();}
+    // maximum deviation of the flattened arcs, mm
+    inline void setTolerance(double tolerance) {_tolerance = tolerance;}
+
+    // first source line whose move cannot follow the surface (probing, moves from an unknown position),
+    // 0 if the whole program can; such a program is not compensated at all
+    static int unsupportedLine(const GCodeProgram& program, const char** reason=nullptr);
+
+    const char* name() const override {return "Height compensation";}
+    void reset() override;
+
+protected:
+    void _process(int lineNumber, const char* code) override;
+
+private:
+    void _emitPieces(int lineNumber, const GCodeMove& move, bool feedWord, bool zKnown);
+    void _emitPartial(int lineNumber, const GCodeMove& move, bool feedWord);
+    void _emitHome(int lineNumber, const char* code, const GCodeMove& move, const bool* known);
+    double _height(const double* pos, bool xyKnown) const; // of the map under the point
+    int _pieces(const GCodeMove& move) const;
+    void _point(const GCodeMove& move, int piece, int pieces, double* pos) const;
+
+private:
+    const HeightMap* _map;
+    double _tolerance;
+    GCodeState _state; // of the input stream
+    double _sent[3]; // last position sent, mm, compensated
+    bool _known; // _sent is the position of the output
+    double _high; // the highest point of the map, raises rapids to an unknown XY
+};
+
+#endif // GSHARPIE_HEIGHTCOMPENSATOR_H
@@ -0,0 +1,80 @@
+#include <cmath>
+#include <algorithm>
+#include "heightmap.h"
+
+using namespace std;
+
+
+void HeightMap::clear()
+{
+    _origin[0] = _origin[1] = 0.0;
+    _cell[0] = _cell[1] = 1.0;
+    _columns = _rows = 0;
+    _heights.clear();
+    _known.clear();
+    _probed = 0;
+}
+
+
+void HeightMap::setGrid(const double* low, const double* high, double step)
+{
+    clear();
+    int size[2];
+    for(int i=0; i<2; ++i){
+        const double extent = high[i] - low[i];
+        size[i] = (extent > 0.0 && step > 0.0)? static_cast<int>(::ceil(extent / step)) + 1: 1;
+        _origin[i] = low[i];
+        _cell[i] = (size[i] > 1)? extent / (size[i] - 1): max(step, 1.0);
+    }
+    _columns = size[0];
+    _rows = size[1];
+    _heights.assign(_columns*_rows, 0.0);
+    _known.assign(_columns*_rows, false);
+}
+
+
+void HeightMap::position(int index, double& x, double& y) const
+{
+    x = _origin[0] + (index % _columns)*_cell[0];
+    y = _origin[1] + (index / _columns)*_cell[1];
+}
+
+
+void HeightMap::setHeight(int index, double z)
+{
+    if(!_known[index]){
+        _known[index] = true;
+        ++_probed;
+    }
+    _heights[index] = z;
+}
+
+
+//////  h e i g h t  //////
+double HeightMap::height(double x, double y) const
+{
+    // cell containing the point, clamped to the grid
+    const double fx = max(0.0, min(static_cast<double>(_columns - 1), (x - _origin[0]) / _cell[0]));
+    const double fy = max(0.0, min(static_cast<double>(_rows - 1), (y - _origin[1]) / _cell[1]));
+    const int i0 = min(static_cast<int>(fx), max(_columns - 2, 0));
+    const int j0 = min(static_cast<int>(fy), max(_rows - 2, 0));
+    const int i1 = min(i0 + 1, _columns - 1);
+    const int j1 = min(j0 + 1, _rows - 1);
+    const double tx = fx - i0, ty = fy - j0;
+
+    const double* row0 = &_heights[j0*_columns];
+    const double* row1 = &_heights[j1*_columns];
+    const double z0 = row0[i0] + (row0[i1] - row0[i0])*tx;
+    const double z1 = row1[i0] + (row1[i1] - row1[i0])*tx;
+    return z0 + (z1 - z0)*ty;
+}
+
+
+void HeightMap::range(double& low, double& high) const
+{
+    low = high = _heights.empty()? 0.0: _heights[0];
+    for(size_t i=1; i < _heights.size(); ++i){
+        low = min(low, _heights[i]);
+        high = max(high, _heights[i]);
+    }
+}
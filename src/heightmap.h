@@ -0,0 +1,41 @@
+#ifndef GSHARPIE_HEIGHTMAP_H
+#define GSHARPIE_HEIGHTMAP_H
+#include <vector>
+
+
+// surface heights probed on a regular grid, work Z in mm as the probe touched it; they are interpolated
+// bilinearly between the points, outside the grid the nearest edge holds
+class HeightMap
+{
+public:
+    HeightMap() {clear();}
+
+    void clear();
+
+    // points covering the area (x, y), no farther apart than the step; heights are unknown
+    void setGrid(const double* low, const double* high, double step);
+
+    inline bool isEmpty() const {return _heights.empty();}
+    inline int columns() const {return _columns;}
+    inline int rows() const {return _rows;}
+    inline int count() const {return static_cast<int>(_heights.size());} // points, row by row from the low corner
+    inline double cell(int axis) const {return _cell[axis];} // mm, spacing
+    void position(int index, double& x, double& y) const;
+
+    void setHeight(int index, double z); // probed (or interpolated) work Z, mm
+    inline bool isKnown(int index) const {return _known[index];}
+    inline double at(int index) const {return _heights[index];} // work Z
+    inline bool isComplete() const {return !_heights.empty() && _probed == count();}
+
+    double height(double x, double y) const; // work Z of a complete map
+    void range(double& low, double& high) const; // of the probed heights
+
+private:
+    double _origin[2], _cell[2]; // mm
+    int _columns, _rows;
+    std::vector<double> _heights;
+    std::vector<bool> _known;
+    int _probed;
+};
+
+#endif // GSHARPIE_HEIGHTMAP_H
@@ -0,0 +1,182 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <QTimer>
+#include "jogcontroller.h"
+
+static const double INITIAL_LATENCY = 0.05; // sec, until measured
+static const double MAX_LATENCY = 0.5; // sec, longer responses are not jogging anymore
+static const double LATENCY_MARGIN = 1.5; // a move lasts this many latencies at least
+static const double MIN_SEGMENT_TIME = 0.02; // sec
+static const double DEFAULT_ACCELERATION = 10.0; // mm/sec^2, until grbl's settings are known
+static const double MIN_STEP = 0.001; // mm, shorter moves are not sent
+
+
+JogController::JogController() : QObject(nullptr)
+{
+    _request.generation = 0;
+    _request.rate = 100;
+    _request.limits = false;
+    for(int i=0; i<3; ++i){
+        _request.direction[i] = 0;
+        _request.position[i] = _request.low[i] = _request.high[i] = 0.0;
+        _request.acceleration[i] = DEFAULT_ACCELERATION;
+    }
+    _latency = INITIAL_LATENCY;
+    _failed = false;
+    _clock.start();
+
+    _timer = nullptr;
+    _generation = 0;
+    for(int i=0; i<3; ++i)
+        _pos[i] = 0.0;
+    _queueEnd = 0.0;
+}
+
+
+void JogController::start()
+{
+    _timer = new QTimer(this);
+    _timer->setTimerType(Qt::PreciseTimer);
+    connect(_timer, SIGNAL(timeout()), this, SLOT(_tick()));
+    _timer->start(TICK);
+}
+
+
+void JogController::configure(const GrblControl::Config& config)
+{
+    QMutexLocker lock(&_mutex);
+    for(int i=0; i<3; ++i)
+        _request.acceleration[i] = (config.acceleration[i] > 0.0)? config.acceleration[i]: DEFAULT_ACCELERATION;
+}
+
+
+void JogController::setRate(int rate)
+{
+    QMutexLocker lock(&_mutex);
+    _request.rate = rate;
+}
+
+
+void JogController::setLimits(bool enable, const double* low, const double* high)
+{
+    QMutexLocker lock(&_mutex);
+    _request.limits = enable;
+    for(int i=0; i<3; ++i){
+        _request.low[i] = low[i];
+        _request.high[i] = high[i];
+    }
+}
+
+
+int JogController::jog(const int* direction, const double* position)
+{
+    QMutexLocker lock(&_mutex);
+    for(int i=0; i<3; ++i){
+        _request.direction[i] = direction[i];
+        _request.position[i] = position[i];
+    }
+    _failed = false;
+    return ++_request.generation;
+}
+
+
+void JogController::acknowledged(bool ok, double sent)
+{
+    const double sample = std::min(time() - sent, MAX_LATENCY);
+    QMutexLocker lock(&_mutex);
+    if(!ok)
+        _failed = true; // soft limits, or not in a state to jog
+
+    // rises at once, decays slowly
+    _latency = (sample > _latency)? sample: _latency + 0.1*(sample - _latency);
+}
+
+
+double JogController::latency() const
+{
+    QMutexLocker lock(&_mutex);
+    return _latency;
+}
+
+
+void JogController::steer(const int* direction)
+{
+    QMutexLocker lock(&_mutex);
+    for(int i=0; i<3; ++i)
+        _request.direction[i] = direction[i];
+    _failed = false;
+}
+
+
+//////  t i c k  //////
+void JogController::_tick()
+{
+    Request request;
+    double latency;
+    bool failed;
+    {
+        QMutexLocker lock(&_mutex);
+        request = _request;
+        latency = _latency;
+        failed = _failed;
+    }
+
+    const double now = time();
+    if(request.generation != _generation){ // new direction, or stop
+        _generation = request.generation;
+        for(int i=0; i<3; ++i)
+            _pos[i] = request.position[i];
+        _queueEnd = now;
+    }
+    if(failed || request.rate <= 0)
+        return;
+
+    double unit[3], norm = 0.0;
+    for(int i=0; i<3; ++i)
+        norm += request.direction[i]*request.direction[i];
+    if(norm == 0.0)
+        return;
+    norm = ::sqrt(norm);
+
+    // diagonal moves run at the rate along them,
+    // their acceleration is limited by every axis they drive (as grbl's planner does)
+    double acceleration = 1e30;
+    for(int i=0; i<3; ++i){
+        unit[i] = request.direction[i] / norm;
+        if(unit[i] != 0.0)
+            acceleration = std::min(acceleration, request.acceleration[i] / ::fabs(unit[i]));
+    }
+
+    // a move lasts longer than a response takes, and the moves queued after the first one
+    // are enough for the planner to stop from full speed: (n-1)*v*dt >= v^2/(2a)
+    const double speed = request.rate / 60.0; // mm/sec
+    double dt = std::max(LATENCY_MARGIN * latency, MIN_SEGMENT_TIME);
+    dt = std::max(dt, speed / (2.0*acceleration*(QUEUED_SEGMENTS-1)));
+
+    while(_queueEnd - now < (QUEUED_SEGMENTS-1)*dt){
+        double step[3], length = 0.0;
+        for(int i=0; i<3; ++i){
+            double target = _pos[i] + unit[i]*speed*dt;
+            if(request.limits)
+                target = std::max(request.low[i], std::min(request.high[i], target));
+            step[i] = ::round((target - _pos[i]) * 1000.0) / 1000.0; // as sent
+            length += step[i]*step[i];
+        }
+        length = ::sqrt(length);
+        if(length < MIN_STEP)
+            return; // at the limits, unless steered away
+
+        char code[80];
+        int n = ::sprintf(code, "$J=G91G21F%d", request.rate);
+        for(int i=0; i<3; ++i){
+            if(step[i] != 0.0)
+                n += ::sprintf(code + n, "%c%.3f", "XYZ"[i], step[i]);
+        }
+        emit command(QByteArray(code, n), _generation, now);
+
+        for(int i=0; i<3; ++i)
+            _pos[i] += step[i];
+        _queueEnd = std::max(_queueEnd, now) + length / speed;
+    }
+}
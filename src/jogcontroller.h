@@ -0,0 +1,77 @@
+#ifndef GSHARPIE_JOGCONTROLLER_H
+#define GSHARPIE_JOGCONTROLLER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include "grblcontrol.h"
+
+class QTimer;
+
+
+// continuous jogging: short incremental $J moves are streamed from a thread of its own, only a few
+// of them ahead of the machine; a released key stops it within a bounded distance even if the
+// jog cancel comes late, the moves are long enough for the link latency and for grbl's planner to
+// stop from full speed at the end of the queued ones
+class JogController : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int QUEUED_SEGMENTS = 3; // jog moves ahead of the machine, at most
+    static const int TICK = 5; // msec, period of the loop
+
+public:
+    JogController();
+
+    // thread-safe, called from the GUI thread
+    void configure(const GrblControl::Config& config); // accelerations
+    void setRate(int rate); // mm/min
+    void setLimits(bool enable, const double* low, const double* high); // mm, work coordinates
+
+    // -1, 0 or 1 per axis, all zeros stops; position is the last reported one (mm, work coordinates);
+    // returns the generation of the request, commands of older ones must not be sent
+    int jog(const int* direction, const double* position);
+    // new direction of the running jog, the moves already sent stay valid and the next ones turn
+    void steer(const int* direction);
+    void acknowledged(bool ok, double sent); // response of a $J line, emitted at the time given
+    double latency() const; // sec, from a command emitted to its response, smoothed
+    virtual double time() const {return _clock.elapsed() * 1e-3;} // sec, of the commands emitted; scripted in tests
+
+public slots:
+    void start(); // in the thread it lives in
+
+signals:
+    void command(QByteArray code, int generation, double time);
+
+protected slots:
+    void _tick(); // one pass of the loop, at time()
+
+private:
+    struct Request
+    {
+        int direction[3];
+        double position[3]; // mm, where the jog starts
+        int generation;
+        int rate; // mm/min
+        bool limits;
+        double low[3], high[3]; // mm
+        double acceleration[3]; // mm/sec^2
+    };
+
+private:
+    mutable QMutex _mutex; // guards the request and the responses
+    Request _request;
+    double _latency; // sec
+    bool _failed; // grbl rejected a move, no more until the next request
+    QElapsedTimer _clock;
+
+    // jog thread only
+    QTimer* _timer;
+    int _generation; // being executed
+    double _pos[3]; // mm, at the end of the moves sent
+    double _queueEnd; // sec, when the moves sent are expected to be done
+};
+
+#endif // GSHARPIE_JOGCONTROLLER_H
@@ -1,11 +1,54 @@
+#include <QThread>
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "jogcontroller.h"
+#include "jogsession.h"
+
+
+// jog session on the controller's link
+class GrblJogSession: public JogSession
+{
+public:
+    GrblJogSession(GrblControl* grbl, JogController* jog, QObject* parent) : JogSession(jog, parent) {_grbl = grbl;}
+
+protected:
+    qint64 _time() const override {return _grbl->getTime();}
+    GrblControl::MACHINE_STATE _state() const override {return _grbl->getCurrentStatus().state;}
+    const GrblControl::Config& _config() const override {return _grbl->getConfiguration();}
+    quint32 _send(const QByteArray& code) override {return _grbl->issueCommand(code.constData(), "Jog");}
+
+    void _position(double* pos) const override
+    {
+        const QVector4D& wpos = _grbl->getCurrentStatus().pos.wpos;
+        const double scale = _grbl->getConfiguration().imperial? 25.4: 1.0; // reported positions to mm
+        pos[0] = wpos.x()*scale;
+        pos[1] = wpos.y()*scale;
+        pos[2] = wpos.z()*scale;
+    }
+
+    void _cancel() override
+    {
+        _grbl->discardUnsent("$J="); // they would start it again after the cancel
+        _grbl->issueRealtimeCommand(GrblControl::CANCEL_JOGGING);
+    }
+
+private:
+    GrblControl* _grbl;
+};
 
 
 //////  i n i t  J o g g i n g  C o n t r o l s  /////
 void MainWindow::_initJoggingControls()
 {
-    _isJogging = false;
+    // the jog loop runs in a thread of its own, its moves are sent from here where the port lives
+    _jogThread = new QThread(this);
+    _jog = new JogController();
+    _jog->moveToThread(_jogThread);
+    _jogSession = new GrblJogSession(_grbl, _jog, this);
+    connect(_jogThread, SIGNAL(started()), _jog, SLOT(start()));
+    connect(_jogThread, SIGNAL(finished()), _jog, SLOT(deleteLater()));
+    connect(_jog, SIGNAL(command(QByteArray,int,double)), _jogSession, SLOT(issue(QByteArray,int,double)));
+    _jogThread->start();
 
     ui->dial_jogFeed->setWrapping(false);
     ui->dial_jogFeed->setRange(0, 26);
@@ -13,22 +56,22 @@ void MainWindow::_initJoggingControls()
 }
 
 
-///////  p r e p a r e  J o g  C o m m a n d  //////
-void MainWindow::_prepareJogCommand(char axis, double limit)
+//////  p r e s s  J o g  //////
+void MainWindow::_pressJog(int axis, int sign, bool pressed)
 {
-    ::sprintf(_jogCommand, "$J=G90G21F%d%c%.3f", _jogRate, axis, limit);
+    const GrblControl::Config& conf = _grbl->getConfiguration();
+    const double scale = conf.imperial? 25.4: 1.0; // limits to mm
+    const double low[3] = {ui->spin_minX->value()*scale, ui->spin_minY->value()*scale, ui->spin_minZ->value()*scale};
+    const double high[3] = {ui->spin_maxX->value()*scale, ui->spin_maxY->value()*scale, ui->spin_maxZ->value()*scale};
+    _jogSession->setLimits(ui->check_obeyLimits->isChecked(), low, high); // for a jog which starts now
+    _jogSession->press(axis, sign, pressed);
 }
 
 
-//////  c a n c e l  J o g g i n g  //////
-void MainWindow::_cancelJogging()
+//////  r e l e a s e  J o g  K e y s  //////
+void MainWindow::_releaseJogKeys()
 {
-    if(!_isJogging){
-//        on_errorReport(1, QString("Attempt to cancel jogging on idle"));
-        return;
-    }
-    _isJogging = false;
-    _grbl->issueRealtimeCommand(GrblControl::CANCEL_JOGGING);
+    _jogSession->releaseAll();
 }
 
 
@@ -64,6 +107,7 @@ int MainWindow::_pos2Rate(int pos)
 void MainWindow::on_dial_jogFeed_valueChanged(int value)
 {
     _jogRate = _pos2Rate(value);
+    _jog->setRate(_jogRate); // applies to the next jog moves
     ui->label_jogFeed->setText(QString::number(_jogRate));
 }
 
@@ -71,106 +115,82 @@ void MainWindow::on_dial_jogFeed_valueChanged(int value)
 /////  j o g  R i g h t  p r e s s e d  /////
 void MainWindow::on_btn_jogRight_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('X', ui->check_obeyLimits->isChecked()? ui->spin_maxX->value(): 9999.);
-        _grbl->issueCommand(_jogCommand, "Jog right");
-        _isJogging = true;
-    }
+    _pressJog(0, 1, true);
 }
 
 
 /////  j o g  R i g h t  r e l e a s e d  /////
 void MainWindow::on_btn_jogRight_released()
 {
-    _cancelJogging();
+    _pressJog(0, 1, false);
 }
 
 
 /////  j o g  L e f t  p r e s s e d  /////
 void MainWindow::on_btn_jogLeft_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('X', ui->check_obeyLimits->isChecked()? ui->spin_minX->value(): -9999.);
-        _grbl->issueCommand(_jogCommand, "Jog left");
-        _isJogging = true;
-    }
+    _pressJog(0, -1, true);
 }
 
 
 /////  j o g  L e f t  r e l e a s e d  /////
 void MainWindow::on_btn_jogLeft_released()
 {
-    _cancelJogging();
+    _pressJog(0, -1, false);
 }
 
 
 /////  j o g  F o r w a r d  p r e s s e d  /////
 void MainWindow::on_btn_jogForward_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('Y', ui->check_obeyLimits->isChecked()? ui->spin_maxY->value(): 9999.);
-        _grbl->issueCommand(_jogCommand, "Jog forward");
-        _isJogging = true;
-    }
+    _pressJog(1, 1, true);
 }
 
 
 /////  j o g  F o r w a r d  r e l e a s e d  /////
 void MainWindow::on_btn_jogForward_released()
 {
-    _cancelJogging();
+    _pressJog(1, 1, false);
 }
 
 
 /////  j o g  B a c k w a r d  p r e s s e d  /////
 void MainWindow::on_btn_jogBackward_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('Y', ui->check_obeyLimits->isChecked()? ui->spin_minY->value(): -9999.);
-        _grbl->issueCommand(_jogCommand, "Jog backward");
-        _isJogging = true;
-    }
+    _pressJog(1, -1, true);
 }
 
 
 /////  j o g  B a c k w a r d  r e l e a s e d  /////
 void MainWindow::on_btn_jogBackward_released()
 {
-    _cancelJogging();
+    _pressJog(1, -1, false);
 }
 
 
 /////  j o g  U p  p r e s s e d  /////
 void MainWindow::on_btn_jogUp_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('Z', ui->check_obeyLimits->isChecked()? ui->spin_maxZ->value(): 9999.);
-        _grbl->issueCommand(_jogCommand, "Jog up");
-        _isJogging = true;
-    }
+    _pressJog(2, 1, true);
 }
 
 
 /////  j o g  U p  r e l e a s e d  /////
 void MainWindow::on_btn_jogUp_released()
 {
-    _cancelJogging();
+    _pressJog(2, 1, false);
 }
 
 
 /////  j o g  D o w n  p r e s s e d  /////
 void MainWindow::on_btn_jogDown_pressed()
 {
-    if(_grbl->getCurrentStatus().state == GrblControl::Idle){
-        _prepareJogCommand('Z', ui->check_obeyLimits->isChecked()? ui->spin_minZ->value(): -9999.);
-        _grbl->issueCommand(_jogCommand, "Jog down");
-        _isJogging = true;
-    }
+    _pressJog(2, -1, true);
 }
 
 
 /////  j o g  D o w n  r e l e a s e d  /////
 void MainWindow::on_btn_jogDown_released()
 {
-    _cancelJogging();
+    _pressJog(2, -1, false);
 }
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include "joglatency.h"
+
+
+JogLatency::JogLatency()
+{
+    for(int i=0; i<INTERVALS; ++i){
+        _samples[i].resize(HISTORY);
+        _counts[i] = 0;
+        _waiting[i] = false;
+    }
+    _pressed = _released = 0;
+}
+
+
+void JogLatency::pressed(qint64 time)
+{
+    _pressed = time;
+    _waiting[PressToCommand] = _waiting[PressToMotion] = true;
+    _waiting[ReleaseToCancel] = _waiting[ReleaseToStop] = false;
+}
+
+
+void JogLatency::commandSent(qint64 time)
+{
+    if(_waiting[PressToCommand]){
+        _waiting[PressToCommand] = false;
+        _add(PressToCommand, time - _pressed);
+    }
+}
+
+
+void JogLatency::released(qint64 time)
+{
+    _released = time;
+    _waiting[PressToCommand] = _waiting[PressToMotion] = false; // too short to move
+    _waiting[ReleaseToCancel] = _waiting[ReleaseToStop] = true;
+}
+
+
+void JogLatency::cancelSent(qint64 time)
+{
+    if(_waiting[ReleaseToCancel]){
+        _waiting[ReleaseToCancel] = false;
+        _add(ReleaseToCancel, time - _released);
+    }
+}
+
+
+bool JogLatency::reported(qint64 time, GrblControl::MACHINE_STATE state)
+{
+    if(_waiting[PressToMotion] && state == GrblControl::Jog){
+        _waiting[PressToMotion] = false;
+        _add(PressToMotion, time - _pressed);
+    }
+    if(_waiting[ReleaseToStop] && state == GrblControl::Idle){
+        _waiting[ReleaseToStop] = false;
+        _add(ReleaseToStop, time - _released);
+        return true;
+    }
+    return false;
+}
+
+
+void JogLatency::_add(INTERVAL interval, qint64 value)
+{
+    _samples[interval][_counts[interval] % HISTORY] = value;
+    ++_counts[interval];
+}
+
+
+JogLatency::Summary JogLatency::summary(INTERVAL interval) const
+{
+    Summary summary;
+    summary.count = std::min(_counts[interval], static_cast<int>(HISTORY));
+    summary.median = summary.p90 = summary.p99 = summary.max = 0;
+    if(summary.count == 0)
+        return summary;
+
+    std::vector<qint64> sorted(_samples[interval].begin(), _samples[interval].begin() + summary.count);
+    std::sort(sorted.begin(), sorted.end());
+    const int last = summary.count - 1;
+    summary.median = sorted[last * 50 / 100]; // nearest rank below
+    summary.p90 = sorted[last * 90 / 100];
+    summary.p99 = sorted[last * 99 / 100];
+    summary.max = sorted[last];
+    return summary;
+}
+
+
+QString JogLatency::report() const
+{
+    static const char* NAMES[INTERVALS] = {"press to command", "press to motion", "release to cancel", "release to stop"};
+
+    QString text("Jog latency, msec (median/90%/99%/max of samples):");
+    for(int i=0; i<INTERVALS; ++i){
+        const Summary s = summary(static_cast<INTERVAL>(i));
+        text += QString(" %1 %2/%3/%4/%5 of %6%7").arg(NAMES[i]).arg(s.median).arg(s.p90).arg(s.p99).arg(s.max)
+                                                     .arg(s.count).arg(i < INTERVALS-1? ",": "");
+    }
+    return text;
+}
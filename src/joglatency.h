@@ -0,0 +1,48 @@
+#ifndef GSHARPIE_JOGLATENCY_H
+#define GSHARPIE_JOGLATENCY_H
+#include <vector>
+#include <QtGlobal>
+#include <QString>
+#include "grblcontrol.h"
+
+
+// how fast jogging responds: from the key or button held to the first $J line sent and to the first report
+// in Jog state, from its release to the jog cancel sent and to the first report in Idle state;
+// the reports come once per status period, the intervals ending with them are that much coarse
+class JogLatency
+{
+public:
+    static const int HISTORY = 1024; // last samples kept of each interval
+
+    enum INTERVAL{PressToCommand, PressToMotion, ReleaseToCancel, ReleaseToStop, INTERVALS};
+
+    struct Summary // msec
+    {
+        int count;
+        qint64 median, p90, p99, max;
+    };
+
+public:
+    JogLatency();
+
+    // times are msec, GrblControl::getTime()
+    void pressed(qint64 time); // jog started, at the time the first key or button was held
+    void commandSent(qint64 time);
+    void released(qint64 time);
+    void cancelSent(qint64 time);
+    bool reported(qint64 time, GrblControl::MACHINE_STATE state); // true when a jog has stopped
+
+    Summary summary(INTERVAL interval) const;
+    QString report() const; // all the intervals, one line
+
+private:
+    void _add(INTERVAL interval, qint64 value);
+
+private:
+    std::vector<qint64> _samples[INTERVALS]; // rings
+    int _counts[INTERVALS]; // samples added
+    qint64 _pressed, _released;
+    bool _waiting[INTERVALS]; // for the end of the interval
+};
+
+#endif // GSHARPIE_JOGLATENCY_H
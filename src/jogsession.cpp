@@ -0,0 +1,135 @@
+#include "jogsession.h"
+#include "jogcontroller.h"
+
+
+JogSession::JogSession(JogController* jog, QObject* parent) : QObject(parent)
+{
+    _jog = jog;
+    _jogging = false;
+    _generation = 0;
+    _keys = 0;
+    _pending = false;
+    _pressTime = 0;
+    _limits = false;
+    for(int i=0; i<3; ++i){
+        _direction[i] = 0;
+        _low[i] = _high[i] = 0.0;
+    }
+}
+
+
+void JogSession::setLimits(bool enable, const double* low, const double* high)
+{
+    _limits = enable;
+    for(int i=0; i<3; ++i){
+        _low[i] = low[i];
+        _high[i] = high[i];
+    }
+}
+
+
+//////  p r e s s  //////
+void JogSession::press(int axis, int sign, bool pressed)
+{
+    const int key = 1 << (2*axis + (sign > 0? 0: 1));
+    if(pressed && _keys == 0)
+        _pressTime = _time();
+    _keys = pressed? (_keys | key): (_keys & ~key);
+    _update();
+}
+
+
+void JogSession::releaseAll()
+{
+    _keys = 0;
+    _update();
+}
+
+
+//////  u p d a t e  //////
+// all the directions held are combined into one, a change turns the jog in progress
+void JogSession::_update()
+{
+    int direction[3];
+    bool moving = false;
+    for(int i=0; i<3; ++i){
+        direction[i] = ((_keys >> 2*i) & 1) - ((_keys >> (2*i + 1)) & 1); // opposite ones cancel
+        moving = moving || direction[i] != 0;
+    }
+
+    if(!moving){
+        _pending = false;
+        if(!_jogging)
+            return;
+        _jogging = false;
+
+        const double position[3] = {0.0, 0.0, 0.0};
+        for(int i=0; i<3; ++i)
+            _direction[i] = 0;
+        _generation = _jog->jog(_direction, position); // moves on their way are not sent
+        _latency.released(_time());
+        _cancel(); // the queued moves would stop it a little later anyway
+        _latency.cancelSent(_time());
+        return;
+    }
+
+    if(_jogging){
+        if(direction[0] != _direction[0] || direction[1] != _direction[1] || direction[2] != _direction[2]){
+            for(int i=0; i<3; ++i)
+                _direction[i] = direction[i];
+            _jog->steer(_direction); // no stop, grbl joins the moves
+        }
+        return;
+    }
+
+    const GrblControl::MACHINE_STATE state = _state();
+    _pending = (state == GrblControl::Jog); // still stopping, starts when idle
+    if(state != GrblControl::Idle)
+        return;
+
+    double position[3];
+    _position(position);
+    _jog->configure(_config());
+    _jog->setLimits(_limits, _low, _high);
+
+    for(int i=0; i<3; ++i)
+        _direction[i] = direction[i];
+    _sent.clear(); // responses still coming are not measured
+    _generation = _jog->jog(_direction, position);
+    _latency.pressed(_pressTime); // waiting for the last jog to stop counts too
+    _jogging = true;
+}
+
+
+//////  i s s u e  //////
+void JogSession::issue(QByteArray code, int generation, double time)
+{
+    if(!_jogging || generation != _generation)
+        return; // released meanwhile
+
+    const quint32 id = _send(code);
+    if(id != 0){
+        _sent.insert(id, time);
+        _latency.commandSent(_time());
+    }
+}
+
+
+bool JogSession::completed(const GrblControl::Command& cmd)
+{
+    QHash<quint64, double>::iterator it = _sent.find(cmd.id);
+    if(it == _sent.end())
+        return false;
+    _jog->acknowledged(cmd.error.isEmpty(), it.value()); // measures the latency of the link
+    _sent.erase(it);
+    return true;
+}
+
+
+bool JogSession::reported(qint64 time, GrblControl::MACHINE_STATE state)
+{
+    const bool stopped = _latency.reported(time, state);
+    if(_pending && state == GrblControl::Idle)
+        _update(); // directions held while the machine was stopping
+    return stopped;
+}
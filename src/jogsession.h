@@ -0,0 +1,64 @@
+#ifndef GSHARPIE_JOGSESSION_H
+#define GSHARPIE_JOGSESSION_H
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include "grblcontrol.h"
+#include "joglatency.h"
+
+class JogController;
+
+
+// keys and buttons held to jog moves: the directions held are combined into one, a jog starts once the machine
+// is idle, only the moves of the current request are sent and a release drops the unsent ones and cancels the jog;
+// the latency of it all is measured on the way. The link to grbl is up to a subclass, GrblControl in the
+// application and a simulated one in tests
+class JogSession: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit JogSession(JogController* jog, QObject* parent=nullptr);
+
+    // work area the next jog keeps in (mm, work coordinates), the running one keeps its own
+    void setLimits(bool enable, const double* low, const double* high);
+
+    void press(int axis, int sign, bool pressed); // sign +1 or -1
+    void releaseAll(); // their release would not be seen
+
+    bool completed(const GrblControl::Command& cmd); // true if it was a jog move
+    bool reported(qint64 time, GrblControl::MACHINE_STATE state); // true when a jog has stopped
+
+    inline bool isJogging() const {return _jogging;} // faster than reading status from grbl
+    inline const JogLatency& latency() const {return _latency;}
+
+public slots:
+    void issue(QByteArray code, int generation, double time); // jog move of the controller
+
+protected:
+    // the link to grbl
+    virtual qint64 _time() const = 0; // msec, of the status reports
+    virtual GrblControl::MACHINE_STATE _state() const = 0; // last reported
+    virtual void _position(double* pos) const = 0; // mm, last reported work position
+    virtual const GrblControl::Config& _config() const = 0;
+    virtual quint32 _send(const QByteArray& code) = 0; // command id, 0 if not sent
+    virtual void _cancel() = 0; // drops the jog moves not sent yet, then the jog cancel
+
+private:
+    void _update(); // directions held have changed, or the machine has stopped
+
+private:
+    JogController* _jog; // streams short jog moves from its thread
+    bool _jogging;
+    int _generation; // of the last request, older moves are not sent
+    int _direction[3]; // -1, 0 or 1 per axis
+    int _keys; // directions held, bit 2*axis for positive and 2*axis+1 for negative
+    bool _pending; // held while the last jog was stopping
+    qint64 _pressTime; // msec, first direction held
+    bool _limits;
+    double _low[3], _high[3]; // mm
+    QHash<quint64, double> _sent; // command id -> time the move was emitted, for the latency
+    JogLatency _latency; // from the keys to the machine's response
+};
+
+#endif // GSHARPIE_JOGSESSION_H
@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <QDateTime>
+#include "logrecord.h"
+
+
+LogRecord::LogRecord(int level, const char* event)
+{
+    this->level = level;
+    this->time = QDateTime::currentMSecsSinceEpoch();
+    this->event = event;
+}
+
+
+LogRecord& LogRecord::add(const char* name, qint64 value)
+{
+    Field field;
+    field.name = name;
+    field.type = Field::Integer;
+    field.integer = value;
+    field.real = 0.0;
+    fields.push_back(field);
+    return *this;
+}
+
+
+LogRecord& LogRecord::add(const char* name, double value)
+{
+    Field field;
+    field.name = name;
+    field.type = Field::Real;
+    field.integer = 0;
+    field.real = value;
+    fields.push_back(field);
+    return *this;
+}
+
+
+LogRecord& LogRecord::add(const char* name, const QString& value)
+{
+    Field field;
+    field.name = name;
+    field.type = Field::Text;
+    field.integer = 0;
+    field.real = 0.0;
+    field.text = value;
+    fields.push_back(field);
+    return *this;
+}
+
+
+LogRecord& LogRecord::addHex(const char* name, int value)
+{
+    return add(name, QString("0x") + QString::number(value, 16));
+}
+
+
+//////  m e s s a g e  //////
+QString LogRecord::message() const
+{
+    QString msg = QString::fromLatin1(event);
+    for(size_t i=0; i < fields.size(); ++i){
+        msg += (i == 0)? QStringLiteral(": "): QStringLiteral(", ");
+        msg += QString::fromLatin1(fields[i].name) + QStringLiteral("=");
+        if(fields[i].type == Field::Integer)
+            msg += QString::number(fields[i].integer);
+        else if(fields[i].type == Field::Real)
+            msg += QString::number(fields[i].real);
+        else
+            msg += fields[i].text;
+    }
+    return msg;
+}
+
+
+static void appendJsonString(QByteArray& out, const QString& text)
+{
+    out += '"';
+    const QByteArray utf8 = text.toUtf8();
+    for(int i=0; i < utf8.size(); ++i){
+        const char c = utf8[i];
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += c;
+        }
+        else if(static_cast<unsigned char>(c) < 0x20){
+            char escaped[8];
+            ::sprintf(escaped, "\\u%04x", static_cast<unsigned char>(c));
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+
+//////  j s o n  //////
+QByteArray LogRecord::json() const
+{
+    QByteArray out;
+    out.reserve(64 + 24*static_cast<int>(fields.size()));
+    out += "{\"time\":";
+    out += QByteArray::number(time);
+    out += ",\"level\":";
+    out += QByteArray::number(level);
+    out += ",\"event\":";
+    appendJsonString(out, QString::fromLatin1(event));
+    for(size_t i=0; i < fields.size(); ++i){
+        out += ",\"";
+        out += fields[i].name;
+        out += "\":";
+        if(fields[i].type == Field::Integer)
+            out += QByteArray::number(fields[i].integer);
+        else if(fields[i].type == Field::Real)
+            out += QByteArray::number(fields[i].real, 'g', 10);
+        else
+            appendJsonString(out, fields[i].text);
+    }
+    out += '}';
+    return out;
+}
@@ -0,0 +1,52 @@
+#ifndef GSHARPIE_LOGRECORD_H
+#define GSHARPIE_LOGRECORD_H
+
+#include <vector>
+#include <QString>
+#include <QByteArray>
+
+extern int GSharpieReportLevel;
+
+// nothing should be formatted for records below the reported level
+inline bool isReported(int level) {return level >= GSharpieReportLevel;}
+
+
+// event with typed fields, turned into text only where it is shown or written
+class LogRecord
+{
+public:
+    struct Field
+    {
+        enum TYPE{Integer, Real, Text};
+
+        const char* name; // static string
+        TYPE type;
+        qint64 integer;
+        double real;
+        QString text;
+    };
+
+public:
+    LogRecord() {level = 0; time = 0; event = "";}
+    LogRecord(int level, const char* event); // event is a static string
+
+    LogRecord& add(const char* name, qint64 value);
+    LogRecord& add(const char* name, int value) {return add(name, static_cast<qint64>(value));}
+    LogRecord& add(const char* name, quint32 value) {return add(name, static_cast<qint64>(value));}
+    LogRecord& add(const char* name, double value);
+    LogRecord& add(const char* name, const QString& value);
+    LogRecord& add(const char* name, const QByteArray& value) {return add(name, QString::fromLatin1(value));}
+    LogRecord& add(const char* name, const char* value) {return add(name, QString::fromLatin1(value));}
+    LogRecord& addHex(const char* name, int value);
+
+    QString message() const; // event: name=value ...
+    QByteArray json() const; // one line, without the new line
+
+public:
+    int level; // as in GrblControl::report()
+    qint64 time; // msec since epoch
+    const char* event;
+    std::vector<Field> fields;
+};
+
+#endif // GSHARPIE_LOGRECORD_H
@@ -0,0 +1,318 @@
+#include <climits>
+#include <QtWidgets>
+#include "logview.h"
+
+static const int TEXT_MARGIN = 4;
+static const int FRAME_PERIOD = 16; // msec, records are shown at most once per frame
+static const int PREFIX_LENGTH = 15; // "(H:mm:ss)Err: "
+
+
+LogView::LogView(QWidget *parent) : QAbstractScrollArea(parent), _queue(QUEUE_SIZE), _history(HISTORY_SIZE)
+{
+    for(size_t i=0; i < _queue.size(); ++i)
+        _queue[i].stamp = 0;
+    _queueHead = 0;
+    _queueTail = 0;
+    _flushScheduled = false;
+    _dropped = 0;
+    _firstSeq = _endSeq = 0;
+    _minLevel = INT_MIN;
+    _longest = 0;
+
+    _timerFlush = new QTimer(this);
+    _timerFlush->setSingleShot(true);
+    connect(_timerFlush, SIGNAL(timeout()), this, SLOT(_flush()));
+
+    _search = new QLineEdit(this);
+    _search->setPlaceholderText("Find");
+    _search->hide();
+    connect(_search, SIGNAL(textChanged(QString)), this, SLOT(_searchChanged(QString)));
+    connect(_search, SIGNAL(editingFinished()), this, SLOT(_searchFinished()));
+}
+
+
+//////  a p p e n d  //////
+void LogView::append(int level, const QString& text)
+{
+    qint64 head = _queueHead.load(std::memory_order_relaxed);
+    do{
+        if(head - _queueTail.load(std::memory_order_acquire) >= QUEUE_SIZE){
+            ++_dropped; // view is behind by a whole queue, nobody reads that fast anyway
+            return;
+        }
+    }while(!_queueHead.compare_exchange_weak(head, head+1, std::memory_order_acq_rel));
+
+    // the slot is ours until the stamp is published
+    Slot& slot = _queue[head % QUEUE_SIZE];
+    slot.record.level = level;
+    slot.record.time = QTime::currentTime().msecsSinceStartOfDay();
+    slot.record.text = text;
+    slot.stamp.store(head+1, std::memory_order_release);
+
+    if(!_flushScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, "_scheduleFlush", Qt::QueuedConnection);
+}
+
+
+void LogView::clear()
+{
+    _flush(); // queued records are older than the clearing
+    _firstSeq = _endSeq;
+    for(size_t i=0; i < _filters.size(); ++i)
+        _filters[i].matches.clear();
+    _longest = 0;
+    _updateScrollBars();
+    viewport()->update();
+}
+
+
+void LogView::_scheduleFlush()
+{
+    if(!_timerFlush->isActive())
+        _timerFlush->start(FRAME_PERIOD);
+}
+
+
+//////  f l u s h  //////
+void LogView::_flush()
+{
+    _flushScheduled = false; // records appended from now on schedule the next frame
+
+    QScrollBar* scroll = verticalScrollBar();
+    const bool following = (scroll->value() >= scroll->maximum());
+    const int shown = _shownCount();
+
+    int removed = 0; // rows scrolled out at the top
+    const int dropped = _dropped.exchange(0);
+    if(dropped > 0){
+        Record record = {1, QTime::currentTime().msecsSinceStartOfDay(),
+                         QString::number(dropped) + QString(" log records dropped")};
+        _add(record, removed);
+    }
+
+    qint64 tail = _queueTail.load(std::memory_order_relaxed);
+    for(;;){
+        Slot& slot = _queue[tail % QUEUE_SIZE];
+        if(slot.stamp.load(std::memory_order_acquire) != tail+1)
+            break; // not written yet, or nothing more
+        _add(slot.record, removed);
+        slot.record.text.clear();
+        _queueTail.store(++tail, std::memory_order_release);
+    }
+
+    if(_shownCount() == shown && removed == 0)
+        return;
+    _updateScrollBars();
+    if(following)
+        scroll->setValue(scroll->maximum());
+    else
+        scroll->setValue(scroll->value() - removed); // keeps the same records in view
+    viewport()->update();
+}
+
+
+void LogView::_add(const Record& record, int& removed)
+{
+    if(_endSeq - _firstSeq == HISTORY_SIZE){ // the ring is full, the oldest record is overwritten
+        ++_firstSeq;
+        if(_filters.empty())
+            ++removed;
+    }
+    _history[_endSeq % HISTORY_SIZE] = record;
+
+    // filters only look at the new record
+    for(size_t i=0; i < _filters.size(); ++i){
+        std::deque<qint64>& matches = _filters[i].matches;
+        while(!matches.empty() && matches.front() < _firstSeq){
+            matches.pop_front();
+            if(i+1 == _filters.size())
+                ++removed;
+        }
+        if(_matches(record, _filters[i]))
+            matches.push_back(_endSeq);
+    }
+    _longest = qMax(_longest, PREFIX_LENGTH + record.text.size());
+    ++_endSeq;
+}
+
+
+//////  s e t  F i l t e r  //////
+void LogView::setFilter(int minLevel, const QString& text)
+{
+    _minLevel = minLevel;
+    _text = text;
+
+    // back to the last filter this one narrows, its matches are searched instead of the history
+    while(!_filters.empty() && !(minLevel >= _filters.back().minLevel &&
+                                 text.contains(_filters.back().text, Qt::CaseInsensitive)))
+        _filters.pop_back();
+
+    const bool same = _filters.empty()? (minLevel == INT_MIN && text.isEmpty()):
+                                        (minLevel == _filters.back().minLevel &&
+                                         text.compare(_filters.back().text, Qt::CaseInsensitive) == 0);
+    if(!same){
+        Filter filter;
+        filter.minLevel = minLevel;
+        filter.text = text;
+        if(_filters.empty()){
+            for(qint64 seq = _firstSeq; seq < _endSeq; ++seq)
+                if(_matches(_record(seq), filter))
+                    filter.matches.push_back(seq);
+        }
+        else{
+            const std::deque<qint64>& wider = _filters.back().matches;
+            for(size_t i=0; i < wider.size(); ++i)
+                if(_matches(_record(wider[i]), filter))
+                    filter.matches.push_back(wider[i]);
+        }
+        _filters.push_back(filter);
+    }
+
+    _updateScrollBars();
+    verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    viewport()->update();
+}
+
+
+bool LogView::_matches(const Record& record, const Filter& filter) const
+{
+    return record.level >= filter.minLevel &&
+           (filter.text.isEmpty() || record.text.contains(filter.text, Qt::CaseInsensitive));
+}
+
+
+int LogView::_shownCount() const
+{
+    return _filters.empty()? static_cast<int>(_endSeq - _firstSeq): static_cast<int>(_filters.back().matches.size());
+}
+
+
+qint64 LogView::_shownSeq(int row) const
+{
+    return _filters.empty()? _firstSeq + row: _filters.back().matches[row];
+}
+
+
+QString LogView::_format(const Record& record) const
+{
+    QString prefix = QTime::fromMSecsSinceStartOfDay(record.time).toString("(H:mm:ss)");
+    if(record.level > 0)
+        prefix += QStringLiteral("Err: ");
+    else if(record.level == 0)
+        prefix += QStringLiteral("Msg: ");
+    else
+        prefix += QStringLiteral("Dbg: ");
+    return prefix + record.text;
+}
+
+
+bool LogView::hasSearchFocus() const
+{
+    return _search->hasFocus();
+}
+
+
+void LogView::_searchChanged(const QString& text)
+{
+    setFilter(_minLevel, text);
+}
+
+
+void LogView::_searchFinished()
+{
+    if(_search->text().isEmpty())
+        _search->hide();
+}
+
+
+void LogView::_updateScrollBars()
+{
+    const int lineHeight = fontMetrics().height();
+    const int visible = qMax(1, viewport()->height() / lineHeight);
+    verticalScrollBar()->setRange(0, qMax(0, _shownCount() - visible));
+    verticalScrollBar()->setPageStep(visible);
+    verticalScrollBar()->setSingleStep(1);
+
+    const int charWidth = fontMetrics().width(QLatin1Char('9'));
+    const int width = 2*TEXT_MARGIN + _longest*charWidth;
+    horizontalScrollBar()->setRange(0, qMax(0, width - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setSingleStep(charWidth);
+}
+
+
+void LogView::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+
+    const int width = qMin(200, viewport()->width()/2);
+    _search->setGeometry(viewport()->geometry().right() - width, viewport()->geometry().top(),
+                         width, _search->sizeHint().height());
+    _updateScrollBars();
+}
+
+
+void LogView::scrollContentsBy(int /* dx */, int /* dy */)
+{
+    viewport()->update();
+}
+
+
+void LogView::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), palette().color(QPalette::Base));
+    painter.setPen(palette().color(QPalette::Text));
+
+    const int lineHeight = fontMetrics().height();
+    const int left = TEXT_MARGIN - horizontalScrollBar()->value();
+    int row = verticalScrollBar()->value() + event->rect().top() / lineHeight;
+    int top = (row - verticalScrollBar()->value()) * lineHeight;
+
+    const int count = _shownCount();
+    while(row < count && top <= event->rect().bottom()){
+        painter.drawText(left, top + fontMetrics().ascent(), _format(_record(_shownSeq(row))));
+        top += lineHeight;
+        ++row;
+    }
+}
+
+
+void LogView::contextMenuEvent(QContextMenuEvent *event)
+{
+    QMenu menu(this);
+    QAction* find = menu.addAction("Find...");
+    menu.addSeparator();
+    QAction* all = menu.addAction("Show all");
+    QAction* messages = menu.addAction("Show messages and errors");
+    QAction* errors = menu.addAction("Show errors only");
+    all->setCheckable(true);
+    messages->setCheckable(true);
+    errors->setCheckable(true);
+    all->setChecked(_minLevel < 0);
+    messages->setChecked(_minLevel == 0);
+    errors->setChecked(_minLevel > 0);
+    menu.addSeparator();
+    QAction* copy = menu.addAction("Copy shown");
+    QAction* clearAll = menu.addAction("Clear");
+
+    QAction* chosen = menu.exec(event->globalPos());
+    if(chosen == find){
+        _search->show();
+        _search->setFocus();
+    }
+    else if(chosen == all)
+        setFilter(INT_MIN, _text);
+    else if(chosen == messages)
+        setFilter(0, _text);
+    else if(chosen == errors)
+        setFilter(1, _text);
+    else if(chosen == copy){
+        QStringList lines;
+        for(int row=0; row < _shownCount(); ++row)
+            lines.append(_format(_record(_shownSeq(row))));
+        QApplication::clipboard()->setText(lines.join('\n'));
+    }
+    else if(chosen == clearAll)
+        clear();
+}
@@ -0,0 +1,99 @@
+#ifndef GSHARPIE_LOGVIEW_H
+#define GSHARPIE_LOGVIEW_H
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <QString>
+#include <QAbstractScrollArea>
+
+class QTimer;
+class QLineEdit;
+class QPaintEvent;
+class QResizeEvent;
+class QContextMenuEvent;
+
+
+// log records kept in a ring of fixed size, only the visible ones are painted
+class LogView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    static const int HISTORY_SIZE = 10000; // records shown, older ones are dropped
+    static const int QUEUE_SIZE = 4096; // records waiting for the next frame
+
+    struct Record
+    {
+        int level; // as in GrblControl::report()
+        int time; // msec since midnight
+        QString text;
+    };
+
+public:
+    LogView(QWidget *parent = 0);
+
+    void append(int level, const QString& text); // from any thread, never blocks
+    void clear();
+
+    void setFilter(int minLevel, const QString& text); // shows records of the level and above containing the text
+    bool hasSearchFocus() const; // keyboard goes to the search field
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void contextMenuEvent(QContextMenuEvent *event) override;
+
+private slots:
+    void _scheduleFlush();
+    void _flush();
+    void _searchChanged(const QString& text);
+    void _searchFinished();
+
+private:
+    struct Slot
+    {
+        std::atomic<qint64> stamp; // sequence number + 1 when the record is ready to be read
+        Record record;
+    };
+
+    struct Filter
+    {
+        int minLevel;
+        QString text;
+        std::deque<qint64> matches; // sequence numbers
+    };
+
+    void _add(const Record& record, int& removed);
+    bool _matches(const Record& record, const Filter& filter) const;
+    const Record& _record(qint64 seq) const {return _history[seq % HISTORY_SIZE];}
+    int _shownCount() const;
+    qint64 _shownSeq(int row) const;
+    QString _format(const Record& record) const;
+    void _updateScrollBars();
+
+private:
+    // lock free queue, any thread appends, the view drains it
+    std::vector<Slot> _queue;
+    std::atomic<qint64> _queueHead; // next to be written
+    std::atomic<qint64> _queueTail; // next to be read
+    std::atomic<bool> _flushScheduled;
+    std::atomic<int> _dropped; // queue was full
+
+    // history ring, sequence numbers of the records grow forever
+    std::vector<Record> _history;
+    qint64 _firstSeq; // oldest kept
+    qint64 _endSeq; // next to be added
+
+    // each filter narrows the one before it, going back to a wider filter does not search again
+    std::vector<Filter> _filters;
+    int _minLevel; // requested filter
+    QString _text;
+
+    QTimer* _timerFlush;
+    QLineEdit* _search;
+    int _longest; // characters of the longest shown line
+};
+
+#endif // GSHARPIE_LOGVIEW_H
@@ -0,0 +1,97 @@
+#include <QFile>
+#include "logwriter.h"
+
+
+LogWriter::LogWriter(const QString& fileName)
+{
+    _fileName = fileName;
+    _file.setFileName(_name(0));
+    _opened = _file.open(QFile::WriteOnly | QFile::Append);
+    if(!_opened)
+        _error = _file.errorString();
+    _dropped = 0;
+    _stop = false;
+    _thread = std::thread(&LogWriter::_run, this);
+}
+
+
+LogWriter::~LogWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _ready.notify_one();
+    _thread.join();
+}
+
+
+void LogWriter::write(const LogRecord& record)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_queue.size() >= MAX_QUEUED){
+            ++_dropped;
+            return;
+        }
+        _queue.push_back(record);
+    }
+    _ready.notify_one();
+}
+
+
+QString LogWriter::_name(int index) const
+{
+    return (index == 0)? _fileName + QStringLiteral(".log"):
+                         _fileName + QStringLiteral(".") + QString::number(index) + QStringLiteral(".log");
+}
+
+
+void LogWriter::_rotate()
+{
+    QFile::remove(_name(MAX_FILES-1));
+    for(int i = MAX_FILES-1; i > 0; --i)
+        QFile::rename(_name(i-1), _name(i));
+}
+
+
+//////  r u n  //////
+void LogWriter::_run()
+{
+    std::deque<LogRecord> records;
+    for(;;){
+        size_t dropped;
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.wait(lock, [this](){return _stop || !_queue.empty();});
+            records.swap(_queue); // formatted and written without the lock
+            dropped = _dropped;
+            _dropped = 0;
+            stop = _stop;
+        }
+
+        QByteArray lines;
+        if(dropped > 0){
+            LogRecord record(1, "log records dropped");
+            record.add("count", static_cast<qint64>(dropped));
+            lines += record.json() + '\n';
+        }
+        for(size_t i=0; i < records.size(); ++i)
+            lines += records[i].json() + '\n';
+        records.clear();
+
+        if(_file.isOpen() && !lines.isEmpty()){
+            if(_file.size() + lines.size() > MAX_FILE_SIZE){
+                _file.close();
+                _rotate();
+                _file.open(QFile::WriteOnly | QFile::Append);
+            }
+            _file.write(lines);
+            _file.flush();
+        }
+
+        if(stop)
+            break;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef GSHARPIE_LOGWRITER_H
+#define GSHARPIE_LOGWRITER_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <QString>
+#include <QFile>
+#include "logrecord.h"
+
+
+// writes records as JSON lines on its own thread, the file is rotated when it grows too big
+class LogWriter
+{
+public:
+    static const qint64 MAX_FILE_SIZE = 8*1024*1024; // bytes
+    static const int MAX_FILES = 3; // current one and the rotated ones (name.1.log, name.2.log)
+    static const size_t MAX_QUEUED = 65536; // records, newer ones are dropped if the disk is that slow
+
+public:
+    LogWriter(const QString& fileName); // without extension, the file is opened at once
+    ~LogWriter(); // writes what is queued
+
+    inline bool isOpen() const {return _opened;} // records are dropped otherwise
+    inline const QString& errorString() const {return _error;} // why it could not be opened
+
+    void write(const LogRecord& record); // never waits for the disk
+
+private:
+    void _run();
+    void _rotate();
+    QString _name(int index) const;
+
+private:
+    QString _fileName;
+    QFile _file; // used by the thread
+    bool _opened;
+    QString _error;
+    std::deque<LogRecord> _queue;
+    size_t _dropped;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::thread _thread;
+};
+
+#endif // GSHARPIE_LOGWRITER_H
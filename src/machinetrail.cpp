@@ -0,0 +1,33 @@
+#include "machinetrail.h"
+
+
+MachineTrail::MachineTrail() : _samples(CAPACITY)
+{
+    _first = _end = 0;
+    _clears = 0;
+}
+
+
+void MachineTrail::append(qint64 time, const float* pos)
+{
+    if(_end > _first){
+        const Sample& last = at(_end-1);
+        if(last.pos[0] == pos[0] && last.pos[1] == pos[1] && last.pos[2] == pos[2])
+            return;
+    }
+
+    Sample& sample = _samples[_end & (CAPACITY-1)];
+    sample.time = time;
+    for(int i=0; i<3; ++i)
+        sample.pos[i] = pos[i];
+    ++_end;
+    if(_end - _first > CAPACITY)
+        _first = _end - CAPACITY;
+}
+
+
+void MachineTrail::clear()
+{
+    _first = _end;
+    ++_clears;
+}
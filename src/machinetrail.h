@@ -0,0 +1,37 @@
+#ifndef GSHARPIE_MACHINETRAIL_H
+#define GSHARPIE_MACHINETRAIL_H
+#include <vector>
+#include <QtGlobal>
+
+
+// positions the machine has reported, in a ring of fixed size: the oldest ones are overwritten;
+// samples are numbered from the first one appended, readers keep the number they have got to
+class MachineTrail
+{
+public:
+    static const int CAPACITY = 1 << 18; // samples, 6 MB
+
+    struct Sample
+    {
+        qint64 time; // msec, GrblControl::getTime()
+        float pos[3]; // mm, work coordinates
+    };
+
+public:
+    MachineTrail();
+
+    void append(qint64 time, const float* pos); // skipped if the machine has not moved
+    void clear(); // samples numbered so far are gone
+
+    inline qint64 first() const {return _first;} // oldest sample kept
+    inline qint64 end() const {return _end;} // next one to be appended
+    inline const Sample& at(qint64 index) const {return _samples[index & (CAPACITY-1)];}
+    inline int clearCount() const {return _clears;}
+
+private:
+    std::vector<Sample> _samples;
+    qint64 _first, _end;
+    int _clears;
+};
+
+#endif // GSHARPIE_MACHINETRAIL_H
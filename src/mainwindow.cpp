@@ -1,37 +1,81 @@
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <QDebug>
 #include <QTime>
 #include <QFile>
+#include <QFileInfo>
 #include <QFileDialog>
+#include <QStandardPaths>
+#include <QDir>
 #include <QTextBlock>
 #include <QTextCursor>
 #include <QStyleOptionSlider>
+#include <QMessageBox>
+#include <QtConcurrent>
 #include "dlgserialport.h"
 #include "dlgconfig.h"
+#include "logwriter.h"
+#include "jogsession.h"
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
 int GSharpieReportLevel = 0; // global
 
 
+static QString formatDuration(double sec)
+{
+    int s = static_cast<int>(sec + 0.5);
+    return QString("%1:%2:%3").arg(s/3600).arg((s/60)%60, 2, 10, QChar('0')).arg(s%60, 2, 10, QChar('0'));
+}
+
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
     ui->text_errorLog->clear();
+    QString logFolder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if(logFolder.isEmpty())
+        logFolder = QDir::currentPath(); // no such folder on this system
+    QDir().mkpath(logFolder);
+    _logWriter = new LogWriter(logFolder + QStringLiteral("/GSharpie"));
 
     on_errorReport(0, QString("G-Sharpie started on ") + QDate::currentDate().toString());
+    if(!_logWriter->isOpen())
+        on_errorReport(2, QString("Log cannot be written in ") + QDir::toNativeSeparators(logFolder) + QString(": ") +
+                          _logWriter->errorString());
 //GSharpieReportLevel = -1;
 
     _grbl = new GrblControl();
     connect(_grbl, SIGNAL(report(int, QString)), this, SLOT(on_errorReport(int, QString)));
+    connect(_grbl, SIGNAL(logged(LogRecord)), this, SLOT(on_logRecord(LogRecord)));
     connect(_grbl, SIGNAL(commandComplete(GrblControl::Command)),
              this, SLOT(on_GrblResponse(GrblControl::Command)));
 
     _sequencer = new GCodeSequencer();
     _sequencer->setGrblControl(_grbl);
 
+    _validation = new QFutureWatcher<int>(this);
+    connect(_validation, SIGNAL(finished()), this, SLOT(_validationFinished()));
+    _timerValidation = new QTimer(this);
+    connect(_timerValidation, SIGNAL(timeout()), this, SLOT(_validationProgress()));
+
+    _estimation = new QFutureWatcher<GCodeEstimator::Result>(this);
+    connect(_estimation, SIGNAL(finished()), this, SLOT(_estimationFinished()));
+    connect(ui->view_toolpath, SIGNAL(selectionChanged()), this, SLOT(_toolpathSelected()));
+    ui->view_toolpath->setTrail(&_grbl->getTrail());
+    _probeRouting = new QFutureWatcher<std::vector<int>>(this);
+    connect(_probeRouting, SIGNAL(finished()), this, SLOT(_probesRouted()));
+    _travelPlanning = new QFutureWatcher<TravelPreview>(this);
+    connect(_travelPlanning, SIGNAL(finished()), this, SLOT(_travelPlanned()));
+    _cancelPlanning = false;
+    _probing = false;
+    _remainingTime = 0.0;
+    _timedStep = -1;
+    _sourceTime = 0.0;
+
     _timerGCode = new QTimer(this); // sequencer timer
     connect(_timerGCode, SIGNAL(timeout()), this, SLOT(_sendGCode()));
 
@@ -51,9 +95,27 @@ MainWindow::MainWindow(QWidget *parent) :
     _statusTimerPeriod = 1000 / _settings->value("refresh_rate", 5).toInt(); // careful with high refresh rates!
     _settings->endGroup();
 
+    _settings->beginGroup("Optimization");
+    _sequencer->enableArcFitting(_settings->value("arc_fitting", false).toBool(),
+                                 _settings->value("arc_fitting_tolerance", 0.0).toDouble());
+    _sequencer->enableDecimation(_settings->value("decimation", false).toBool(),
+                                 _settings->value("decimation_tolerance", 0.01).toDouble());
+    _sequencer->enableAirCutRemoval(_settings->value("air_cut_removal", false).toBool(),
+                                    _settings->value("air_cut_height", 1.0).toDouble());
+    _travelReversal = _settings->value("travel_reversal", true).toBool();
+    _settings->endGroup();
+
     _timerStatus = new QTimer(this); // status timer
     connect(_timerStatus, SIGNAL(timeout()), this, SLOT(_statusRequest()));
-    connect(_grbl, SIGNAL(statusUpdated()), this, SLOT(_updateStatus()));
+    connect(_grbl, SIGNAL(statusUpdated()), this, SLOT(_statusUpdated()));
+    _timerRender = new QTimer(this); // status is shown at most once per frame
+    _timerRender->setSingleShot(true);
+    connect(_timerRender, SIGNAL(timeout()), this, SLOT(_updateStatus()));
+    _lastRender.start();
+    _rendered.valid = false;
+    _timerDro = new QTimer(this); // position between the reports
+    connect(_timerDro, SIGNAL(timeout()), this, SLOT(_updateDro()));
+    _droStep = -1;
     _timerStatus->start(_statusTimerPeriod);
     _restartTimer = false;
 
@@ -72,8 +134,17 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {    
+    _cancelValidation();
+    _cancelTravelPlanning();
+    _estimation->waitForFinished(); // it reads the sequencer's program
+    _cancelRouting = true;
+    _probeRouting->waitForFinished();
+    ui->view_toolpath->releaseProgram();
+    _jogThread->quit(); // the jog controller is deleted with its thread
+    _jogThread->wait();
     delete _sequencer;
     delete _grbl;
+    delete _logWriter; // after everything that reports
     delete _settings;
     delete ui;
 }
@@ -92,7 +163,11 @@ bool MainWindow::_commandEditingMode() const
 //////  e v e n t  F i l t e r  //////
 bool MainWindow::eventFilter(QObject* obj, QEvent* event)
 {
+    if(event->type() == QEvent::WindowDeactivate && obj == this)
+        _releaseJogKeys(); // their release would not be seen
+
     if(_programEditingMode() || _commandEditingMode() ||
+        ui->text_errorLog->hasSearchFocus() ||
         qApp->focusWidget() == ui->spin_minX ||
         qApp->focusWidget() == ui->spin_maxX ||
         qApp->focusWidget() == ui->spin_minY ||
@@ -197,41 +272,44 @@ void MainWindow::on_btn_loadGCode_clicked()
                         QStringLiteral("G-sharp (*.ngs);;G-code (*.nc);;All files (*.*)"));
     if(name.isEmpty()) return;
 
-    QFile file(name);
-    if(!file.open(QFile::ReadOnly | QFile::Text)){
-        on_errorReport(1, QString("Cannot open file ") + name);
+    QString errorMsg;
+    if(!ui->edit_textGCode->openFile(name, &errorMsg)){
+        on_errorReport(1, QString("Cannot open file ") + name + QString(": ") + errorMsg);
         return;
     }
     on_errorReport(0, QString("Opened file ") + name);
 
-    QString program(file.readAll());
-    ui->edit_textGCode->setPlainText(program);
-
-    _loadSequencer(program);
+    _loadSequencer();
 }
 
 
 void MainWindow::on_btn_saveGCode_clicked()
 {
-    if(ui->edit_textGCode->document()->isEmpty()) return;
+    if(ui->edit_textGCode->isProgramEmpty()) return;
 
     QString name = QFileDialog::getSaveFileName(this, QStringLiteral("Save file"), ".",
                         QStringLiteral("G-sharp (*.ngs);;G-code (*.nc);;All files (*.*)"));
     if(name.isEmpty()) return;
 
-    QFile file(name);
-    if(!file.open(QIODevice::WriteOnly| QFile::Text)){
-        on_errorReport(1, QString("Cannot open file ") + name + " for writing");
+    QString errorMsg;
+    if(!ui->edit_textGCode->saveFile(name, &errorMsg)){
+        on_errorReport(1, QString("Cannot save file ") + name + QString(": ") + errorMsg);
         return;
     }
-
-    file.write(ui->edit_textGCode->document()->toPlainText().toLatin1());
+    on_errorReport(0, QString("Saved file ") + name);
 }
 
 
 void MainWindow::on_btn_editGCode_clicked()
 {
     if(ui->edit_textGCode->isReadOnly()){
+        if(!ui->edit_textGCode->isEditable()){
+            on_errorReport(1, QString("File is too large to be edited"));
+            return;
+        }
+        _cancelValidation(); // program is going to change
+        _cancelTravelPlanning();
+        ui->edit_textGCode->startEditing();
         ui->edit_textGCode->setReadOnly(false);
         ui->btn_runGCode->setEnabled(false);
         ui->btn_saveGCode->setEnabled(false);
@@ -251,14 +329,52 @@ void MainWindow::on_btn_editGCode_clicked()
 
         ui->edit_textGCode->setPalette(_paletteNoEdit);
 
-        _loadSequencer(ui->edit_textGCode->document()->toPlainText());
+        _updateSequencer();
     }
 }
 
 
 void MainWindow::on_btn_runGCode_clicked()
 {
-    on_errorReport(0, QString("Program started"));
+    if(_probing){
+        on_errorReport(1, QString("Surface is being probed"));
+        return;
+    }
+    if(_sequencer->compensationRefusal().lineNumber > 0){
+        on_errorReport(2, QString("Program cannot follow the surface, turn \"follow surface\" off to run it as it is"));
+        return;
+    }
+    if(_keyShiftPressed){ // resume from the line under cursor
+        int lineNum = ui->edit_textGCode->currentLine();
+        std::vector<std::string> preamble;
+        QString errorMsg;
+        _settings->beginGroup("Resuming");
+        const double safeZ = _settings->value("safe_z", -1.0).toDouble();
+        const double plungeFeed = _settings->value("plunge_feed", 100.0).toDouble();
+        _settings->endGroup();
+        if(!_sequencer->seekLine(lineNum, safeZ, plungeFeed, preamble, &errorMsg)){
+            on_errorReport(1, QString("Cannot resume: ") + errorMsg);
+            return;
+        }
+        if(!_checkBounds())
+            return;
+        for(size_t i=0; i < preamble.size(); ++i)
+            _grbl->issueCommand(preamble[i].c_str(), "Resume preamble");
+        on_errorReport(0, QString("Program resumed from line ") + QString::number(lineNum));
+    }
+    else{
+        if(!_checkBounds())
+            return;
+        on_errorReport(0, QString("Program started"));
+    }
+
+    _grbl->clearTrail(); // backplot of this run
+    _remainingTime = 0.0;
+    for(size_t i = _sequencer->currentStep(); i < _estimate.stepTime.size(); ++i)
+        _remainingTime += _estimate.stepTime[i];
+    _timedStep = _sequencer->currentStep(); // counts down as grbl executes the steps
+    ui->label_stateGCode->setText(formatDuration(_remainingTime));
+
     _timerGCode->start(5);
 }
 
@@ -283,6 +399,15 @@ void MainWindow::on_btn_settings_clicked()
             GSharpieReportLevel = dlgConfig.verbosityLevel();
         }
         ui->label_units->setText(_grbl->getConfiguration().imperial? "inches": "mm");
+        _rendered.valid = false;
+        _sequencer->enableArcFitting(dlgConfig.arcFitting(), dlgConfig.arcFitTolerance());
+        _sequencer->enableDecimation(dlgConfig.decimation(), dlgConfig.decimationTolerance());
+        _sequencer->enableAirCutRemoval(dlgConfig.airCutRemoval(), dlgConfig.airCutHeight());
+        _travelReversal = dlgConfig.travelReversal(); // for the next ordering
+        if(_sequencer->isReady() && !_timerGCode->isActive())
+            _optimizeProgram();
+        if(_sequencer->isReady())
+            _startEstimation(); // machine limits may have changed
     }
     qApp->installEventFilter(this);
 }
@@ -362,6 +487,7 @@ void MainWindow::on_btn_homing_clicked()
     _timerStatus->stop(); // status is not reported during homing
     _grbl->issueCommand("$H", "Homing");
     ui->label_status->setText("homing");
+    _rendered.valid = false; // shown again whatever state the next report brings
     _restartTimer = true;
 }
 
@@ -391,6 +517,9 @@ void MainWindow::on_combo_toolOffset_currentIndexChanged(const QString &arg1)
 
 void MainWindow::on_GrblResponse(GrblControl::Command cmd)
 {
+    _jogSession->completed(cmd);
+    _probeResponse(cmd);
+
     for(int i=0; i < cmd.response.size(); ++i)
         on_errorReport(0, cmd.name + QStringLiteral(": ") + cmd.response.at(i));
 
@@ -412,37 +541,385 @@ void MainWindow::on_errorReport(int level, const QString& msg)
     if(level < GSharpieReportLevel)
         return;
 
-    QString prefix = QTime::currentTime().toString("(H:mm:ss)");
-    if(level > 0)
-        prefix += QStringLiteral("Err: ");
-    else if(level == 0)
-        prefix += QStringLiteral("Msg: ");
-    else
-        prefix += QStringLiteral("Dbg: ");
+    ui->text_errorLog->append(level, msg); // shown with the next frame
+    _logWriter->write(LogRecord(level, "Message").add("text", msg));
+}
 
-    ui->text_errorLog->appendPlainText(prefix + msg);
+
+void MainWindow::on_logRecord(const LogRecord& record)
+{
+    // already checked against the reported level
+    ui->text_errorLog->append(record.level, record.message());
+    _logWriter->write(record);
 }
 
 
-void MainWindow::_loadSequencer(const QString& program)
+void MainWindow::_loadSequencer()
 {
+    _cancelValidation();
+    _cancelTravelPlanning();
+    ui->edit_textGCode->clearDirty(); // whole program is loaded
+    _estimation->waitForFinished(); // it reads the program which is about to change
+    ui->view_toolpath->clear();
+    _estimate.stepTime.clear();
+    _estimate.lineTime.clear();
+    _droStep = -1; // steps of the new program
+
+    QByteArray buffer;
+    size_t length;
+    const char* program = ui->edit_textGCode->programText(length, buffer);
     QString errorMsg;
-    int errorLine = _sequencer->loadProgram(program, &errorMsg);
+    int errorLine = _sequencer->loadProgram(program, length, &errorMsg);
     ui->edit_textGCode->enableHighlight(errorLine > 0);
     if(errorLine > 0){
-        QTextCursor cursor(ui->edit_textGCode->document()->findBlockByLineNumber(errorLine-1));
-        ui->edit_textGCode->setTextCursor(cursor);
+        ui->edit_textGCode->gotoLine(errorLine);
         on_errorReport(1, QString("Parsing g-code ") + errorMsg);
+        ui->label_stateGCode->clear();
     }
-    else
-        on_errorReport(0, QString("Program is ready to run"));
+    else{ // runtime errors (loops, expressions...) show up only when the program is executed
+        GCodeSequencer* sequencer = _sequencer;
+        QString* validationError = &_validationError; // read when the validation has finished
+        _validationError.clear();
+        _validation->setFuture(QtConcurrent::run([sequencer, validationError](){
+            return sequencer->expandProgram(validationError);
+        }));
+        _timerValidation->start(200);
+        ui->label_stateGCode->setText("checking");
+    }
+
+    ui->btn_saveGCode->setEnabled(!ui->edit_textGCode->isProgramEmpty());
+    ui->btn_runGCode->setEnabled(false);
+}
+
+
+void MainWindow::_cancelValidation()
+{
+    if(!_validation->isRunning())
+        return;
+    _sequencer->cancelExpansion();
+    _validation->waitForFinished();
+    _timerValidation->stop();
+}
+
 
-    ui->btn_saveGCode->setEnabled(!ui->edit_textGCode->document()->isEmpty());
-    ui->btn_runGCode->setEnabled(_grbl->isActive() && _sequencer->isReady());
+//////  v a l i d a t i o n  P r o g r e s s  //////
+void MainWindow::_validationProgress()
+{
+    const int lines = ui->edit_textGCode->lineCount();
+    const int percent = 100 * _sequencer->expansionProgress() / ((lines > 0)? lines: 1);
+    ui->label_stateGCode->setText(QString("checking ") + QString::number((percent < 99)? percent: 99) + QString("%"));
+}
+
+
+//////  u p d a t e  S e q u e n c e r  //////
+void MainWindow::_updateSequencer()
+{
+    GCodeEditor* editor = ui->edit_textGCode;
+    if(!editor->isDirty() && _sequencer->isReady()){ // nothing to load again
+        ui->btn_runGCode->setEnabled(_grbl->isActive() && _sequencer->compensationRefusal().lineNumber == 0);
+        ui->btn_saveGCode->setEnabled(!editor->isProgramEmpty());
+        ui->label_stateGCode->setText(ui->btn_runGCode->isEnabled()? "ready": "");
+        return;
+    }
+
+    _cancelTravelPlanning();
+    _estimation->waitForFinished(); // it reads the program which is about to change
+    ui->view_toolpath->releaseProgram();
+    _estimate.stepTime.clear();
+    _estimate.lineTime.clear();
+
+    QString fragment; // changed lines only, the rest of a long program is not copied on every edit
+    QTextBlock block = editor->document()->findBlockByNumber(editor->dirtyFirst());
+    for(int line = editor->dirtyFirst(); line <= editor->dirtyLast() && block.isValid(); ++line, block = block.next())
+        fragment += block.text() + QChar('\n');
+    QString errorMsg;
+    int errorLine = 0;
+    if(!_sequencer->updateProgram(fragment, editor->dirtyFirst()+1, editor->dirtyLast()+1, editor->dirtyDelta(),
+                                  errorLine, &errorMsg)){
+        _loadSequencer(); // parameters, expressions or O-words: interpret it all again
+        return;
+    }
+
+    editor->clearDirty();
+    ui->btn_saveGCode->setEnabled(!editor->isProgramEmpty());
+    if(errorLine > 0){
+        editor->enableHighlight(true);
+        editor->gotoLine(errorLine);
+        on_errorReport(1, QString("Parsing g-code ") + errorMsg);
+        ui->btn_runGCode->setEnabled(false);
+        ui->label_stateGCode->clear();
+        return;
+    }
+    _programValidated(0);
+}
+
+
+//////  v a l i d a t i o n  F i n i s h e d  //////
+void MainWindow::_validationFinished()
+{
+    _timerValidation->stop();
+    if(!_sequencer->isReady() && _validation->result() == 0)
+        return; // cancelled
+
+    _programValidated(_validation->result());
+}
+
+
+void MainWindow::_programValidated(int errorLine)
+{
+    const std::vector<GCodeSequencer::Issue>& issues = _sequencer->issues();
+    const size_t maxReported = 100;
+    for(size_t i=0; i < issues.size() && i < maxReported; ++i)
+        on_errorReport(1, QString("Line ") + QString::number(issues[i].lineNumber) + QString(": ") + issues[i].message);
+    if(issues.size() > maxReported)
+        on_errorReport(1, QString("... and ") + QString::number(issues.size() - maxReported) + QString(" more lines grbl would reject"));
+
+    if(errorLine == 0 && !issues.empty())
+        errorLine = issues.front().lineNumber;
+    ui->edit_textGCode->enableHighlight(errorLine > 0);
+    if(errorLine > 0){
+        ui->edit_textGCode->gotoLine(errorLine);
+        if(!_validationError.isEmpty())
+            on_errorReport(1, QString("Checking g-code ") + _validationError);
+    }
+    else{
+        _optimizeProgram();
+        if(_sequencer->compensationRefusal().lineNumber == 0)
+            on_errorReport(0, QString("Program is ready to run"));
+        _startEstimation();
+        ui->view_toolpath->setProgram(&_sequencer->program());
+    }
+
+    ui->btn_runGCode->setEnabled(_grbl->isActive() && _sequencer->isReady() && errorLine == 0 &&
+                                 _sequencer->compensationRefusal().lineNumber == 0);
     ui->label_stateGCode->setText(ui->btn_runGCode->isEnabled()? "ready": "");
 }
 
 
+//////  c h e c k  B o u n d s  //////
+bool MainWindow::_checkBounds()
+{
+    const GrblControl::Config& conf = _grbl->getConfiguration();
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
+    const double scale = conf.imperial? 25.4: 1.0; // reported positions and limits to mm
+
+    GCodeBounds bounds;
+    if(ui->check_obeyLimits->isChecked()){
+        const double low[3] = {ui->spin_minX->value()*scale, ui->spin_minY->value()*scale, ui->spin_minZ->value()*scale};
+        const double high[3] = {ui->spin_maxX->value()*scale, ui->spin_maxY->value()*scale, ui->spin_maxZ->value()*scale};
+        bounds.setWorkArea(low, high);
+    }
+    if(conf.homingEnable && conf.maxTravel[0] > 0.0 && conf.maxTravel[1] > 0.0 && conf.maxTravel[2] > 0.0){
+        // machine coordinates are meaningful after homing only
+        const QVector4D offset = status.pos.mpos - status.pos.wpos;
+        const double workOffset[3] = {offset.x()*scale, offset.y()*scale, offset.z()*scale};
+        bounds.setWorkOffset(workOffset);
+        bounds.setMachineTravel(conf.maxTravel);
+    }
+
+    const GCodeProgram& program = _sequencer->program();
+    const GCodeBounds::Result result = bounds.check(program, _sequencer->currentStep());
+    if(result.empty)
+        return true;
+
+    on_errorReport(0, QString("Program bounds X ") + QString::number(result.low[0]/scale) + QString("..") + QString::number(result.high[0]/scale) +
+                       QString(", Y ") + QString::number(result.low[1]/scale) + QString("..") + QString::number(result.high[1]/scale) +
+                       QString(", Z ") + QString::number(result.low[2]/scale) + QString("..") + QString::number(result.high[2]/scale));
+
+    const int step = (result.travelStep >= 0)? result.travelStep: result.limitStep;
+    if(step < 0)
+        return true;
+
+    const int lineNum = program.lineNumber(step);
+    ui->edit_textGCode->gotoLine(lineNum);
+    on_errorReport(2, QString("Line ") + QString::number(lineNum) +
+                      QString((result.travelStep >= 0)? " exceeds machine travel ($130-132)": " leaves the work area limits"));
+    return false;
+}
+
+
+//////  o p t i m i z e  P r o g r a m  //////
+void MainWindow::_optimizeProgram()
+{
+    _estimation->waitForFinished(); // it reads the program which is about to change
+    ui->view_toolpath->releaseProgram();
+    const bool filtered = _sequencer->applyFilters();
+
+    const GCodeSequencer::Issue& refusal = _sequencer->compensationRefusal();
+    if(refusal.lineNumber > 0){ // it does not run until the line is changed or the surface is not followed
+        ui->edit_textGCode->gotoLine(refusal.lineNumber);
+        on_errorReport(2, QString("Program cannot follow the surface, line ") + QString::number(refusal.lineNumber) +
+                          QString(": ") + refusal.message);
+        ui->btn_runGCode->setEnabled(false);
+        ui->label_stateGCode->clear();
+    }
+    if(!filtered)
+        return;
+
+    for(const GCodeFilter* filter: _sequencer->filters()){
+        const GCodeFilter::Statistics& stats = filter->statistics();
+        const bool removed = (stats.linesOut <= stats.linesIn); // some filters make more lines
+        on_errorReport(0, QString(filter->name()) + QString(removed? ": removed ": ": added ") +
+                          QString::number(::abs(stats.linesIn - stats.linesOut)) + QString(" lines, ") +
+                          QString::number(::llabs(static_cast<qint64>(stats.bytesIn) - static_cast<qint64>(stats.bytesOut))) +
+                          QString(" bytes"));
+        if(filter == &_sequencer->airCutRemover()){
+            const AirCutRemover& remover = _sequencer->airCutRemover();
+            on_errorReport(0, QString("Air cut removal: ") + QString::number(remover.moves()) + QString(" feed moves, ") +
+                              QString::number(remover.rapidLength(), 'f', 1) + QString(" mm at rapid instead of ") +
+                              formatDuration(remover.feedTime()) + QString(" at feed"));
+        }
+    }
+}
+
+
+//////  s t a r t  E s t i m a t i o n  //////
+void MainWindow::_startEstimation()
+{
+    _estimation->waitForFinished();
+
+    GCodeEstimator estimator(_grbl->getConfiguration());
+    const GCodeProgram* program = &_sequencer->program();
+    const GCodeProgram* source = &_sequencer->source();
+    double* sourceTime = &_sourceTime; // read when the estimation has finished
+    _estimation->setFuture(QtConcurrent::run([estimator, program, source, sourceTime](){
+        *sourceTime = (program != source)? estimator.estimate(*source).totalTime: 0.0;
+        return estimator.estimate(*program);
+    }));
+}
+
+
+//////  e s t i m a t i o n  F i n i s h e d  //////
+void MainWindow::_estimationFinished()
+{
+    _estimate = _estimation->result();
+    on_errorReport(0, QString("Estimated run time ") + formatDuration(_estimate.totalTime) +
+                      QString(", feed path ") + QString::number(_estimate.feedLength, 'f', 1) +
+                      QString(" mm, rapids ") + QString::number(_estimate.rapidLength, 'f', 1) + QString(" mm"));
+    if(_sourceTime > 0.0){
+        const double saved = _sourceTime - _estimate.totalTime;
+        on_errorReport(0, QString((saved >= 0.0)? "Optimization saves ": "Optimization adds ") + formatDuration(::fabs(saved)) +
+                          QString(", unoptimized run time ") + formatDuration(_sourceTime));
+    }
+}
+
+
+//////  o r d e r  T r a v e l  //////
+void MainWindow::on_btn_orderTravel_clicked()
+{
+    if(_travelPlanning->isRunning())
+        return;
+    if(!_sequencer->isReady() || _programEditingMode()){
+        on_errorReport(1, QString("Load a program to order its travel"));
+        return;
+    }
+    if(_timerGCode->isActive()){
+        on_errorReport(1, QString("Travel cannot be ordered while the program runs"));
+        return;
+    }
+    if(_sequencer->hasTravelPlan()){ // pressed again
+        _sequencer->clearTravelPlan();
+        _optimizeProgram();
+        on_errorReport(0, QString("Original travel order is restored"));
+        _startEstimation();
+        ui->view_toolpath->setProgram(&_sequencer->program());
+        return;
+    }
+
+    on_errorReport(0, QString("Ordering travel between the cut regions..."));
+    _cancelPlanning = false;
+    GCodeEstimator estimator(_grbl->getConfiguration());
+    const GCodeProgram* source = &_sequencer->source(); // the filters take it in this order
+    const GCodeSequencer::LaterFilters later = _sequencer->laterFilters(); // as the program is going to be sent
+    const bool reversal = _travelReversal;
+    const std::atomic<bool>* cancel = &_cancelPlanning;
+    _travelPlanning->setFuture(QtConcurrent::run([estimator, source, later, reversal, cancel](){
+        TravelPreview preview;
+        preview.plan = TravelOptimizer::plan(*source, reversal, cancel);
+        preview.time = preview.originalTime = preview.rapids = preview.originalRapids = 0.0;
+        if(preview.plan.order.empty())
+            return preview;
+
+        GCodeProgram reordered, filtered;
+        TravelOptimizer::apply(*source, preview.plan, reordered);
+        GCodeSequencer::LaterFilters filters = later;
+        const GCodeEstimator::Result original = filters.apply(*source, filtered)? estimator.estimate(filtered):
+                                                                                   estimator.estimate(*source);
+        const GCodeEstimator::Result result = filters.apply(reordered, filtered)? estimator.estimate(filtered):
+                                                                                  estimator.estimate(reordered);
+        preview.originalTime = original.totalTime;
+        preview.originalRapids = original.rapidLength;
+        preview.time = result.totalTime;
+        preview.rapids = result.rapidLength;
+        return preview;
+    }));
+}
+
+
+void MainWindow::_cancelTravelPlanning()
+{
+    if(!_travelPlanning->isRunning())
+        return;
+    _cancelPlanning = true;
+    _travelPlanning->waitForFinished();
+}
+
+
+//////  t r a v e l  P l a n n e d  //////
+void MainWindow::_travelPlanned()
+{
+    if(_cancelPlanning)
+        return; // the program has changed
+    const TravelPreview preview = _travelPlanning->result();
+    if(preview.plan.order.empty()){
+        on_errorReport(0, QString("Travel order cannot be improved"));
+        return;
+    }
+
+    const QString summary = QString::number(preview.plan.regions) + QString(" regions, ") +
+                            QString::number(preview.plan.reversed) + QString(" cut backwards\n") +
+                            QString("Rapids ") + QString::number(preview.originalRapids, 'f', 1) + QString(" mm -> ") +
+                            QString::number(preview.rapids, 'f', 1) + QString(" mm\n") +
+                            QString("Run time ") + formatDuration(preview.originalTime) + QString(" -> ") +
+                            formatDuration(preview.time);
+    on_errorReport(0, QString("Travel ordering: ") + QString(summary).replace('\n', ", "));
+    if(QMessageBox::question(this, QString("Order travel"), summary + QString("\n\nApply the new order?")) != QMessageBox::Yes)
+        return;
+    if(_timerGCode->isActive() || !_sequencer->isReady()){
+        on_errorReport(1, QString("Travel order is not applied, the program has started or changed"));
+        return;
+    }
+
+    _sequencer->setTravelPlan(preview.plan);
+    _optimizeProgram();
+    _startEstimation();
+    ui->view_toolpath->setProgram(&_sequencer->program());
+}
+
+
+//////  t o o l p a t h  S e l e c t e d  //////
+void MainWindow::_toolpathSelected()
+{
+    const std::vector<std::pair<int, int>>& ranges = ui->view_toolpath->selectedLines();
+    ui->edit_textGCode->setSelectedLines(ranges);
+
+    // estimated time of the picked lines, once the program has been estimated
+    const std::vector<float>& lineTime = _estimate.lineTime;
+    if(ranges.empty() || lineTime.empty())
+        return;
+    double time = 0.0;
+    int lines = 0;
+    for(const std::pair<int, int>& range: ranges){
+        for(int line = range.first; line <= range.second && line < static_cast<int>(lineTime.size()); ++line){
+            time += lineTime[line];
+            ++lines;
+        }
+    }
+    on_errorReport(0, QString::number(lines) + QString((lines == 1)? " line": " lines") + QString(" selected, estimated ") +
+                      formatDuration(time) + QString(" of ") + formatDuration(_estimate.totalTime));
+}
+
+
 //////  s t a t u s  R e q u e s t  //////
 void MainWindow::_statusRequest()
 {
@@ -451,54 +928,159 @@ void MainWindow::_statusRequest()
 }
 
 
+//////  s t a t u s  U p d a t e d  //////
+void MainWindow::_statusUpdated()
+{
+    // every report feeds the dead reckoning, it is shown between the reports
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
+    const bool moving = (status.state == GrblControl::Run || status.state == GrblControl::Jog);
+    const double wpos[3] = {status.pos.wpos.x(), status.pos.wpos.y(), status.pos.wpos.z()};
+    _dro.report(wpos, status.time, status.feedrate, moving);
+    if(_jogSession->reported(status.time, status.state))
+        on_errorReport(-1, _jogSession->latency().report()); // a jog has stopped
+
+    const int step = _sequencer->executedStep(status.line);
+    if(step != _droStep){
+        _droStep = step;
+        const GCodeProgram& program = _sequencer->program();
+        if(step >= 0 && step < program.size()){
+            GCodeState state = program.stateAt(step);
+            GCodeMove move;
+            state.update(program.codePtr(step), &move);
+            _dro.setSegment(&move, _grbl->getConfiguration().imperial? 1.0/25.4: 1.0);
+        }
+        else
+            _dro.setSegment(nullptr, 1.0); // follows the direction of the last reports
+    }
+    if(moving && !_timerDro->isActive())
+        _timerDro->start(FRAME_PERIOD);
+
+    // reports coming faster than the display refresh are rendered together
+    if(_timerRender->isActive())
+        return;
+    const qint64 elapsed = _lastRender.elapsed();
+    if(elapsed >= FRAME_PERIOD)
+        _updateStatus();
+    else
+        _timerRender->start(static_cast<int>(FRAME_PERIOD - elapsed));
+}
+
+
 /////  u p d a t e  S t a t u s  //////
 void MainWindow::_updateStatus()
 {
-    GrblControl::Status status = _grbl->getCurrentStatus();
+    _lastRender.restart();
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
     const GrblControl::MACHINE_STATE& state = status.state;
 
-    ui->label_status->setText(state==GrblControl::Jog?   QStringLiteral("jogging"):
-                              state==GrblControl::Run?   QStringLiteral("running"):
-                              state==GrblControl::Home?  QStringLiteral("homing"):
-                              state==GrblControl::Check? QStringLiteral("simulation"):
-                              state==GrblControl::Idle?  QStringLiteral("idle"):
-                              state==GrblControl::Alarm? QStringLiteral("alarm lock"):
-                              state==GrblControl::Hold?  QStringLiteral("holding"):
-                              state==GrblControl::Door?  QStringLiteral("door open"):
-                              state==GrblControl::Sleep? QStringLiteral("dormant"):
-                                                                         QStringLiteral("disconnected"));
+    // only widgets showing something different are touched
+    RenderedStatus shown = _rendered;
+    shown.state = state;
+    shown.opened = _grbl->isOpened();
+    shown.active = _grbl->isActive();
+    shown.imperial = _grbl->getConfiguration().imperial;
+
+    const bool all = !_rendered.valid;
+    if(!_timerDro->isActive()){ // otherwise the dead reckoning timer shows the position
+        const double wpos[3] = {status.pos.wpos.x(), status.pos.wpos.y(), status.pos.wpos.z()};
+        const double mpos[3] = {status.pos.mpos.x(), status.pos.mpos.y(), status.pos.mpos.z()};
+        _showPosition(wpos, mpos, all);
+    }
 
-    ui->label_WPosX->setText(QString::number(status.pos.wpos.x(), 'f', 3));
-    ui->label_WPosY->setText(QString::number(status.pos.wpos.y(), 'f', 3));
-    ui->label_WPosZ->setText(QString::number(status.pos.wpos.z(), 'f', 3));
+    // source line of the block being executed, grbl reports the step number it was sent with
+    int executingLine = 0;
+    const int step = _sequencer->executedStep(status.line);
+    if(step >= 0 && step < _sequencer->program().size())
+        executingLine = _sequencer->program().lineNumber(step);
+    ui->edit_textGCode->setExecutingLine(executingLine); // repaints only when it has changed
+    if(_timedStep >= 0 && step > _timedStep){ // the steps before the executing one are done
+        for(; _timedStep < step && _timedStep < static_cast<int>(_estimate.stepTime.size()); ++_timedStep)
+            _remainingTime -= _estimate.stepTime[_timedStep];
+        _timedStep = step;
+        ui->label_stateGCode->setText(formatDuration(_remainingTime));
+    }
+    ui->view_toolpath->updateTrail(); // new segments only
+
+    if(all || shown.state != _rendered.state){
+        ui->label_status->setText(state==GrblControl::Jog?   QStringLiteral("jogging"):
+                                  state==GrblControl::Run?   QStringLiteral("running"):
+                                  state==GrblControl::Home?  QStringLiteral("homing"):
+                                  state==GrblControl::Check? QStringLiteral("simulation"):
+                                  state==GrblControl::Idle?  QStringLiteral("idle"):
+                                  state==GrblControl::Alarm? QStringLiteral("alarm lock"):
+                                  state==GrblControl::Hold?  QStringLiteral("holding"):
+                                  state==GrblControl::Door?  QStringLiteral("door open"):
+                                  state==GrblControl::Sleep? QStringLiteral("dormant"):
+                                                                             QStringLiteral("disconnected"));
+
+        ui->btn_unlock->setEnabled(state==GrblControl::Alarm);
+
+        // --- simulation mode has to be thoroughly tested ---
+        //    ui->btn_simulation->setEnabled(state==GrblControl::Idle || state==GrblControl::Check);
+        //    ui->btn_simulation->setText(state==GrblControl::Check? QStringLiteral("Operation"):
+        //                                                           QStringLiteral("Simulation"));
+
+        ui->btn_jogLeft->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // X
+        ui->btn_jogRight->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
+        ui->btn_jogForward->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // Y
+        ui->btn_jogBackward->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
+        ui->btn_jogUp->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // Z
+        ui->btn_jogDown->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
+
+        ui->btn_homing->setEnabled(state==GrblControl::Idle || state==GrblControl::Alarm);
+        ui->btn_setXOrigin->setEnabled(state==GrblControl::Idle);
+        ui->btn_setYOrigin->setEnabled(state==GrblControl::Idle);
+        ui->btn_setZOrigin->setEnabled(state==GrblControl::Idle);
+        ui->btn_setXYZOrigin->setEnabled(state==GrblControl::Idle);
+    }
 
-    ui->label_MPosX->setText(QString::number(status.pos.mpos.x(), 'f', 3));
-    ui->label_MPosY->setText(QString::number(status.pos.mpos.y(), 'f', 3));
-    ui->label_MPosZ->setText(QString::number(status.pos.mpos.z(), 'f', 3));
+    if(all || shown.opened != _rendered.opened)
+        ui->btn_reset->setEnabled(shown.opened);
+    if(all || shown.active != _rendered.active)
+        ui->btn_settings->setEnabled(shown.active);
+    if(all || shown.imperial != _rendered.imperial)
+        ui->label_units->setText(shown.imperial? "inches": "mm");
+
+    shown.valid = true;
+    for(int i=0; i < 6; ++i)
+        shown.pos[i] = _rendered.pos[i]; // already shown
+    _rendered = shown;
+}
 
-    ui->btn_unlock->setEnabled(state==GrblControl::Alarm);
-    ui->btn_reset->setEnabled(_grbl->isOpened());
-    ui->btn_settings->setEnabled(_grbl->isActive());
 
-    // --- simulation mode has to be thoroughly tested ---
-    //    ui->btn_simulation->setEnabled(state==GrblControl::Idle || state==GrblControl::Check);
-    //    ui->btn_simulation->setText(state==GrblControl::Check? QStringLiteral("Operation"):
-    //                                                           QStringLiteral("Simulation"));
+void MainWindow::_showPosition(const double wpos[3], const double mpos[3], bool all)
+{
+    QLabel* labels[6] = {ui->label_WPosX, ui->label_WPosY, ui->label_WPosZ,
+                         ui->label_MPosX, ui->label_MPosY, ui->label_MPosZ};
+    for(int i=0; i < 6; ++i){
+        const double value = (i < 3)? wpos[i]: mpos[i-3];
+        const qint64 shown = qRound64(value * 1000.0); // as displayed, 3 decimals
+        if(all || shown != _rendered.pos[i]){
+            labels[i]->setText(QString::number(value, 'f', 3));
+            _rendered.pos[i] = shown;
+        }
+    }
+}
 
-    ui->btn_jogLeft->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // X
-    ui->btn_jogRight->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
-    ui->btn_jogForward->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // Y
-    ui->btn_jogBackward->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
-    ui->btn_jogUp->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog); // Z
-    ui->btn_jogDown->setEnabled(state==GrblControl::Idle || state==GrblControl::Jog);
 
-    ui->btn_homing->setEnabled(state==GrblControl::Idle || state==GrblControl::Alarm);
-    ui->btn_setXOrigin->setEnabled(state==GrblControl::Idle);
-    ui->btn_setYOrigin->setEnabled(state==GrblControl::Idle);
-    ui->btn_setZOrigin->setEnabled(state==GrblControl::Idle);
-    ui->btn_setXYZOrigin->setEnabled(state==GrblControl::Idle);
+//////  u p d a t e  D R O  //////
+void MainWindow::_updateDro()
+{
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
+    if(status.state != GrblControl::Run && status.state != GrblControl::Jog){
+        _timerDro->stop();
+        const double wpos[3] = {status.pos.wpos.x(), status.pos.wpos.y(), status.pos.wpos.z()};
+        const double mpos[3] = {status.pos.mpos.x(), status.pos.mpos.y(), status.pos.mpos.z()};
+        _showPosition(wpos, mpos, false); // where it has stopped
+        return;
+    }
 
-    ui->label_units->setText(_grbl->getConfiguration().imperial? "inches": "mm");
+    double wpos[3], mpos[3];
+    _dro.estimate(_grbl->getTime(), wpos);
+    const QVector4D offset = status.pos.mpos - status.pos.wpos;
+    for(int i=0; i < 3; ++i)
+        mpos[i] = wpos[i] + offset[i];
+    _showPosition(wpos, mpos, false);
 }
 
 
@@ -518,12 +1100,14 @@ void MainWindow::_sendGCode()
     std::string gcode;
     QString errorMsg;
     if(!_sequencer->nextLine(lineNum, gcode, &errorMsg)){
-        if(errorMsg.isEmpty())
+        _timedStep = -1; // the steps are not followed once the program is rewound
+        if(errorMsg.isEmpty()){
             on_errorReport(0, QString("Program finished"));
+            ui->label_stateGCode->setText(ui->btn_runGCode->isEnabled()? "ready": "");
+        }
         else{
             ui->edit_textGCode->enableHighlight(true);
-            QTextCursor cursor(ui->edit_textGCode->document()->findBlockByLineNumber(lineNum-1));
-            ui->edit_textGCode->setTextCursor(cursor);
+            ui->edit_textGCode->gotoLine(lineNum);
             on_errorReport(1, QString("Running g-code ") + errorMsg);
         }
         _timerGCode->stop();
@@ -565,6 +1149,7 @@ void MainWindow::_initMainControls()
     ui->btn_setYOrigin->setEnabled(false);
     ui->btn_setZOrigin->setEnabled(false);
     ui->btn_setXYZOrigin->setEnabled(false);
+    _rendered.valid = false; // the next status enables them again, even if the state has not changed
 }
 
 
@@ -1,12 +1,26 @@
 #ifndef GSHARPIE_MAINWINDOW_H
 #define GSHARPIE_MAINWINDOW_H
 
+#include <atomic>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QMainWindow>
 #include <QSettings>
+#include <QFutureWatcher>
+#include <QHash>
 
 #include "grblcontrol.h"
 #include "gcodesequencer.h"
+#include "gcodeestimator.h"
+#include "gcodebounds.h"
+#include "positionestimator.h"
+#include "heightmap.h"
+#include "probeplanner.h"
+
+class LogWriter;
+class JogController;
+class JogSession;
+class QThread;
 
 
 struct CncConfig
@@ -33,10 +47,23 @@ private slots:
 
     void on_GrblResponse(GrblControl::Command cmd);
     void on_errorReport(int level, const QString& msg);
+    void on_logRecord(const LogRecord& record);
 
     void _statusRequest();
+    void _statusUpdated();
     void _updateStatus();
+    void _updateDro();
     void _sendGCode();
+    void _estimationFinished();
+    void _validationFinished();
+    void _validationProgress();
+    void _toolpathSelected();
+    void _probesRouted();
+    void _travelPlanned();
+
+    void on_btn_probeSurface_clicked();
+    void on_check_heightMap_toggled(bool checked);
+    void on_btn_orderTravel_clicked();
 
     void on_dial_jogFeed_valueChanged(int value);
 
@@ -100,7 +127,15 @@ private slots:
     void on_spin_minZ_valueChanged(double arg1);
 
 private:
-    void _loadSequencer(const QString& program);
+    void _loadSequencer();
+    void _updateSequencer(); // after editing
+    void _programValidated(int errorLine);
+    void _cancelValidation();
+    void _optimizeProgram();
+    bool _checkBounds(); // of the rest of the program
+    void _showPosition(const double wpos[3], const double mpos[3], bool all);
+    void _startEstimation();
+    void _cancelTravelPlanning(); // before the program changes
 
     bool _programEditingMode() const;
     bool _commandEditingMode() const;
@@ -108,8 +143,13 @@ private:
     void _initMainControls();
 
     void _initJoggingControls();
-    void _prepareJogCommand(char axis, double limit);
-    void _cancelJogging();
+    void _pressJog(int axis, int sign, bool pressed);
+    void _releaseJogKeys();
+
+    void _planProbes(); // next batch of points, ordered in background
+    void _probeResponse(const GrblControl::Command& cmd);
+    void _abortProbing(const QString& reason);
+    void _applyHeightMap(); // filters the program again
     void _setJogRate(int value);
     int _pos2Rate(int pos);
 
@@ -120,6 +160,28 @@ private:
     QTimer *_timerGCode;  // send next gcode command every ...
     GrblControl* _grbl;
     GCodeSequencer* _sequencer;
+    LogWriter* _logWriter; // GSharpie.log in the application data folder
+
+    QFutureWatcher<int>* _validation; // interprets the whole program in background, returns error line
+    QString _validationError;
+    QTimer* _timerValidation; // shows its progress
+
+    QFutureWatcher<GCodeEstimator::Result>* _estimation; // runs in background
+    GCodeEstimator::Result _estimate;
+    double _sourceTime; // sec, of the program as interpreted, 0 if it is sent unchanged
+    double _remainingTime; // sec, of the running program
+    int _timedStep; // first step of the running program not taken off _remainingTime, -1 if none runs
+
+    // travel ordering, shown to be accepted before it is applied
+    struct TravelPreview
+    {
+        TravelOptimizer::Plan plan;
+        double time, originalTime; // sec, of the program through the other filters, as it is going to be sent
+        double rapids, originalRapids; // mm
+    };
+    QFutureWatcher<TravelPreview>* _travelPlanning; // runs in background
+    std::atomic<bool> _cancelPlanning;
+    bool _travelReversal; // regions may be cut backwards
 
     QSettings* _settings;
     QPalette _paletteNoEdit;
@@ -127,6 +189,25 @@ private:
     int _statusTimerPeriod; // ms, related to frequency of status updates
     bool _restartTimer;
 
+    // status as it is shown, widgets are updated only when it changes
+    struct RenderedStatus
+    {
+        GrblControl::MACHINE_STATE state;
+        qint64 pos[6]; // work and machine XYZ, in displayed units
+        bool opened;
+        bool active;
+        bool imperial;
+        bool valid; // shown at all
+    };
+    static const int FRAME_PERIOD = 16; // ms
+    QTimer* _timerRender;
+    QElapsedTimer _lastRender;
+    RenderedStatus _rendered;
+
+    PositionEstimator _dro; // dead reckoning between the reports
+    QTimer* _timerDro; // runs while moving, every frame
+    int _droStep; // segment the estimation follows
+
     // keyboard control
     bool _keyShiftPressed;
     bool _keyCtrlPressed;
@@ -134,8 +215,20 @@ private:
     bool _keyMetaPressed; // "windows" key
 
     int _jogRate;
-    bool _isJogging; // faster than reading status from grbl
-    char _jogCommand[32];
+    JogController* _jog; // streams short jog moves from its thread
+    QThread* _jogThread;
+    JogSession* _jogSession; // keys held to jog moves, measures the latency
+
+    HeightMap _heightMap; // of the surface, Z compensation of the program
+    QHash<quint64, int> _probeIds; // G38.2 command id -> grid point, while probing
+    ProbePlanner _probePlanner; // chooses the points, batch by batch
+    QFutureWatcher<std::vector<int>>* _probeRouting; // orders a batch for the shortest travel
+    std::atomic<bool> _cancelRouting;
+    bool _probing; // from the first batch until the map is complete or probing stops
+    int _probeCount; // points probed
+    double _probeTravel; // mm, between them
+    double _probeAt[2]; // mm, work XY where the last batch ends
+    double _probeClearance, _probeDepth, _probeFeed; // mm and mm/min, of this probing
 };
 
 #endif // GSHARPIE_MAINWINDOW_H
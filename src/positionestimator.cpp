@@ -0,0 +1,107 @@
+#include <cmath>
+#include <algorithm>
+#include "positionestimator.h"
+
+
+void PositionEstimator::reset()
+{
+    for(int i=0; i < 3; ++i)
+        _pos[i] = _prevPos[i] = 0.0;
+    _time = _prevTime = 0;
+    _feed = 0.0;
+    _moving = false;
+    _hasPrev = false;
+    _hasSegment = false;
+}
+
+
+void PositionEstimator::report(const double pos[3], int64_t time, double feed, bool moving)
+{
+    for(int i=0; i < 3; ++i){
+        _prevPos[i] = _pos[i];
+        _pos[i] = pos[i];
+    }
+    _prevTime = _time;
+    _hasPrev = _moving && moving; // both reports taken while moving
+    _time = time;
+    _feed = feed;
+    _moving = moving;
+}
+
+
+void PositionEstimator::setSegment(const GCodeMove* move, double scale)
+{
+    _hasSegment = (move && move->type != GCodeMove::None && move->type != GCodeMove::Dwell && !move->machine);
+    if(!_hasSegment)
+        return;
+
+    _segment = *move;
+    for(int i=0; i < 3; ++i){
+        _segment.from[i] *= scale;
+        _segment.to[i] *= scale;
+        _segment.center[i] *= scale;
+    }
+}
+
+
+//////  e s t i m a t e  //////
+void PositionEstimator::estimate(int64_t time, double pos[3]) const
+{
+    for(int i=0; i < 3; ++i)
+        pos[i] = _pos[i];
+    if(!_moving || time <= _time || _feed <= 0.0)
+        return;
+
+    double distance = _feed * (time - _time) / 60000.0;
+
+    if(_hasSegment && _segment.isArc()){
+        int a0, a1, lin;
+        _segment.planeAxes(a0, a1, lin);
+        const double* c = _segment.center;
+        const double rx = _pos[a0] - c[a0], ry = _pos[a1] - c[a1];
+        const double ex = _segment.to[a0] - c[a0], ey = _segment.to[a1] - c[a1];
+        const double radius = ::hypot(rx, ry);
+        if(radius < 1e-9)
+            return;
+
+        // angle left to the end of the arc, in the arc direction
+        const double total = _segment.angularTravel();
+        double left = ::atan2(rx*ey - ry*ex, rx*ex + ry*ey);
+        if(total < 0.0 && left > 0.0)
+            left -= 2*M_PI;
+        else if(total > 0.0 && left < 0.0)
+            left += 2*M_PI;
+        if(::fabs(left) > ::fabs(total) + 1e-6)
+            return; // already past the end
+
+        const double turn = (left < 0.0)? -std::min(distance/radius, -left): std::min(distance/radius, left);
+        const double sn = ::sin(turn), cs = ::cos(turn);
+        pos[a0] = c[a0] + rx*cs - ry*sn;
+        pos[a1] = c[a1] + rx*sn + ry*cs;
+        if(::fabs(left) > 1e-9) // helix
+            pos[lin] = _pos[lin] + (_segment.to[lin] - _pos[lin]) * turn/left;
+        return;
+    }
+
+    double dir[3];
+    double length;
+    if(_hasSegment){ // straight to the end of the segment
+        for(int i=0; i < 3; ++i)
+            dir[i] = _segment.to[i] - _pos[i];
+        length = ::sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+    }
+    else if(_hasPrev && _time > _prevTime){ // as it moved since the previous report, not further than then
+        for(int i=0; i < 3; ++i)
+            dir[i] = _pos[i] - _prevPos[i];
+        length = ::sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+        distance = std::min(distance, length);
+    }
+    else
+        return;
+
+    if(length < 1e-9)
+        return;
+    distance = std::min(distance, _hasSegment? length: distance);
+    for(int i=0; i < 3; ++i)
+        pos[i] += dir[i] / length * distance;
+}
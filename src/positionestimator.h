@@ -0,0 +1,39 @@
+#ifndef GSHARPIE_POSITIONESTIMATOR_H
+#define GSHARPIE_POSITIONESTIMATOR_H
+#include <cstdint>
+#include "gcodestate.h"
+
+
+// dead reckoning of the tool position between status reports:
+// advances at the reported feed along the executed segment and stops at its end
+class PositionEstimator
+{
+public:
+    PositionEstimator() {reset();}
+
+    void reset();
+
+    // reported work position (report units), its time (msec), feed (units/min) and whether it is moving
+    void report(const double pos[3], int64_t time, double feed, bool moving);
+
+    // geometry of the block being executed, scaled from mm to report units; nullptr if it is not known
+    void setSegment(const GCodeMove* move, double scale);
+
+    void estimate(int64_t time, double pos[3]) const;
+
+private:
+    double _pos[3];
+    int64_t _time;
+    double _feed;
+    bool _moving;
+
+    // previous report, the direction of travel without a segment
+    double _prevPos[3];
+    int64_t _prevTime;
+    bool _hasPrev;
+
+    GCodeMove _segment;
+    bool _hasSegment;
+};
+
+#endif // GSHARPIE_POSITIONESTIMATOR_H
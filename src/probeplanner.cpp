@@ -0,0 +1,333 @@
+#include <cmath>
+#include <algorithm>
+#include "probeplanner.h"
+
+using namespace std;
+
+
+void ProbePlanner::start(HeightMap* map, double threshold)
+{
+    _map = map;
+    _threshold = threshold;
+    _started = false;
+    _cells.clear();
+    _flat.clear();
+    _queued.assign(map->count(), false);
+}
+
+
+// every step-th index and the last one
+static vector<int> coarseIndices(int count, int step)
+{
+    vector<int> indices;
+    for(int i=0; i < count; i += step)
+        indices.push_back(i);
+    if(indices.back() != count-1)
+        indices.push_back(count-1);
+    return indices;
+}
+
+
+//////  n e x t  B a t c h  //////
+vector<int> ProbePlanner::nextBatch()
+{
+    vector<int> points;
+    if(!_started){
+        _started = true;
+        if(_threshold <= 0.0){ // every point, in one batch
+            for(int index=0; index < _map->count(); ++index)
+                points.push_back(index);
+            _queued.assign(_map->count(), true);
+            return points;
+        }
+
+        const vector<int> columns = coarseIndices(_map->columns(), COARSE_STEP);
+        const vector<int> rows = coarseIndices(_map->rows(), COARSE_STEP);
+        for(size_t j=0; j < rows.size(); ++j){
+            for(size_t i=0; i < columns.size(); ++i){
+                _queue(columns[i], rows[j], points);
+                if((i+1 < columns.size() || columns.size() == 1) && (j+1 < rows.size() || rows.size() == 1)){
+                    const Cell cell = {columns[i], rows[j], columns[min(i+1, columns.size()-1)], rows[min(j+1, rows.size()-1)]};
+                    _cells.push_back(cell);
+                }
+            }
+        }
+        return points;
+    }
+
+    // the corners of the waiting cells have been probed
+    vector<Cell> cells;
+    cells.swap(_cells);
+    for(const Cell& cell: cells){
+        if(cell.column1 - cell.column0 <= 1 && cell.row1 - cell.row0 <= 1)
+            continue; // every point is a corner
+
+        if(_bend(cell) > _threshold)
+            _split(cell, points);
+        else
+            _flat.push_back(cell);
+    }
+    if(!points.empty())
+        return points;
+
+    // probed points on the edges of the flat cells take precedence
+    for(const Cell& cell: _flat)
+        _fill(cell);
+    _flat.clear();
+    return points;
+}
+
+
+//////  b e n d  //////
+double ProbePlanner::_bend(const Cell& cell) const
+{
+    // a tilted plane is interpolated exactly, its corners are tested against the straight lines
+    // through their probed neighbours one cell size away (second differences) and against each other (twist)
+    const int columns = _map->columns(), rows = _map->rows();
+    const int width = cell.column1 - cell.column0, height = cell.row1 - cell.row0;
+    const double z00 = _map->at(cell.row0*columns + cell.column0), z10 = _map->at(cell.row0*columns + cell.column1);
+    const double z01 = _map->at(cell.row1*columns + cell.column0), z11 = _map->at(cell.row1*columns + cell.column1);
+    double bend = ::fabs(z00 - z10 - z01 + z11);
+
+    const int corners[4][2] = {{cell.column0, cell.row0}, {cell.column1, cell.row0},
+                               {cell.column0, cell.row1}, {cell.column1, cell.row1}};
+    for(int k=0; k<4; ++k){
+        const int column = corners[k][0], row = corners[k][1];
+        const double z = _map->at(row*columns + column);
+        if(width > 0 && column - width >= 0 && column + width < columns &&
+           _queued[row*columns + column - width] && _queued[row*columns + column + width])
+            bend = max(bend, ::fabs(_map->at(row*columns + column - width) - 2.0*z + _map->at(row*columns + column + width)));
+        if(height > 0 && row - height >= 0 && row + height < rows &&
+           _queued[(row - height)*columns + column] && _queued[(row + height)*columns + column])
+            bend = max(bend, ::fabs(_map->at((row - height)*columns + column) - 2.0*z + _map->at((row + height)*columns + column)));
+    }
+    return bend;
+}
+
+
+void ProbePlanner::_split(const Cell& cell, vector<int>& points)
+{
+    int columns[3] = {cell.column0, cell.column1, cell.column1};
+    int rows[3] = {cell.row0, cell.row1, cell.row1};
+    int columnRanges = 1, rowRanges = 1;
+    if(cell.column1 - cell.column0 > 1){
+        columns[1] = (cell.column0 + cell.column1) / 2;
+        columnRanges = 2;
+    }
+    if(cell.row1 - cell.row0 > 1){
+        rows[1] = (cell.row0 + cell.row1) / 2;
+        rowRanges = 2;
+    }
+
+    for(int j=0; j < rowRanges; ++j){
+        for(int i=0; i < columnRanges; ++i){
+            const Cell half = {columns[i], rows[j], columns[i+1], rows[j+1]};
+            _queue(half.column0, half.row0, points);
+            _queue(half.column1, half.row0, points);
+            _queue(half.column0, half.row1, points);
+            _queue(half.column1, half.row1, points);
+            _cells.push_back(half);
+        }
+    }
+}
+
+
+void ProbePlanner::_queue(int column, int row, vector<int>& points)
+{
+    const int index = row*_map->columns() + column;
+    if(!_queued[index]){
+        _queued[index] = true;
+        points.push_back(index);
+    }
+}
+
+
+void ProbePlanner::_fill(const Cell& cell)
+{
+    const int columns = _map->columns();
+    const double z00 = _map->at(cell.row0*columns + cell.column0), z10 = _map->at(cell.row0*columns + cell.column1);
+    const double z01 = _map->at(cell.row1*columns + cell.column0), z11 = _map->at(cell.row1*columns + cell.column1);
+    const int width = max(cell.column1 - cell.column0, 1), height = max(cell.row1 - cell.row0, 1);
+
+    for(int row = cell.row0; row <= cell.row1; ++row){
+        const double ty = static_cast<double>(row - cell.row0) / height;
+        for(int column = cell.column0; column <= cell.column1; ++column){
+            const int index = row*columns + column;
+            if(_queued[index])
+                continue;
+            const double tx = static_cast<double>(column - cell.column0) / width;
+            const double z0 = z00 + (z10 - z00)*tx, z1 = z01 + (z11 - z01)*tx;
+            _map->setHeight(index, z0 + (z1 - z0)*ty);
+        }
+    }
+}
+
+
+//////  r o u t e  //////
+
+namespace {
+
+// batch points on the grid of the map, searched ring by ring around a position
+struct Grid
+{
+    const HeightMap& map;
+    std::vector<int> owner; // grid point -> batch point, -1 if none
+    std::vector<double> x, y; // mm, of the batch points and the start (last)
+    double minCell;
+
+    Grid(const HeightMap& map, const std::vector<int>& points, const double* start) : map(map), owner(map.count(), -1)
+    {
+        const int n = points.size();
+        x.resize(n+1);
+        y.resize(n+1);
+        for(int i=0; i < n; ++i){
+            owner[points[i]] = i;
+            map.position(points[i], x[i], y[i]);
+        }
+        x[n] = start[0];
+        y[n] = start[1];
+        minCell = std::min(map.cell(0), map.cell(1));
+    }
+
+    inline double distance(int a, int b) const {return ::hypot(x[a] - x[b], y[a] - y[b]);}
+
+    // nearest batch points to point p, not excluded, up to count of them sorted by distance
+    void nearest(int p, int count, const std::vector<bool>& excluded, std::vector<std::pair<double, int>>& found) const
+    {
+        found.clear();
+        const int columns = map.columns(), rows = map.rows();
+        const double fx = x[p], fy = y[p];
+        double x0, y0;
+        map.position(0, x0, y0);
+        const int c0 = std::max(0, std::min(columns-1, static_cast<int>(::floor((fx - x0) / map.cell(0) + 0.5))));
+        const int r0 = std::max(0, std::min(rows-1, static_cast<int>(::floor((fy - y0) / map.cell(1) + 0.5))));
+        const double offset = ::hypot(fx - (x0 + c0*map.cell(0)), fy - (y0 + r0*map.cell(1))); // from the grid point
+
+        const int maxRing = std::max(columns, rows);
+        for(int ring=0; ring <= maxRing; ++ring){
+            if(static_cast<int>(found.size()) >= count && found[count-1].first <= ring*minCell - offset)
+                break; // farther rings cannot be closer
+            for(int r = r0 - ring; r <= r0 + ring; ++r){
+                if(r < 0 || r >= rows)
+                    continue;
+                const bool edge = (r == r0 - ring || r == r0 + ring);
+                for(int c = c0 - ring; c <= c0 + ring; c += (edge || ring == 0)? 1: 2*ring){
+                    if(c < 0 || c >= columns)
+                        continue;
+                    const int q = owner[r*columns + c];
+                    if(q < 0 || q == p || excluded[q])
+                        continue;
+                    found.push_back(std::make_pair(distance(p, q), q));
+                }
+            }
+            std::sort(found.begin(), found.end());
+            if(static_cast<int>(found.size()) > count)
+                found.resize(count);
+        }
+    }
+};
+
+}
+
+
+vector<int> ProbePlanner::route(const HeightMap& map, const vector<int>& points, const double* start,
+                                const atomic<bool>* cancel)
+{
+    const int n = points.size();
+    if(n < 2)
+        return points;
+    const Grid grid(map, points, start);
+
+    // nearest neighbour from the start (node n)
+    vector<int> tour(1, n);
+    vector<bool> visited(n+1, false);
+    visited[n] = true;
+    vector<pair<double, int>> found;
+    while(static_cast<int>(tour.size()) <= n){
+        grid.nearest(tour.back(), 1, visited, found);
+        if(found.empty())
+            break;
+        visited[found[0].second] = true;
+        tour.push_back(found[0].second);
+    }
+
+    // 2-opt: two edges are replaced when joining their ends the other way round is shorter,
+    // new edges start from the nearest points only; the path is open, the start stays first
+    const int m = tour.size();
+    vector<vector<int>> neighbours(n+1);
+    const vector<bool> none(n+1, false);
+    for(int p=0; p <= n; ++p){
+        grid.nearest(p, NEIGHBOURS, none, found);
+        for(size_t k=0; k < found.size(); ++k)
+            neighbours[p].push_back(found[k].second);
+    }
+    vector<int> position(n+1);
+    for(int i=0; i < m; ++i)
+        position[tour[i]] = i;
+
+    bool improved = true;
+    for(int pass=0; improved && pass < MAX_PASSES && !(cancel && *cancel); ++pass){
+        improved = false;
+        for(int i=0; i+1 < m; ++i){
+            const int a = tour[i], b = tour[i+1];
+            const double ab = grid.distance(a, b);
+            for(const int c: neighbours[a]){
+                const double ac = grid.distance(a, c);
+                if(ac >= ab)
+                    break; // sorted
+                const int j = position[c];
+                int first, last; // reversed
+                double gain;
+                if(j > i+1){ // a-b ... c-d becomes a-c ... b-d
+                    gain = ab - ac;
+                    if(j+1 < m)
+                        gain += grid.distance(c, tour[j+1]) - grid.distance(b, tour[j+1]);
+                    first = i+1;
+                    last = j;
+                }
+                else if(j < i){ // c-e ... a-b becomes c-a ... e-b
+                    const int e = tour[j+1];
+                    gain = ab - ac + grid.distance(c, e) - grid.distance(e, b);
+                    first = j+1;
+                    last = i;
+                }
+                else
+                    continue;
+
+                if(gain > 1e-9){
+                    std::reverse(tour.begin() + first, tour.begin() + last + 1);
+                    for(int k = first; k <= last; ++k)
+                        position[tour[k]] = k;
+                    improved = true;
+                    break; // the edge from a has changed
+                }
+            }
+        }
+    }
+
+    vector<int> ordered;
+    ordered.reserve(n);
+    for(int i=1; i < m; ++i)
+        ordered.push_back(points[tour[i]]);
+    return ordered;
+}
+
+
+double ProbePlanner::length(const HeightMap& map, const vector<int>& points, const double* start)
+{
+    double total = 0.0, last[2] = {start[0], start[1]};
+    for(const int index: points){
+        double x, y;
+        map.position(index, x, y);
+        total += ::hypot(x - last[0], y - last[1]);
+        last[0] = x;
+        last[1] = y;
+    }
+    return total;
+}
+
+
+double ProbePlanner::rasterLength(const HeightMap& map)
+{
+    return map.rows()*(map.columns() - 1)*map.cell(0) + (map.rows() - 1)*map.cell(1);
+}
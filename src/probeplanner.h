@@ -0,0 +1,55 @@
+#ifndef GSHARPIE_PROBEPLANNER_H
+#define GSHARPIE_PROBEPLANNER_H
+#include <atomic>
+#include <vector>
+#include "heightmap.h"
+
+
+// chooses the points of a height map to probe, in batches: a coarse grid first, then the cells whose corners
+// bend away from their neighbours by more than the threshold are halved, down to the grid spacing; the points
+// of the other cells are interpolated; every batch is ordered for the shortest travel (nearest neighbour, then 2-opt)
+class ProbePlanner
+{
+public:
+    static const int COARSE_STEP = 4; // grid cells between the points probed first
+    static const int NEIGHBOURS = 8; // candidates for the new edges of a point, 2-opt
+    static const int MAX_PASSES = 50; // of 2-opt over the whole path
+
+public:
+    ProbePlanner() {_map = nullptr; _threshold = 0.0; _started = false;}
+
+    // the map has its grid set; threshold 0 probes every point, otherwise features smaller than
+    // the coarse spacing may be missed
+    void start(HeightMap* map, double threshold);
+
+    // grid points to probe, their heights are set in the map before the next batch is asked for;
+    // none when the map is complete, the points left out have been interpolated
+    std::vector<int> nextBatch();
+
+    // thread-safe: open path from the start position (mm) through the grid points, shortest found
+    static std::vector<int> route(const HeightMap& map, const std::vector<int>& points, const double* start,
+                                  const std::atomic<bool>* cancel=nullptr);
+    static double length(const HeightMap& map, const std::vector<int>& points, const double* start); // mm
+    static double rasterLength(const HeightMap& map); // mm, every point row by row
+
+private:
+    struct Cell // between the corner columns and rows, the corners are probed
+    {
+        int column0, row0, column1, row1;
+    };
+
+    double _bend(const Cell& cell) const; // mm, off the bilinear surface
+    void _split(const Cell& cell, std::vector<int>& points);
+    void _queue(int column, int row, std::vector<int>& points);
+    void _fill(const Cell& cell); // interpolates the points not probed
+
+private:
+    HeightMap* _map;
+    double _threshold; // mm
+    bool _started;
+    std::vector<Cell> _cells; // corners queued in the last batch
+    std::vector<Cell> _flat; // to be interpolated at the end
+    std::vector<bool> _queued; // grid points probed, or to be
+};
+
+#endif // GSHARPIE_PROBEPLANNER_H
@@ -0,0 +1,210 @@
+#include <QtConcurrent>
+#include "mainwindow.h"
+#include "ui_mainwindow.h"
+
+
+// "[PRB:x,y,z:1]", machine coordinates in report units and whether the probe has touched
+static bool readProbe(const QString& line, QVector4D& pos, bool& touched)
+{
+    if(!line.startsWith(QLatin1String("[PRB:")) || !line.endsWith(QLatin1Char(']')))
+        return false;
+    const QStringList fields = line.mid(5, line.size()-6).split(QLatin1Char(':'));
+    if(fields.size() < 2)
+        return false;
+    const QStringList coordinates = fields[0].split(QLatin1Char(','));
+    if(coordinates.size() < 3)
+        return false;
+
+    pos = QVector4D(coordinates[0].toFloat(), coordinates[1].toFloat(), coordinates[2].toFloat(), 0.0f);
+    touched = (fields[1] == QLatin1String("1"));
+    return true;
+}
+
+
+//////  p r o b e  S u r f a c e  //////
+void MainWindow::on_btn_probeSurface_clicked()
+{
+    if(_probing){
+        _abortProbing(QString("Surface probing stopped"));
+        return;
+    }
+    if(!_sequencer->isReady()){
+        on_errorReport(1, QString("Load a program to probe the surface under it"));
+        return;
+    }
+    if(_grbl->getCurrentStatus().state != GrblControl::Idle || _timerGCode->isActive()){
+        on_errorReport(1, QString("Surface can be probed when the machine is idle"));
+        return;
+    }
+
+    GCodeBounds bounds;
+    const GCodeBounds::Result extent = bounds.check(_sequencer->source()); // as the program is written
+    if(extent.empty){
+        on_errorReport(1, QString("Program does not move"));
+        return;
+    }
+
+    _settings->beginGroup("Probing");
+    const double step = _settings->value("probe_step", 10.0).toDouble(); // mm
+    const double threshold = _settings->value("probe_threshold", 0.05).toDouble();
+    _probeClearance = _settings->value("probe_clearance", 2.0).toDouble();
+    _probeDepth = _settings->value("probe_depth", -2.0).toDouble();
+    _probeFeed = _settings->value("probe_feed", 50.0).toDouble(); // mm/min
+    _settings->endGroup();
+
+    _heightMap.setGrid(extent.low, extent.high, step);
+    _sequencer->enableHeightCompensation(ui->check_heightMap->isChecked(), &_heightMap); // not applied until complete
+    _probePlanner.start(&_heightMap, threshold);
+
+    char cmd[64];
+    _grbl->issueCommand("G21G90", "Probing units");
+    ::sprintf(cmd, "G0Z%.3f", _probeClearance);
+    _grbl->issueCommand(cmd, "Probing clearance");
+
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
+    const double scale = _grbl->getConfiguration().imperial? 25.4: 1.0;
+    _probeAt[0] = status.pos.wpos.x() * scale;
+    _probeAt[1] = status.pos.wpos.y() * scale;
+    _probeCount = 0;
+    _probeTravel = 0.0;
+    _probing = true;
+
+    on_errorReport(0, QString("Probing the surface at ") + QString::number(_heightMap.columns()) + QString(" x ") +
+                      QString::number(_heightMap.rows()) + QString(" points, ") +
+                      QString::number(_heightMap.cell(0), 'f', 2) + QString(" x ") +
+                      QString::number(_heightMap.cell(1), 'f', 2) + QString(" mm apart"));
+    ui->btn_probeSurface->setText(QStringLiteral("stop probing"));
+    _planProbes();
+}
+
+
+//////  p l a n  P r o b e s  //////
+void MainWindow::_planProbes()
+{
+    const std::vector<int> batch = _probePlanner.nextBatch();
+    if(!batch.empty()){
+        const HeightMap map = _heightMap; // its grid, the map itself changes while the batch is probed
+        const double from[2] = {_probeAt[0], _probeAt[1]};
+        const std::atomic<bool>* cancel = &_cancelRouting;
+        _cancelRouting = false;
+        _probeRouting->setFuture(QtConcurrent::run([map, batch, from, cancel](){
+            return ProbePlanner::route(map, batch, from, cancel);
+        }));
+        return;
+    }
+
+    // the points left out have been interpolated
+    _probing = false;
+    double low, high;
+    _heightMap.range(low, high);
+    on_errorReport(0, QString("Surface probed, work Z from ") + QString::number(low, 'f', 3) +
+                      QString(" to ") + QString::number(high, 'f', 3) + QString(" mm"));
+    on_errorReport(0, QString("Probed ") + QString::number(_probeCount) + QString(" of ") +
+                      QString::number(_heightMap.count()) + QString(" points, travel ") +
+                      QString::number(_probeTravel, 'f', 0) + QString(" mm (") +
+                      QString::number(ProbePlanner::rasterLength(_heightMap), 'f', 0) +
+                      QString(" mm for every point row by row)"));
+    ui->btn_probeSurface->setText(QStringLiteral("probe surface"));
+    _applyHeightMap();
+}
+
+
+//////  p r o b e s  R o u t e d  //////
+void MainWindow::_probesRouted()
+{
+    if(!_probing || _probeRouting->isCanceled())
+        return; // stopped meanwhile
+
+    const std::vector<int> route = _probeRouting->result();
+    _probeTravel += ProbePlanner::length(_heightMap, route, _probeAt);
+
+    char cmd[64];
+    for(size_t i=0; i < route.size(); ++i){
+        double x, y;
+        _heightMap.position(route[i], x, y);
+        ::sprintf(cmd, "G0X%.3fY%.3f", x, y);
+        _grbl->issueCommand(cmd, "Probing move");
+        ::sprintf(cmd, "G38.2Z%.3fF%g", _probeDepth, _probeFeed);
+        const quint32 id = _grbl->issueCommand(cmd, "Probe");
+        if(id != 0)
+            _probeIds.insert(id, route[i]);
+        ::sprintf(cmd, "G0Z%.3f", _probeClearance);
+        _grbl->issueCommand(cmd, "Probing clearance");
+        _probeAt[0] = x;
+        _probeAt[1] = y;
+    }
+    if(route.empty() || _probeIds.size() != (int)route.size()){
+        _abortProbing(QString("Surface probing cannot be continued"));
+        return;
+    }
+    _probeCount += route.size();
+    on_errorReport(-1, QString("Probing ") + QString::number(route.size()) + QString(" points"));
+}
+
+
+//////  p r o b e  R e s p o n s e  //////
+void MainWindow::_probeResponse(const GrblControl::Command& cmd)
+{
+    QHash<quint64, int>::iterator probe = _probeIds.find(cmd.id);
+    if(probe == _probeIds.end())
+        return;
+    const int index = probe.value();
+    _probeIds.erase(probe);
+
+    QVector4D contact;
+    bool touched = false;
+    for(int i=0; i < cmd.response.size(); ++i)
+        readProbe(cmd.response.at(i), contact, touched);
+    double x, y;
+    _heightMap.position(index, x, y);
+    if(!cmd.error.isEmpty() || !touched){
+        _abortProbing(QString("Probe has not touched the surface at X") + QString::number(x) +
+                      QString(" Y") + QString::number(y));
+        return;
+    }
+
+    // work offset is the same for the whole grid
+    const GrblControl::Status& status = _grbl->getCurrentStatus();
+    const double scale = _grbl->getConfiguration().imperial? 25.4: 1.0;
+    _heightMap.setHeight(index, (contact.z() - (status.pos.mpos.z() - status.pos.wpos.z())) * scale);
+    if(_probeIds.isEmpty())
+        _planProbes(); // where the batch shows the surface bends
+}
+
+
+//////  a b o r t  P r o b i n g  //////
+void MainWindow::_abortProbing(const QString& reason)
+{
+    _cancelRouting = true;
+    _probing = false;
+    _grbl->clearQueue(); // the probe being executed still finishes
+    _probeIds.clear();
+    _heightMap.clear();
+    on_errorReport(2, reason);
+    ui->btn_probeSurface->setText(QStringLiteral("probe surface"));
+}
+
+
+//////  a p p l y  H e i g h t  M a p  //////
+void MainWindow::_applyHeightMap()
+{
+    _sequencer->enableHeightCompensation(ui->check_heightMap->isChecked(), &_heightMap);
+    if(!_sequencer->isReady() || _timerGCode->isActive())
+        return; // with the next program
+
+    _optimizeProgram();
+    _startEstimation();
+    ui->view_toolpath->setProgram(&_sequencer->program());
+    if(ui->edit_textGCode->isReadOnly()){ // a refused program may run again when the surface is not followed
+        ui->btn_runGCode->setEnabled(_grbl->isActive() && _sequencer->compensationRefusal().lineNumber == 0);
+        ui->label_stateGCode->setText(ui->btn_runGCode->isEnabled()? "ready": "");
+    }
+}
+
+
+void MainWindow::on_check_heightMap_toggled(bool checked)
+{
+    Q_UNUSED(checked);
+    if(!_probing)
+        _applyHeightMap();
+}
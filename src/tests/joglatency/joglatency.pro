@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Jog latency regression test: qmake && make check
+#
+#-------------------------------------------------
+
+QT       += core gui serialport testlib
+CONFIG   += c++11 console testcase
+CONFIG   -= app_bundle
+
+TARGET = tst_joglatency
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_joglatency.cpp \
+    ../../jogcontroller.cpp \
+    ../../joglatency.cpp \
+    ../../jogsession.cpp
+
+HEADERS  += ../../jogcontroller.h \
+    ../../joglatency.h \
+    ../../jogsession.h
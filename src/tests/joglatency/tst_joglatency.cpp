@@ -0,0 +1,246 @@
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <algorithm>
+#include <QtTest>
+#include "jogcontroller.h"
+#include "joglatency.h"
+#include "jogsession.h"
+
+
+// a key is held and released many times against a simulated grbl on a scripted clock,
+// the latency percentiles must stay within the budgets (msec)
+static const int LINK = 10; // msec, one way, serial port and USB
+static const int STATUS_PERIOD = 25; // msec, between status requests
+static const double ACCELERATION = 500.0; // mm/sec^2, $120
+static const int RATE = 1000; // mm/min
+static const int CYCLES = 500;
+
+// a report period at most from the first move (or the stop) to its report, plus a little
+static const qint64 PRESS_TO_MOTION_P90 = 55;
+static const qint64 PRESS_TO_MOTION_P99 = 60;
+static const qint64 RELEASE_TO_STOP_P90 = 80;
+static const qint64 RELEASE_TO_STOP_P99 = 85;
+
+
+// jog controller on the test's clock, its loop runs when the test says
+class ScriptedJog: public JogController
+{
+public:
+    ScriptedJog() {now = 0;}
+    double time() const override {return now * 1e-3;}
+    void tick() {_tick();}
+
+    qint64 now; // msec
+};
+
+
+// grbl executing jog moves: the planner accelerates to the rate and keeps room to stop at the end
+// of the queued moves, a jog cancel decelerates to a stop at once
+class FakeGrbl
+{
+public:
+    FakeGrbl() {_queued = _speed = 0.0;}
+
+    void receive(double length) {_queued += length;}
+    void cancel() {_queued = _speed*_speed / (2.0*ACCELERATION);}
+    inline GrblControl::MACHINE_STATE state() const {return (_queued > 0.0)? GrblControl::Jog: GrblControl::Idle;}
+
+    void advance(double dt) // sec
+    {
+        if(_queued <= 0.0)
+            return;
+        const double limit = std::min(RATE/60.0, ::sqrt(2.0*ACCELERATION*_queued));
+        _speed = std::min(_speed + ACCELERATION*dt, limit);
+        _queued -= _speed*dt;
+        if(_queued <= 1e-6)
+            _queued = _speed = 0.0;
+    }
+
+private:
+    double _queued; // mm
+    double _speed; // mm/sec
+};
+
+
+// whatever travels over the link, in the order it was sent
+struct Event
+{
+    enum KIND{Line, Ack, Cancel, StatusRequest, Report};
+
+    qint64 at; // msec, arrival
+    KIND kind;
+    double length; // mm, of a line
+    quint32 id; // command id of a line
+    GrblControl::MACHINE_STATE state; // of a report
+};
+
+
+// mm, of a $J line
+static double jogLength(const QByteArray& code)
+{
+    double length = 0.0;
+    for(const char* s = code.constData(); *s; ++s){
+        if(*s == 'X' || *s == 'Y' || *s == 'Z'){
+            const double d = ::strtod(s+1, nullptr);
+            length += d*d;
+        }
+    }
+    return ::sqrt(length);
+}
+
+
+// jog session on the simulated link, lines and the jog cancel leave at once and take LINK
+class ScriptedSession: public JogSession
+{
+public:
+    ScriptedSession(ScriptedJog* jog, std::deque<Event>* link) : JogSession(jog)
+    {
+        _clock = jog;
+        _link = link;
+        _lastId = 0;
+        state = GrblControl::Idle;
+        config = GrblControl::Config();
+    }
+
+    GrblControl::MACHINE_STATE state; // last reported
+    GrblControl::Config config;
+
+protected:
+    qint64 _time() const override {return _clock->now;}
+    GrblControl::MACHINE_STATE _state() const override {return state;}
+    void _position(double* pos) const override {pos[0] = pos[1] = pos[2] = 0.0;}
+    const GrblControl::Config& _config() const override {return config;}
+
+    quint32 _send(const QByteArray& code) override
+    {
+        const Event line = {_clock->now + LINK, Event::Line, jogLength(code), ++_lastId, GrblControl::Idle};
+        _link->push_back(line);
+        return _lastId;
+    }
+
+    void _cancel() override // nothing waits unsent on this link
+    {
+        const Event cancel = {_clock->now + LINK, Event::Cancel, 0.0, 0, GrblControl::Idle};
+        _link->push_back(cancel);
+    }
+
+private:
+    const ScriptedJog* _clock;
+    std::deque<Event>* _link;
+    quint32 _lastId;
+};
+
+
+static int randomDelay(int low, int high) // msec, repeatable
+{
+    static unsigned int seed = 12345;
+    seed = seed*1103515245u + 12345u;
+    return low + static_cast<int>((seed >> 16) % static_cast<unsigned int>(high - low + 1));
+}
+
+
+class TestJogLatency: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void pressToMotion();
+    void releaseToStop();
+
+private:
+    JogLatency _latency;
+};
+
+
+//////  i n i t  T e s t  C a s e  //////
+// the key is pressed a while after the last jog has stopped and held for a random time
+void TestJogLatency::initTestCase()
+{
+    ScriptedJog jog;
+    std::deque<Event> link; // every event takes LINK, they arrive in order
+    ScriptedSession session(&jog, &link);
+    for(int i=0; i<3; ++i)
+        session.config.acceleration[i] = ACCELERATION;
+    jog.setRate(RATE);
+    QObject::connect(&jog, &JogController::command, &session, &JogSession::issue);
+
+    FakeGrbl grbl;
+    qint64 press = 100, release = -1;
+    int cycles = 0;
+    for(qint64 t = 0; cycles < CYCLES; ++t){
+        jog.now = t;
+        while(!link.empty() && link.front().at <= t){
+            Event event = link.front();
+            link.pop_front();
+            switch(event.kind){
+                case Event::Line: // accepted at once, the response goes back
+                    grbl.receive(event.length);
+                    event.kind = Event::Ack;
+                    event.at = t + LINK;
+                    link.push_back(event);
+                    break;
+                case Event::Ack:{
+                    GrblControl::Command cmd = GrblControl::Command();
+                    cmd.id = event.id;
+                    session.completed(cmd);
+                    break;
+                }
+                case Event::Cancel:
+                    grbl.cancel();
+                    break;
+                case Event::StatusRequest:
+                    event.kind = Event::Report;
+                    event.state = grbl.state();
+                    event.at = t + LINK;
+                    link.push_back(event);
+                    break;
+                case Event::Report: // stamped on receipt
+                    session.state = event.state;
+                    if(session.reported(t, event.state)){
+                        ++cycles;
+                        press = t + randomDelay(50, 300);
+                    }
+                    break;
+            }
+        }
+
+        if(t % STATUS_PERIOD == 0){
+            const Event request = {t + LINK, Event::StatusRequest, 0.0, 0, GrblControl::Idle};
+            link.push_back(request);
+        }
+        if(t == press){
+            session.press(0, 1, true);
+            release = t + randomDelay(100, 800);
+        }
+        if(t == release)
+            session.press(0, 1, false);
+        if(t % JogController::TICK == 0)
+            jog.tick();
+        grbl.advance(1e-3);
+    }
+    _latency = session.latency();
+}
+
+
+void TestJogLatency::pressToMotion()
+{
+    const JogLatency::Summary summary = _latency.summary(JogLatency::PressToMotion);
+    QCOMPARE(summary.count, CYCLES);
+    QVERIFY2(summary.p90 <= PRESS_TO_MOTION_P90, qPrintable(_latency.report()));
+    QVERIFY2(summary.p99 <= PRESS_TO_MOTION_P99, qPrintable(_latency.report()));
+}
+
+
+void TestJogLatency::releaseToStop()
+{
+    const JogLatency::Summary summary = _latency.summary(JogLatency::ReleaseToStop);
+    QCOMPARE(summary.count, CYCLES);
+    QVERIFY2(summary.p90 <= RELEASE_TO_STOP_P90, qPrintable(_latency.report()));
+    QVERIFY2(summary.p99 <= RELEASE_TO_STOP_P99, qPrintable(_latency.report()));
+}
+
+
+QTEST_APPLESS_MAIN(TestJogLatency)
+#include "tst_joglatency.moc"
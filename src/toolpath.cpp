@@ -0,0 +1,487 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <QThread>
+#include <QtConcurrent>
+#include "toolpath.h"
+
+using namespace std;
+
+static const double ARC_TOLERANCE = 0.01; // mm, chord error of flattened arcs
+static const int MAX_ARC_SEGMENTS = 4096;
+static const float MIN_CELL = 1e-3f; // mm, keeps cell numbers in range
+static const int MORTON_BITS = 21; // per axis
+
+
+Toolpath::Toolpath()
+{
+    for(int i=0; i<3; ++i)
+        _low[i] = _high[i] = 0.0f;
+    _maxLine = 0;
+    _leafCount = 0;
+}
+
+
+int Toolpath::selectLevel(double pixelSize) const
+{
+    int index = 0;
+    while(index+1 < levelCount() && _levels[index+1].cell <= pixelSize)
+        ++index;
+    return index;
+}
+
+
+//////  b u i l d  //////
+bool Toolpath::build(const GCodeProgram& program, const std::atomic<bool>* cancel)
+{
+    _levels.clear();
+    _lines = program.lineNumbers();
+    _maxLine = _lines.empty()? 0: *max_element(_lines.begin(), _lines.end());
+
+    const int steps = program.size();
+    const int chunkSize = 16 * GCodeProgram::CHECKPOINT_INTERVAL;
+    vector<Chunk> chunks;
+    for(int begin = 0; begin < steps; begin += chunkSize){
+        Chunk chunk;
+        chunk.begin = begin;
+        chunk.end = min(begin + chunkSize, steps);
+        chunks.push_back(chunk);
+    }
+    QtConcurrent::blockingMap(chunks, [&program, cancel](Chunk& chunk){
+        _buildChunk(program, chunk, cancel);
+    });
+    if(cancel && *cancel)
+        return false;
+
+    // chunks start with a jump to their first move, it is dropped where the path continues
+    Level full;
+    full.cell = 0.0f;
+    size_t total = 0;
+    for(const Chunk& chunk: chunks)
+        total += chunk.points.size();
+    full.points.reserve(total);
+    for(const Chunk& chunk: chunks){
+        size_t first = 0;
+        if(!chunk.points.empty() && !full.points.empty()){
+            const Point& last = full.points.back();
+            const Point& next = chunk.points.front();
+            if(last.pos[0] == next.pos[0] && last.pos[1] == next.pos[1] && last.pos[2] == next.pos[2])
+                first = 1;
+        }
+        full.points.insert(full.points.end(), chunk.points.begin() + first, chunk.points.end());
+    }
+    chunks.clear();
+
+    for(int i=0; i<3; ++i){
+        _low[i] = 1e30f;
+        _high[i] = -1e30f;
+    }
+    for(const Point& point: full.points){
+        for(int i=0; i<3; ++i){
+            _low[i] = min(_low[i], point.pos[i]);
+            _high[i] = max(_high[i], point.pos[i]);
+        }
+    }
+    if(full.points.empty()){
+        for(int i=0; i<3; ++i)
+            _low[i] = _high[i] = 0.0f;
+    }
+    _makeBlocks(full);
+    _levels.push_back(std::move(full));
+    if(!_buildIndex(cancel))
+        return false;
+
+    const float size = max(max(_high[0] - _low[0], _high[1] - _low[1]), max(_high[2] - _low[2], 1e-3f));
+    for(float cell = max(size/FINEST_CELLS, MIN_CELL); cell <= size/COARSEST_CELLS; cell *= 2.0f){
+        if(static_cast<int>(_levels.back().points.size()) < MIN_POINTS)
+            break;
+        if(cancel && *cancel)
+            return false;
+
+        Level coarse;
+        coarse.cell = cell;
+        _merge(_levels.back(), coarse);
+        if(coarse.points.size() <= _levels.back().points.size() * 3/4) // otherwise not worth another copy
+            _levels.push_back(std::move(coarse));
+    }
+    return true;
+}
+
+
+//////  b u i l d  C h u n k  //////
+void Toolpath::_buildChunk(const GCodeProgram& program, Chunk& chunk, const std::atomic<bool>* cancel)
+{
+    GCodeState state = program.stateAt(chunk.begin);
+    GCodeMove move;
+    bool started = false; // chunk has its first point
+    double last[3] = {0.0, 0.0, 0.0};
+    for(int step = chunk.begin; step < chunk.end; ++step){
+        if((step & (GCodeProgram::CHECKPOINT_INTERVAL-1)) == 0 && cancel && *cancel)
+            return;
+        if(!state.update(program.codePtr(step), &move) || move.type == GCodeMove::Dwell)
+            continue;
+        if(move.machine) // G53 target is in machine coordinates, the path continues where the next move starts
+            continue;
+
+        if(!started || move.from[0] != last[0] || move.from[1] != last[1] || move.from[2] != last[2])
+            _addPoint(chunk.points, move.from, step, Jump);
+        started = true;
+
+        if(move.isArc()){
+            int a0, a1, lin;
+            move.planeAxes(a0, a1, lin);
+            const double radius = move.radius();
+            const double angle = move.angularTravel();
+            int segments = 1;
+            if(2.0*radius > ARC_TOLERANCE)
+                segments = static_cast<int>(::ceil(::fabs(0.5*angle*radius) /
+                                                   ::sqrt(ARC_TOLERANCE*(2.0*radius - ARC_TOLERANCE))));
+            segments = max(1, min(segments, MAX_ARC_SEGMENTS));
+
+            const double rx = move.from[a0] - move.center[a0];
+            const double ry = move.from[a1] - move.center[a1];
+            for(int i=1; i < segments; ++i){
+                const double theta = angle*i/segments;
+                double point[3];
+                point[a0] = move.center[a0] + rx*::cos(theta) - ry*::sin(theta);
+                point[a1] = move.center[a1] + rx*::sin(theta) + ry*::cos(theta);
+                point[lin] = move.from[lin] + (move.to[lin] - move.from[lin])*i/segments;
+                _addPoint(chunk.points, point, step, Feed);
+            }
+        }
+        _addPoint(chunk.points, move.to, step, (move.type == GCodeMove::Rapid)? Rapid: Feed);
+        for(int i=0; i<3; ++i)
+            last[i] = move.to[i];
+    }
+}
+
+
+void Toolpath::_addPoint(std::vector<Point>& points, const double* pos, int step, TYPE type)
+{
+    Point point;
+    for(int i=0; i<3; ++i)
+        point.pos[i] = static_cast<float>(pos[i]);
+    point.tag = (step << 2) | type;
+    points.push_back(point);
+}
+
+
+//////  m e r g e  //////
+// a point replaces the one before it when both are reached the same way and lie in the same cell;
+// all the points dropped in a row are in the cell of the point kept, the path moves less than a cell
+void Toolpath::_merge(const Level& fine, Level& coarse)
+{
+    const float scale = 1.0f / coarse.cell;
+    coarse.points.reserve(fine.points.size() / 2);
+
+    int lastCell[3] = {0, 0, 0};
+    for(const Point& point: fine.points){
+        int cell[3];
+        for(int i=0; i<3; ++i)
+            cell[i] = static_cast<int>(::floor(point.pos[i] * scale));
+
+        const size_t n = coarse.points.size();
+        if(n >= 2 && point.type() != Jump && point.type() == coarse.points[n-1].type() &&
+           cell[0] == lastCell[0] && cell[1] == lastCell[1] && cell[2] == lastCell[2])
+            coarse.points[n-1] = point;
+        else
+            coarse.points.push_back(point);
+
+        for(int i=0; i<3; ++i)
+            lastCell[i] = cell[i];
+    }
+    _makeBlocks(coarse);
+}
+
+
+void Toolpath::_makeBlocks(Level& level)
+{
+    const size_t count = level.points.size();
+    level.blocks.resize((count + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    for(size_t b=0; b < level.blocks.size(); ++b){
+        Block& block = level.blocks[b];
+        const size_t begin = (b > 0)? b*BLOCK_SIZE - 1: 0; // segments start in the point before
+        const size_t end = min(count, (b+1)*BLOCK_SIZE);
+        for(int i=0; i<3; ++i){
+            block.low[i] = 1e30f;
+            block.high[i] = -1e30f;
+        }
+        for(size_t n = begin; n < end; ++n){
+            for(int i=0; i<3; ++i){
+                block.low[i] = min(block.low[i], level.points[n].pos[i]);
+                block.high[i] = max(block.high[i], level.points[n].pos[i]);
+            }
+        }
+    }
+}
+
+
+//////  b u i l d  I n d e x  //////
+static inline uint64_t spreadBits(uint64_t v) // 21 bits to every third bit
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+
+bool Toolpath::_buildIndex(const std::atomic<bool>* cancel)
+{
+    _segments.clear();
+    _nodes.clear();
+    _leafCount = 0;
+
+    const vector<Point>& points = _levels[0].points;
+    struct Entry
+    {
+        uint64_t code; // Morton code of the midpoint
+        int segment;
+        inline bool operator<(const Entry& other) const {return code < other.code;}
+    };
+    vector<Entry> entries;
+    entries.reserve(points.size());
+    for(size_t n=1; n < points.size(); ++n){
+        if(points[n].type() != Jump){
+            Entry entry;
+            entry.segment = static_cast<int>(n);
+            entries.push_back(entry);
+        }
+    }
+    const int count = static_cast<int>(entries.size());
+    if(count == 0)
+        return true;
+
+    // codes and sorted runs in parallel, then the runs are merged pairwise
+    const int runSize = max(count / (4*max(QThread::idealThreadCount(), 1)) + 1, 1024);
+    vector<pair<int, int>> runs;
+    for(int begin = 0; begin < count; begin += runSize)
+        runs.push_back(make_pair(begin, min(begin + runSize, count)));
+
+    float scale[3];
+    for(int i=0; i<3; ++i)
+        scale[i] = ((1 << MORTON_BITS) - 1) / max(_high[i] - _low[i], 1e-6f);
+    QtConcurrent::blockingMap(runs, [this, &entries, &points, &scale](const pair<int, int>& run){
+        for(int e = run.first; e < run.second; ++e){
+            const Point& a = points[entries[e].segment - 1];
+            const Point& b = points[entries[e].segment];
+            uint64_t code = 0;
+            for(int i=0; i<3; ++i)
+                code |= spreadBits(static_cast<uint64_t>((0.5f*(a.pos[i] + b.pos[i]) - _low[i]) * scale[i])) << i;
+            entries[e].code = code;
+        }
+        sort(entries.begin() + run.first, entries.begin() + run.second);
+    });
+    if(cancel && *cancel)
+        return false;
+
+    vector<Entry> merged(entries.size());
+    while(runs.size() > 1){
+        vector<pair<int, int>> pairs; // first run of each pair, its end is the start of the second
+        vector<pair<int, int>> next;
+        for(size_t r=0; r < runs.size(); r += 2){
+            const int end = (r+1 < runs.size())? runs[r+1].second: runs[r].second;
+            pairs.push_back(make_pair(static_cast<int>(r), end));
+            next.push_back(make_pair(runs[r].first, end));
+        }
+        QtConcurrent::blockingMap(pairs, [&runs, &entries, &merged](const pair<int, int>& p){
+            const pair<int, int>& run = runs[p.first];
+            std::merge(entries.begin() + run.first, entries.begin() + run.second,
+                       entries.begin() + run.second, entries.begin() + p.second, merged.begin() + run.first);
+        });
+        entries.swap(merged);
+        runs.swap(next);
+        if(cancel && *cancel)
+            return false;
+    }
+
+    // leaves, NODE_SIZE segments each
+    _segments.resize(count);
+    _leafCount = (count + NODE_SIZE - 1) / NODE_SIZE;
+    _nodes.resize(_leafCount);
+    vector<pair<int, int>> chunks; // of leaves
+    for(int begin = 0; begin < _leafCount; begin += runSize / NODE_SIZE + 1)
+        chunks.push_back(make_pair(begin, min(begin + runSize / NODE_SIZE + 1, _leafCount)));
+    QtConcurrent::blockingMap(chunks, [this, &entries, &points, count](const pair<int, int>& chunk){
+        for(int leaf = chunk.first; leaf < chunk.second; ++leaf){
+            Node& node = _nodes[leaf];
+            node.first = node.segmentFirst = leaf * NODE_SIZE;
+            node.count = node.segmentCount = min(NODE_SIZE, count - node.first);
+            for(int i=0; i<3; ++i){
+                node.low[i] = 1e30f;
+                node.high[i] = -1e30f;
+            }
+            for(int e = node.first; e < node.first + node.count; ++e){
+                const int segment = entries[e].segment;
+                _segments[e] = segment;
+                for(int i=0; i<3; ++i){
+                    const float a = points[segment-1].pos[i], b = points[segment].pos[i];
+                    node.low[i] = min(node.low[i], min(a, b));
+                    node.high[i] = max(node.high[i], max(a, b));
+                }
+            }
+        }
+    });
+
+    // upper levels, up to a single root
+    int levelFirst = 0, levelCount = _leafCount;
+    while(levelCount > 1){
+        const int parents = (levelCount + NODE_SIZE - 1) / NODE_SIZE;
+        for(int p=0; p < parents; ++p){
+            Node node;
+            node.first = levelFirst + p*NODE_SIZE;
+            node.count = min(NODE_SIZE, levelFirst + levelCount - node.first);
+            node.segmentFirst = _nodes[node.first].segmentFirst;
+            node.segmentCount = 0;
+            for(int i=0; i<3; ++i){
+                node.low[i] = 1e30f;
+                node.high[i] = -1e30f;
+            }
+            for(int c = node.first; c < node.first + node.count; ++c){
+                const Node& child = _nodes[c];
+                node.segmentCount += child.segmentCount;
+                for(int i=0; i<3; ++i){
+                    node.low[i] = min(node.low[i], child.low[i]);
+                    node.high[i] = max(node.high[i], child.high[i]);
+                }
+            }
+            _nodes.push_back(node);
+        }
+        levelFirst += levelCount;
+        levelCount = parents;
+    }
+    return true;
+}
+
+
+void Toolpath::_nodeCircle(const Projection& projection, const Node& node, float& x, float& y, float& radius)
+{
+    float mid[3];
+    radius = 0.0f;
+    for(int i=0; i<3; ++i){
+        mid[i] = 0.5f*(node.low[i] + node.high[i]);
+        radius += 0.25f*(node.high[i] - node.low[i])*(node.high[i] - node.low[i]);
+    }
+    radius = ::sqrt(radius) * projection.scale;
+    x = projection.m[0][0]*mid[0] + projection.m[0][1]*mid[1] + projection.m[0][2]*mid[2] + projection.offset[0];
+    y = projection.m[1][0]*mid[0] + projection.m[1][1]*mid[1] + projection.m[1][2]*mid[2] + projection.offset[1];
+}
+
+
+//////  p i c k  //////
+int Toolpath::pick(const Projection& projection, float x, float y, float distance) const
+{
+    if(_nodes.empty())
+        return -1;
+
+    const vector<Point>& points = _levels[0].points;
+    float best = distance*distance; // squared
+    int found = -1;
+    vector<int> stack(1, static_cast<int>(_nodes.size()) - 1);
+    stack.reserve(16*NODE_SIZE);
+    while(!stack.empty()){
+        const Node& node = _nodes[stack.back()];
+        const bool leaf = (stack.back() < _leafCount);
+        stack.pop_back();
+
+        float cx, cy, radius;
+        _nodeCircle(projection, node, cx, cy, radius);
+        const float d = ::sqrt((cx - x)*(cx - x) + (cy - y)*(cy - y)) - radius;
+        if(d > 0.0f && d*d > best)
+            continue;
+
+        if(!leaf){
+            for(int c = node.first; c < node.first + node.count; ++c)
+                stack.push_back(c);
+            continue;
+        }
+        for(int e = node.first; e < node.first + node.count; ++e){
+            const float* a = points[_segments[e] - 1].pos;
+            const float* b = points[_segments[e]].pos;
+            const float ax = projection.m[0][0]*a[0] + projection.m[0][1]*a[1] + projection.m[0][2]*a[2] + projection.offset[0];
+            const float ay = projection.m[1][0]*a[0] + projection.m[1][1]*a[1] + projection.m[1][2]*a[2] + projection.offset[1];
+            const float bx = projection.m[0][0]*b[0] + projection.m[0][1]*b[1] + projection.m[0][2]*b[2] + projection.offset[0];
+            const float by = projection.m[1][0]*b[0] + projection.m[1][1]*b[1] + projection.m[1][2]*b[2] + projection.offset[1];
+            const float dx = bx - ax, dy = by - ay;
+            const float length = dx*dx + dy*dy;
+            float t = (length > 0.0f)? ((x - ax)*dx + (y - ay)*dy) / length: 0.0f;
+            t = max(0.0f, min(1.0f, t));
+            const float ex = ax + t*dx - x, ey = ay + t*dy - y;
+            if(ex*ex + ey*ey <= best){
+                best = ex*ex + ey*ey;
+                found = _segments[e];
+            }
+        }
+    }
+    return found;
+}
+
+
+//////  s e l e c t  //////
+// segment from a to b crosses the rectangle, clipped as in Liang-Barsky
+static bool crossesRect(float ax, float ay, float bx, float by, const float* rect)
+{
+    const float dx = bx - ax, dy = by - ay;
+    const float p[4] = {-dx, dx, -dy, dy};
+    const float q[4] = {ax - rect[0], rect[2] - ax, ay - rect[1], rect[3] - ay};
+    float t0 = 0.0f, t1 = 1.0f;
+    for(int i=0; i<4; ++i){
+        if(p[i] == 0.0f){
+            if(q[i] < 0.0f)
+                return false;
+            continue;
+        }
+        const float t = q[i] / p[i];
+        if(p[i] < 0.0f)
+            t0 = max(t0, t);
+        else
+            t1 = min(t1, t);
+        if(t0 > t1)
+            return false;
+    }
+    return true;
+}
+
+
+void Toolpath::select(const Projection& projection, const float* rect, std::vector<int>& segments) const
+{
+    if(_nodes.empty())
+        return;
+
+    const vector<Point>& points = _levels[0].points;
+    vector<int> stack(1, static_cast<int>(_nodes.size()) - 1);
+    stack.reserve(16*NODE_SIZE);
+    while(!stack.empty()){
+        const Node& node = _nodes[stack.back()];
+        const bool leaf = (stack.back() < _leafCount);
+        stack.pop_back();
+
+        float cx, cy, radius;
+        _nodeCircle(projection, node, cx, cy, radius);
+        if(cx + radius < rect[0] || cx - radius > rect[2] || cy + radius < rect[1] || cy - radius > rect[3])
+            continue; // outside
+        if(cx - radius >= rect[0] && cx + radius <= rect[2] && cy - radius >= rect[1] && cy + radius <= rect[3]){
+            segments.insert(segments.end(), _segments.begin() + node.segmentFirst,
+                            _segments.begin() + node.segmentFirst + node.segmentCount); // all inside
+            continue;
+        }
+
+        if(!leaf){
+            for(int c = node.first; c < node.first + node.count; ++c)
+                stack.push_back(c);
+            continue;
+        }
+        for(int e = node.first; e < node.first + node.count; ++e){
+            const float* a = points[_segments[e] - 1].pos;
+            const float* b = points[_segments[e]].pos;
+            if(crossesRect(projection.m[0][0]*a[0] + projection.m[0][1]*a[1] + projection.m[0][2]*a[2] + projection.offset[0],
+                           projection.m[1][0]*a[0] + projection.m[1][1]*a[1] + projection.m[1][2]*a[2] + projection.offset[1],
+                           projection.m[0][0]*b[0] + projection.m[0][1]*b[1] + projection.m[0][2]*b[2] + projection.offset[0],
+                           projection.m[1][0]*b[0] + projection.m[1][1]*b[1] + projection.m[1][2]*b[2] + projection.offset[1], rect))
+                segments.push_back(_segments[e]);
+        }
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef GSHARPIE_TOOLPATH_H
+#define GSHARPIE_TOOLPATH_H
+#include <atomic>
+#include <vector>
+#include "gcodeprogram.h"
+
+
+// path of the tool as polylines, with coarser copies of it for zoomed out views:
+// each level merges runs of points falling into one grid cell, twice as large as in the level before;
+// segments of the full path are indexed by a packed R-tree (Morton order) for picking them on the screen
+class Toolpath
+{
+public:
+    static const int BLOCK_SIZE = 1024; // points sharing a bounding box, for culling
+    static const int MIN_POINTS = 4096; // no coarser level is made of a path this short
+    static const int FINEST_CELLS = 16384; // across the path, first coarse level
+    static const int COARSEST_CELLS = 256;
+    static const int NODE_SIZE = 16; // children or segments of an index node
+
+    enum TYPE{Rapid, Feed, Jump}; // how the point is reached from the one before, jumps are not drawn
+
+    struct Point
+    {
+        float pos[3]; // mm, program coordinates
+        int tag; // step << 2 | type
+
+        inline int step() const {return tag >> 2;}
+        inline TYPE type() const {return static_cast<TYPE>(tag & 3);}
+    };
+
+    struct Block // extents of the segments ending in BLOCK_SIZE consecutive points
+    {
+        float low[3], high[3];
+    };
+
+    struct Projection // to the screen: m * pos + offset
+    {
+        float m[2][3];
+        float offset[2]; // pixels
+        float scale; // pixels per mm
+    };
+
+    struct Level
+    {
+        float cell; // mm, 0 for the full path
+        std::vector<Point> points;
+        std::vector<Block> blocks;
+    };
+
+public:
+    Toolpath();
+
+    // thread-safe, can be called from a worker thread as long as the program is not modified;
+    // returns false if cancelled
+    bool build(const GCodeProgram& program, const std::atomic<bool>* cancel=nullptr);
+
+    inline bool isEmpty() const {return _levels.empty() || _levels[0].points.size() < 2;}
+    inline int levelCount() const {return static_cast<int>(_levels.size());}
+    inline const Level& level(int index) const {return _levels[index];}
+
+    // coarsest level whose cells are not larger than the given size (mm)
+    int selectLevel(double pixelSize) const;
+
+    inline const float* low() const {return _low;}
+    inline const float* high() const {return _high;}
+
+    // source line of the step, as when the toolpath was built
+    inline int lineNumber(int step) const {return _lines[step];}
+    inline int maxLineNumber() const {return _maxLine;}
+
+    // segments of the full path are given by the index of their end point in level(0);
+    // nearest one within the distance (pixels) of the screen point, or -1
+    int pick(const Projection& projection, float x, float y, float distance) const;
+    // segments crossing the screen rectangle (left, top, right, bottom), appended
+    void select(const Projection& projection, const float* rect, std::vector<int>& segments) const;
+
+private:
+    struct Chunk // part of the program processed by one thread
+    {
+        int begin, end; // steps
+        std::vector<Point> points;
+    };
+
+    static void _buildChunk(const GCodeProgram& program, Chunk& chunk, const std::atomic<bool>* cancel);
+    static void _addPoint(std::vector<Point>& points, const double* pos, int step, TYPE type);
+    static void _merge(const Level& fine, Level& coarse);
+    static void _makeBlocks(Level& level);
+
+    struct Node // leaves come first, the root is the last one
+    {
+        float low[3], high[3];
+        int first, count; // child nodes, or entries of _segments in a leaf
+        int segmentFirst, segmentCount; // all the segments below, contiguous in _segments
+    };
+
+    bool _buildIndex(const std::atomic<bool>* cancel);
+    static void _nodeCircle(const Projection& projection, const Node& node, float& x, float& y, float& radius); // on the screen
+
+private:
+    std::vector<Level> _levels;
+    float _low[3], _high[3]; // mm, extents of the path
+    std::vector<int> _lines; // source line of every step
+    int _maxLine;
+
+    std::vector<int> _segments; // in Morton order of their midpoints
+    std::vector<Node> _nodes;
+    int _leafCount;
+};
+
+#endif // GSHARPIE_TOOLPATH_H
@@ -0,0 +1,604 @@
+#include <cmath>
+#include <algorithm>
+#include <QtWidgets>
+#include <QtConcurrent>
+#include "toolpathview.h"
+
+static const QRgb BACKGROUND = qRgb(255, 255, 255);
+static const QRgb FEED_COLOR = qRgb(0, 0, 192);
+static const QRgb RAPID_COLOR = qRgb(255, 144, 144);
+static const QColor SELECTED_COLOR(255, 160, 0);
+static const QRgb TRAIL_COLOR = qRgb(0, 170, 0);
+static const int TOOL_RADIUS = 4; // pixels, marks the last position
+static const int MARGIN = 10; // pixels around the fitted toolpath
+static const int AXIS_LENGTH = 24; // pixels, at the origin
+
+
+ToolpathView::ToolpathView(QWidget *parent) : QWidget(parent)
+{
+    _build = new QFutureWatcher<Toolpath*>(this);
+    connect(_build, SIGNAL(finished()), this, SLOT(_buildFinished()));
+    _cancelBuild = false;
+    _building = false;
+
+    _toolpath = nullptr;
+    _rendering = new QFutureWatcher<QImage>(this);
+    connect(_rendering, SIGNAL(finished()), this, SLOT(_renderFinished()));
+    _generation = 0;
+    _renderGeneration = -1;
+    _renderLevel = _targetLevel = 0;
+
+    for(int i=0; i<3; ++i)
+        _camera.center[i] = 0.0;
+    _camera.scale = 1.0;
+    _camera.yaw = _camera.pitch = 0.0;
+    _camera.update();
+    _imageCamera = _renderCamera = _camera;
+    _trail = nullptr;
+    _trailGeneration = -1;
+    _trailClears = 0;
+    _trailDrawn = 0;
+
+    _dragging = Qt::NoButton;
+    _banding = false;
+}
+
+
+
+ToolpathView::~ToolpathView()
+{
+    releaseProgram();
+    ++_generation;
+    _rendering->waitForFinished();
+    delete _toolpath;
+}
+
+
+
+void ToolpathView::Camera::update()
+{
+    const double cy = ::cos(yaw), sy = ::sin(yaw);
+    const double cp = ::cos(pitch), sp = ::sin(pitch);
+    const double a[3][3] = {{cy, sy, 0.0}, {-sy*cp, cy*cp, sp}, {sy*sp, -cy*sp, cp}};
+    for(int i=0; i<3; ++i)
+        for(int k=0; k<3; ++k)
+            axes[i][k] = a[i][k];
+}
+
+
+
+void ToolpathView::setProgram(const GCodeProgram* program)
+{
+    releaseProgram();
+    if(!program)
+        return;
+
+    _cancelBuild = false;
+    _building = true;
+    std::atomic<bool>* cancel = &_cancelBuild;
+    _build->setFuture(QtConcurrent::run([program, cancel]() -> Toolpath* {
+        Toolpath* toolpath = new Toolpath;
+        if(!toolpath->build(*program, cancel)){
+            delete toolpath;
+            return nullptr;
+        }
+        return toolpath;
+    }));
+}
+
+
+
+void ToolpathView::releaseProgram()
+{
+    if(!_building)
+        return;
+    _cancelBuild = true;
+    _build->waitForFinished();
+    delete _build->result(); // finished before it was cancelled, never shown
+    _building = false;
+}
+
+
+
+void ToolpathView::clear()
+{
+    releaseProgram();
+    ++_generation;
+    _rendering->waitForFinished();
+    delete _toolpath;
+    _toolpath = nullptr;
+    _image = QImage();
+    _setSelection(std::vector<int>());
+    update();
+}
+
+
+
+void ToolpathView::_buildFinished()
+{
+    if(!_building)
+        return; // released
+    _building = false;
+    Toolpath* toolpath = _build->result();
+    if(!toolpath)
+        return;
+
+    ++_generation;
+    _rendering->waitForFinished(); // it reads the old toolpath
+    delete _toolpath;
+    _toolpath = toolpath;
+    _image = QImage();
+    _setSelection(std::vector<int>());
+    fit();
+}
+
+
+
+void ToolpathView::fit()
+{
+    if(!_toolpath || _toolpath->isEmpty())
+        return;
+
+    // extents of the bounding box corners along the screen axes
+    const float* low = _toolpath->low();
+    const float* high = _toolpath->high();
+    double min[2] = {1e30, 1e30}, max[2] = {-1e30, -1e30};
+    for(int corner=0; corner < 8; ++corner){
+        const double pos[3] = {(corner & 1)? high[0]: low[0], (corner & 2)? high[1]: low[1], (corner & 4)? high[2]: low[2]};
+        for(int a=0; a<2; ++a){
+            const double d = _camera.axes[a][0]*pos[0] + _camera.axes[a][1]*pos[1] + _camera.axes[a][2]*pos[2];
+            min[a] = std::min(min[a], d);
+            max[a] = std::max(max[a], d);
+        }
+    }
+    for(int i=0; i<3; ++i)
+        _camera.center[i] = 0.5*(low[i] + high[i]);
+    const double sx = (width() - 2*MARGIN) / std::max(max[0] - min[0], 1e-3);
+    const double sy = (height() - 2*MARGIN) / std::max(max[1] - min[1], 1e-3);
+    _camera.scale = std::max(std::min(sx, sy), 1e-3);
+    _changed();
+}
+
+
+
+void ToolpathView::showTop()
+{
+    _camera.yaw = _camera.pitch = 0.0;
+    _camera.update();
+    fit();
+}
+
+
+
+//////  c h a n g e d  //////
+void ToolpathView::_changed()
+{
+    ++_generation; // the running render gives up
+    update(); // the last image transformed meanwhile
+    if(!_toolpath || _toolpath->isEmpty() || width() <= 0 || height() <= 0)
+        return;
+
+    _targetLevel = _toolpath->selectLevel(1.0 / _camera.scale);
+    if(_rendering->isRunning())
+        return; // started again when it finishes
+    _startRender(std::min(_targetLevel + COARSE_LEVELS, _toolpath->levelCount() - 1));
+}
+
+
+
+void ToolpathView::_startRender(int level)
+{
+    _renderGeneration = _generation;
+    _renderCamera = _camera;
+    _renderLevel = level;
+
+    const Toolpath* toolpath = _toolpath;
+    const Camera camera = _camera;
+    const QSize size = this->size();
+    const std::atomic<int>* generation = &_generation;
+    const int current = _renderGeneration;
+    _rendering->setFuture(QtConcurrent::run([toolpath, camera, level, size, generation, current](){
+        return _render(toolpath, camera, level, size, generation, current);
+    }));
+}
+
+
+
+void ToolpathView::_renderFinished()
+{
+    if(!_toolpath)
+        return;
+    if(_renderGeneration != _generation){ // the camera has moved meanwhile
+        _startRender(std::min(_targetLevel + COARSE_LEVELS, _toolpath->levelCount() - 1));
+        return;
+    }
+
+    _image = _rendering->result();
+    _imageCamera = _renderCamera;
+    update();
+    if(_renderLevel > _targetLevel) // refines it
+        _startRender(_targetLevel);
+}
+
+
+
+//////  d r a w  L i n e  //////
+// clipped to the image (Liang-Barsky) and stepped one pixel at a time along the longer axis
+static void drawLine(QRgb* bits, int stride, int width, int height, float x0, float y0, float x1, float y1, QRgb color)
+{
+    const float dx = x1 - x0, dy = y1 - y0;
+    float t0 = 0.0f, t1 = 1.0f;
+    const float p[4] = {-dx, dx, -dy, dy};
+    const float q[4] = {x0, width - 1 - x0, y0, height - 1 - y0};
+    for(int i=0; i<4; ++i){
+        if(p[i] == 0.0f){
+            if(q[i] < 0.0f)
+                return; // parallel and outside
+            continue;
+        }
+        const float t = q[i] / p[i];
+        if(p[i] < 0.0f){
+            if(t > t1)
+                return;
+            t0 = std::max(t0, t);
+        }
+        else{
+            if(t < t0)
+                return;
+            t1 = std::min(t1, t);
+        }
+    }
+
+    float x = x0 + t0*dx, y = y0 + t0*dy;
+    const float ex = x0 + t1*dx, ey = y0 + t1*dy;
+    const int steps = static_cast<int>(std::max(std::fabs(ex - x), std::fabs(ey - y)) + 0.5f);
+    const float sx = (steps > 0)? (ex - x)/steps: 0.0f, sy = (steps > 0)? (ey - y)/steps: 0.0f;
+    x += 0.5f;
+    y += 0.5f;
+    for(int i=0; i <= steps; ++i){
+        bits[static_cast<int>(y)*stride + static_cast<int>(x)] = color;
+        x += sx;
+        y += sy;
+    }
+}
+
+
+
+//////  r e n d e r  //////
+QImage ToolpathView::_render(const Toolpath* toolpath, const Camera& camera, int level, QSize size,
+                             const std::atomic<int>* generation, int current)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(BACKGROUND);
+    if(!toolpath || toolpath->isEmpty())
+        return image;
+
+    const int width = size.width(), height = size.height();
+    const Toolpath::Projection projection = _projection(camera, size);
+    const float (&m)[2][3] = projection.m;
+    const float* offset = projection.offset;
+
+    QRgb* bits = reinterpret_cast<QRgb*>(image.bits());
+    const int stride = image.bytesPerLine() / sizeof(QRgb);
+    const Toolpath::Level& lod = toolpath->level(level);
+    const size_t count = lod.points.size();
+    for(size_t b=0; b < lod.blocks.size(); ++b){
+        if(*generation != current)
+            return QImage(); // camera has moved
+
+        // culled by the bounding sphere of the block
+        const Toolpath::Block& block = lod.blocks[b];
+        float mid[3], radius = 0.0f;
+        for(int i=0; i<3; ++i){
+            mid[i] = 0.5f*(block.low[i] + block.high[i]);
+            radius += 0.25f*(block.high[i] - block.low[i])*(block.high[i] - block.low[i]);
+        }
+        radius = std::sqrt(radius) * static_cast<float>(camera.scale);
+        const float cx = m[0][0]*mid[0] + m[0][1]*mid[1] + m[0][2]*mid[2] + offset[0];
+        const float cy = m[1][0]*mid[0] + m[1][1]*mid[1] + m[1][2]*mid[2] + offset[1];
+        if(cx + radius < 0.0f || cx - radius > width || cy + radius < 0.0f || cy - radius > height)
+            continue;
+
+        const size_t begin = std::max<size_t>(b*Toolpath::BLOCK_SIZE, 1);
+        const size_t end = std::min(count, (b+1)*Toolpath::BLOCK_SIZE);
+        const float* pos = lod.points[begin-1].pos;
+        float x0 = m[0][0]*pos[0] + m[0][1]*pos[1] + m[0][2]*pos[2] + offset[0];
+        float y0 = m[1][0]*pos[0] + m[1][1]*pos[1] + m[1][2]*pos[2] + offset[1];
+        for(size_t n = begin; n < end; ++n){
+            const Toolpath::Point& point = lod.points[n];
+            const float x1 = m[0][0]*point.pos[0] + m[0][1]*point.pos[1] + m[0][2]*point.pos[2] + offset[0];
+            const float y1 = m[1][0]*point.pos[0] + m[1][1]*point.pos[1] + m[1][2]*point.pos[2] + offset[1];
+            if(point.type() != Toolpath::Jump)
+                drawLine(bits, stride, width, height, x0, y0, x1, y1,
+                         (point.type() == Toolpath::Rapid)? RAPID_COLOR: FEED_COLOR);
+            x0 = x1;
+            y0 = y1;
+        }
+    }
+    return image;
+}
+
+
+
+// screen = m * pos + offset, y grows downwards
+Toolpath::Projection ToolpathView::_projection(const Camera& camera, QSize size)
+{
+    Toolpath::Projection projection;
+    for(int i=0; i<3; ++i){
+        projection.m[0][i] = static_cast<float>(camera.axes[0][i] * camera.scale);
+        projection.m[1][i] = static_cast<float>(-camera.axes[1][i] * camera.scale);
+    }
+    for(int a=0; a<2; ++a)
+        projection.offset[a] = 0.5f*((a == 0)? size.width(): size.height()) -
+                               static_cast<float>(projection.m[a][0]*camera.center[0] + projection.m[a][1]*camera.center[1] +
+                                                  projection.m[a][2]*camera.center[2]);
+    projection.scale = static_cast<float>(camera.scale);
+    return projection;
+}
+
+
+
+//////  t r a i l  //////
+void ToolpathView::setTrail(const MachineTrail* trail)
+{
+    _trail = trail;
+    _trailLayer = QImage();
+    update();
+}
+
+
+
+void ToolpathView::updateTrail()
+{
+    if(!_trail)
+        return;
+    if(_trailLayer.isNull() || _trailGeneration != _generation || _trailClears != _trail->clearCount() ||
+       _trailLayer.size() != size()){
+        update(); // drawn again when painted
+        return;
+    }
+    if(_trailDrawn >= _trail->end())
+        return;
+
+    // continues from the last sample drawn, unless it has been overwritten meanwhile
+    const QPointF tool = _tool;
+    const QRect drawn = _drawTrail(qMax(_trailDrawn - 1, _trail->first()), _trail->end());
+    const QRect marks = QRectF(tool, _tool).normalized().toAlignedRect().adjusted(-TOOL_RADIUS-1, -TOOL_RADIUS-1,
+                                                                                  TOOL_RADIUS+1, TOOL_RADIUS+1);
+    update(drawn.united(marks));
+}
+
+
+
+void ToolpathView::_redrawTrail()
+{
+    if(_trailLayer.size() != size())
+        _trailLayer = QImage(size(), QImage::Format_ARGB32);
+    _trailLayer.fill(0);
+    _trailGeneration = _generation;
+    _trailClears = _trail->clearCount();
+    _drawTrail(_trail->first(), _trail->end());
+}
+
+
+
+QRect ToolpathView::_drawTrail(qint64 from, qint64 end)
+{
+    _trailDrawn = end;
+    if(from >= end)
+        return QRect();
+
+    const Toolpath::Projection projection = _projection(_camera, size());
+    const float (&m)[2][3] = projection.m;
+    QRgb* bits = reinterpret_cast<QRgb*>(_trailLayer.bits());
+    const int stride = _trailLayer.bytesPerLine() / sizeof(QRgb);
+    float low[2] = {1e30f, 1e30f}, high[2] = {-1e30f, -1e30f};
+    float x0 = 0.0f, y0 = 0.0f;
+    for(qint64 n = from; n < end; ++n){
+        const float* pos = _trail->at(n).pos;
+        const float x1 = m[0][0]*pos[0] + m[0][1]*pos[1] + m[0][2]*pos[2] + projection.offset[0];
+        const float y1 = m[1][0]*pos[0] + m[1][1]*pos[1] + m[1][2]*pos[2] + projection.offset[1];
+        if(n > from)
+            drawLine(bits, stride, width(), height(), x0, y0, x1, y1, TRAIL_COLOR);
+        low[0] = std::min(low[0], x1);
+        low[1] = std::min(low[1], y1);
+        high[0] = std::max(high[0], x1);
+        high[1] = std::max(high[1], y1);
+        x0 = x1;
+        y0 = y1;
+    }
+    _tool = QPointF(x0, y0);
+    return QRectF(QPointF(low[0], low[1]), QPointF(high[0], high[1])).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+
+
+QPointF ToolpathView::_project(const Camera& camera, const double* pos, QSize size)
+{
+    double d[2];
+    for(int a=0; a<2; ++a)
+        d[a] = camera.axes[a][0]*(pos[0] - camera.center[0]) + camera.axes[a][1]*(pos[1] - camera.center[1]) +
+               camera.axes[a][2]*(pos[2] - camera.center[2]);
+    return QPointF(0.5*size.width() + d[0]*camera.scale, 0.5*size.height() - d[1]*camera.scale);
+}
+
+
+
+void ToolpathView::paintEvent(QPaintEvent * /* event */)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(BACKGROUND));
+
+    if(!_image.isNull()){
+        painter.save();
+        if(_imageCamera.yaw == _camera.yaw && _imageCamera.pitch == _camera.pitch){
+            // panned and zoomed: image centre goes where its camera centre is projected now
+            const double k = _camera.scale / _imageCamera.scale;
+            painter.translate(_project(_camera, _imageCamera.center, size()));
+            painter.scale(k, k);
+            painter.translate(-0.5*_image.width(), -0.5*_image.height());
+        }
+        painter.drawImage(0, 0, _image); // rotated views wait for the new image
+        painter.restore();
+    }
+
+    if(_trail && _trail->end() > _trail->first()){
+        if(_trailLayer.isNull() || _trailGeneration != _generation || _trailClears != _trail->clearCount() ||
+           _trailLayer.size() != size())
+            _redrawTrail();
+        painter.drawImage(0, 0, _trailLayer);
+        painter.setPen(QColor(TRAIL_COLOR));
+        painter.setBrush(Qt::NoBrush);
+        painter.drawEllipse(_tool, TOOL_RADIUS, TOOL_RADIUS);
+    }
+
+    // selection over the image, drawn now as the camera is
+    if(_toolpath && !_selected.empty()){
+        const std::vector<Toolpath::Point>& points = _toolpath->level(0).points;
+        QVector<QLineF> lines;
+        for(size_t i=0; i < _selected.size() && i < MAX_HIGHLIGHTED; ++i){
+            const float* a = points[_selected[i] - 1].pos;
+            const float* b = points[_selected[i]].pos;
+            const double from[3] = {a[0], a[1], a[2]}, to[3] = {b[0], b[1], b[2]};
+            lines.append(QLineF(_project(_camera, from, size()), _project(_camera, to, size())));
+        }
+        painter.setPen(QPen(SELECTED_COLOR, 2));
+        painter.drawLines(lines);
+    }
+    if(_banding){
+        painter.setPen(QPen(palette().color(QPalette::Highlight), 1, Qt::DashLine));
+        painter.drawRect(QRect(_pressed, _lastMouse).normalized());
+    }
+
+    // axes at the program origin
+    const double origin[3] = {0.0, 0.0, 0.0};
+    const QPointF o = _project(_camera, origin, size());
+    const QColor colors[3] = {Qt::red, Qt::darkGreen, Qt::blue};
+    for(int i=0; i<3; ++i){
+        const QPointF d(_camera.axes[0][i]*AXIS_LENGTH, -_camera.axes[1][i]*AXIS_LENGTH);
+        painter.setPen(colors[i]);
+        painter.drawLine(o, o + d);
+    }
+
+    painter.setPen(palette().color(QPalette::Mid));
+    painter.drawRect(rect().adjusted(0, 0, -1, -1));
+}
+
+
+
+void ToolpathView::resizeEvent(QResizeEvent * /* event */)
+{
+    _changed();
+}
+
+
+
+void ToolpathView::wheelEvent(QWheelEvent *event)
+{
+    // the point under the cursor stays in place
+    const double factor = ::pow(1.2, event->angleDelta().y() / 120.0);
+    const double scale = qBound(1e-3, _camera.scale * factor, 1e4);
+    const double ox = event->pos().x() - 0.5*width();
+    const double oy = event->pos().y() - 0.5*height();
+    const double shift = 1.0/_camera.scale - 1.0/scale;
+    for(int i=0; i<3; ++i)
+        _camera.center[i] += (_camera.axes[0][i]*ox - _camera.axes[1][i]*oy) * shift;
+    _camera.scale = scale;
+    _changed();
+}
+
+
+
+void ToolpathView::mousePressEvent(QMouseEvent *event)
+{
+    _dragging = event->button();
+    _lastMouse = _pressed = event->pos();
+    _banding = (_dragging == Qt::LeftButton && (event->modifiers() & Qt::ShiftModifier));
+}
+
+
+
+void ToolpathView::mouseMoveEvent(QMouseEvent *event)
+{
+    const QPoint d = event->pos() - _lastMouse;
+    _lastMouse = event->pos();
+    if(_banding){
+        update();
+        return;
+    }
+    if(_dragging == Qt::LeftButton){ // pans
+        for(int i=0; i<3; ++i)
+            _camera.center[i] -= (_camera.axes[0][i]*d.x() - _camera.axes[1][i]*d.y()) / _camera.scale;
+    }
+    else if(_dragging == Qt::RightButton){ // orbits around the centre
+        _camera.yaw -= d.x() * 0.01;
+        _camera.pitch = qBound(0.0, _camera.pitch + d.y() * 0.01, M_PI);
+        _camera.update();
+    }
+    else
+        return;
+    _changed();
+}
+
+
+
+void ToolpathView::mouseReleaseEvent(QMouseEvent *event)
+{
+    const bool click = (event->pos() - _pressed).manhattanLength() < 3;
+    const bool banding = _banding;
+    _dragging = Qt::NoButton;
+    _banding = false;
+    if(!_toolpath || event->button() != Qt::LeftButton || (!click && !banding)){
+        update();
+        return;
+    }
+
+    const Toolpath::Projection projection = _projection(_camera, size());
+    std::vector<int> segments;
+    if(banding && !click){
+        const QRect r = QRect(_pressed, event->pos()).normalized();
+        const float rect[4] = {static_cast<float>(r.left()), static_cast<float>(r.top()),
+                               static_cast<float>(r.right()), static_cast<float>(r.bottom())};
+        _toolpath->select(projection, rect, segments);
+    }
+    else{
+        const int segment = _toolpath->pick(projection, event->pos().x(), event->pos().y(), PICK_DISTANCE);
+        if(segment > 0)
+            segments.push_back(segment);
+    }
+    _setSelection(segments);
+    update();
+}
+
+
+
+void ToolpathView::_setSelection(const std::vector<int>& segments)
+{
+    const bool changed = !(_selected.empty() && segments.empty());
+    _selected = segments;
+    _selectedLines.clear();
+    if(_toolpath && !_selected.empty()){
+        // lines marked once, ranges come out in order
+        const std::vector<Toolpath::Point>& points = _toolpath->level(0).points;
+        std::vector<bool> marked(_toolpath->maxLineNumber() + 2, false);
+        for(int segment: _selected)
+            marked[_toolpath->lineNumber(points[segment].step())] = true;
+        for(int line = 1; line < static_cast<int>(marked.size()); ++line){
+            if(!marked[line])
+                continue;
+            if(!_selectedLines.empty() && _selectedLines.back().second == line-1)
+                _selectedLines.back().second = line;
+            else
+                _selectedLines.push_back(std::make_pair(line, line));
+        }
+    }
+    if(changed)
+        emit selectionChanged();
+}
+
+
+
+void ToolpathView::mouseDoubleClickEvent(QMouseEvent * /* event */)
+{
+    showTop();
+}
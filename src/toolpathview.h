@@ -0,0 +1,117 @@
+#ifndef GSHARPIE_TOOLPATHVIEW_H
+#define GSHARPIE_TOOLPATHVIEW_H
+
+#include <atomic>
+#include <QImage>
+#include <QWidget>
+#include <QFutureWatcher>
+#include "toolpath.h"
+#include "machinetrail.h"
+
+class QPaintEvent;
+class QResizeEvent;
+class QWheelEvent;
+class QMouseEvent;
+
+
+// preview of the program's toolpath; it is rendered into an image on a worker thread,
+// a coarse level of detail first, then the one matching the zoom
+class ToolpathView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    static const int COARSE_LEVELS = 2; // first pass is this many levels coarser
+    static const int PICK_DISTANCE = 6; // pixels from the cursor to a segment it picks
+    static const int MAX_HIGHLIGHTED = 20000; // selected segments drawn over the image
+
+public:
+    ToolpathView(QWidget *parent = 0);
+    ~ToolpathView();
+
+    // builds the toolpath in background, the program must not change until releaseProgram()
+    void setProgram(const GCodeProgram* program);
+    void releaseProgram(); // stops reading the program, the toolpath built so far stays shown
+    void clear();
+
+    void fit(); // whole toolpath in view
+    void showTop(); // and fits
+
+    // positions the machine has been at, drawn over the toolpath on a layer of their own
+    void setTrail(const MachineTrail* trail);
+    void updateTrail(); // draws only the samples added since, or all of them when the view has changed
+
+    // source lines (from 1) of the segments clicked or enclosed with shift-drag, first and last of each range
+    inline const std::vector<std::pair<int, int>>& selectedLines() const {return _selectedLines;}
+
+signals:
+    void selectionChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private slots:
+    void _buildFinished();
+    void _renderFinished();
+
+private:
+    struct Camera // orthographic, looking down rotated by yaw and tilted by pitch
+    {
+        double center[3]; // mm, in the middle of the view
+        double scale; // pixels per mm
+        double yaw, pitch; // radians
+        double axes[3][3]; // screen right, screen up and towards the viewer, in program coordinates
+
+        void update(); // axes from yaw and pitch
+    };
+
+    void _changed(); // camera or size
+    void _startRender(int level);
+    static QImage _render(const Toolpath* toolpath, const Camera& camera, int level, QSize size,
+                          const std::atomic<int>* generation, int current);
+    static QPointF _project(const Camera& camera, const double* pos, QSize size);
+    static Toolpath::Projection _projection(const Camera& camera, QSize size);
+    void _setSelection(const std::vector<int>& segments);
+    void _redrawTrail();
+    QRect _drawTrail(qint64 from, qint64 end); // samples from..end-1 joined, returns the area drawn
+
+private:
+    QFutureWatcher<Toolpath*>* _build;
+    std::atomic<bool> _cancelBuild;
+    bool _building; // result not taken yet
+
+    Toolpath* _toolpath; // shown, read by the renderer
+    QFutureWatcher<QImage>* _rendering;
+    std::atomic<int> _generation; // of the camera, renders of older ones give up
+    int _renderGeneration; // of the running render
+    Camera _renderCamera;
+    int _renderLevel;
+    int _targetLevel; // matching the zoom
+
+    Camera _camera; // requested
+    QImage _image; // last rendered, drawn transformed until a new one is ready
+    Camera _imageCamera;
+
+    const MachineTrail* _trail;
+    QImage _trailLayer; // transparent, for the camera of _trailGeneration
+    int _trailGeneration;
+    int _trailClears; // of the trail when the layer was drawn
+    qint64 _trailDrawn; // next sample to be drawn
+    QPointF _tool; // last position, marked
+
+    std::vector<int> _selected; // segments, by their end point in the full path
+    std::vector<std::pair<int, int>> _selectedLines;
+
+    QPoint _lastMouse;
+    QPoint _pressed; // clicks pick, drags pan
+    Qt::MouseButton _dragging;
+    bool _banding; // shift-drag selects
+};
+
+#endif // GSHARPIE_TOOLPATHVIEW_H
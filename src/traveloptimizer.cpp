@@ -0,0 +1,988 @@
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include <QThread>
+#include <QtConcurrent>
+#include "traveloptimizer.h"
+
+using namespace std;
+
+static const double EPSILON = 1e-6; // mm, closer positions are the same
+static const unsigned char MOVES = 0x80; // flag of the input steps, besides their motion mode
+static const uint64_t HASH_SEED = 14695981039346656037ull; // FNV-1a
+static const uint64_t HASH_PRIME = 1099511628211ull;
+
+
+static inline uint64_t hashLine(uint64_t hash, const char* code)
+{
+    for(const char* s = code; *s; ++s)
+        hash = (hash ^ static_cast<unsigned char>(*s)) * HASH_PRIME;
+    return (hash ^ '\n') * HASH_PRIME;
+}
+
+
+static inline double distanceXY(const double* a, const double* b)
+{
+    return ::hypot(a[0] - b[0], a[1] - b[1]);
+}
+
+
+// nothing but motion, dwell, coordinates and feed rate; anything else (spindle, tool, units, plane,
+// coordinate system...) changes what follows, the lines cannot be moved across it
+static bool isMovable(const char* code)
+{
+    for(const char* s = code; *s; ++s){
+        const char c = ::toupper(*s);
+        if(c == '(')
+            while(s[1] && *s != ')') ++s;
+        else if(c == ';')
+            break;
+        else if(c == 'G'){
+            const char* end;
+            const double g = GCodeState::readNumber(s+1, &end);
+            if(g != 0.0 && g != 1.0 && g != 2.0 && g != 3.0 && g != 4.0)
+                return false;
+        }
+        else if(::isalpha(c) && !::strchr("XYZIJKRFNP", c))
+            return false;
+    }
+    return true;
+}
+
+
+//////  L a y o u t  //////
+struct TravelOptimizer::Layout
+{
+    struct Island // cut between two travels
+    {
+        int link, begin, end; // steps: travel leading to it, first line of the cut and past its last one
+        double entry[3], exit[3]; // mm
+        double feed, exitFeed; // mm/min, modal
+        double low[2], high[2]; // mm, XY extent
+        bool reversible; // straight feed moves, none above the entry
+        bool needsFeed; // moves at the modal feed rate before setting one
+    };
+
+    struct Region // islands close to each other, cut in their order
+    {
+        std::vector<int> islands;
+        double entry[2], exit[2]; // mm
+        bool reversible; // a single reversible island
+        bool symmetric; // ends where it starts in XY, either way round is the same
+    };
+
+    struct Segment // between the lines nothing is moved across
+    {
+        int begin, headEnd, tailBegin, end; // steps
+        int firstIsland, lastIsland; // [first, last)
+        int firstRegion, lastRegion;
+        double start[3], finish[3]; // mm, before the travel to the first island and after the last one
+        double startFeed, finishFeed; // mm/min
+        double safeZ; // mm, highest travel
+        bool freeEnd; // the travel after the last island sets every axis
+        bool imperial;
+    };
+
+    std::vector<Island> islands;
+    std::vector<Region> regions;
+    std::vector<Segment> segments;
+
+    void analyze(const GCodeProgram& program);
+
+private:
+    void _group(Segment& segment);
+};
+
+
+void TravelOptimizer::Layout::analyze(const GCodeProgram& program)
+{
+    islands.clear();
+    regions.clear();
+    segments.clear();
+
+    GCodeState state;
+    Segment segment = Segment();
+    segment.headEnd = segment.tailBegin = -1;
+    segment.safeZ = -1e30;
+    bool open = false; // last island is being cut
+    bool feedKnown = false; // whether the open island needs the feed rate it is entered with
+
+    // rapid moves before the current step
+    int run = -1;
+    bool runXY = false, runAxes[3] = {false, false, false};
+    double runStart[3], runFeed = 0.0, runTop = 0.0;
+
+    for(int step=0; step <= program.size(); ++step){
+        double before[3];
+        for(int i=0; i<3; ++i)
+            before[i] = state.position()[i];
+        const double feed = state.feedRate();
+
+        GCodeMove move;
+        bool moved = false, fixed = true, travel = false;
+        const char* code = nullptr;
+        if(step < program.size()){
+            code = program.codePtr(step);
+            moved = state.update(code, &move);
+            fixed = !isMovable(code) || state.isIncremental() || state.isInverseTime() || (moved && move.machine);
+            // travels are written with X and Y, Z of the whole segment is known or the same unknown one
+            fixed = fixed || (moved && !move.known) || !state.isKnown(0) || !state.isKnown(1);
+            travel = !fixed && moved && move.type == GCodeMove::Rapid && isPlainMove(code, GCodeState::Rapid);
+        }
+
+        if(travel){
+            if(run < 0){
+                run = step;
+                runXY = false;
+                runAxes[0] = runAxes[1] = runAxes[2] = false;
+                for(int i=0; i<3; ++i)
+                    runStart[i] = before[i];
+                runFeed = feed;
+                runTop = before[2];
+            }
+            if(::fabs(move.to[0] - move.from[0]) > EPSILON || ::fabs(move.to[1] - move.from[1]) > EPSILON)
+                runXY = true;
+            runTop = max(runTop, move.to[2]);
+            for(const char* s = code; *s; ++s){
+                const char* axis = ::strchr("XYZ", ::toupper(*s));
+                if(axis)
+                    runAxes[axis - "XYZ"] = true;
+            }
+            continue;
+        }
+
+        // rapid moves in XY lead to the next island, the others belong to what they follow
+        const bool link = (run >= 0 && runXY);
+        if(link)
+            segment.safeZ = max(segment.safeZ, runTop);
+        if(open && (link || fixed)){
+            Island& island = islands.back();
+            island.end = link? run: step;
+            for(int i=0; i<3; ++i)
+                island.exit[i] = link? runStart[i]: before[i];
+            island.exitFeed = link? runFeed: feed;
+            if(run >= 0 && !link)
+                island.reversible = false;
+            segment.safeZ = max(segment.safeZ, max(island.entry[2], island.exit[2]));
+            open = false;
+        }
+
+        if(fixed){
+            segment.end = step;
+            segment.lastIsland = static_cast<int>(islands.size());
+            if(segment.lastIsland > segment.firstIsland){
+                const Island& last = islands.back();
+                segment.tailBegin = last.end;
+                segment.freeEnd = link && runAxes[0] && runAxes[1] && runAxes[2];
+                for(int i=0; i<3; ++i)
+                    segment.finish[i] = last.exit[i];
+                segment.finishFeed = last.exitFeed;
+                _group(segment);
+            }
+            else
+                segment.firstRegion = segment.lastRegion = static_cast<int>(regions.size());
+            segments.push_back(segment);
+            if(step == program.size())
+                break;
+
+            segment = Segment();
+            segment.begin = step;
+            segment.headEnd = segment.tailBegin = -1;
+            segment.firstIsland = static_cast<int>(islands.size());
+            segment.safeZ = -1e30;
+            run = -1;
+            continue;
+        }
+
+        if(link){
+            if(segment.headEnd < 0){
+                segment.headEnd = run;
+                for(int i=0; i<3; ++i)
+                    segment.start[i] = runStart[i];
+                segment.startFeed = runFeed;
+                segment.imperial = state.isImperial();
+            }
+            Island island;
+            island.link = run;
+            island.begin = step;
+            island.end = -1;
+            for(int i=0; i<3; ++i)
+                island.entry[i] = island.exit[i] = before[i];
+            island.feed = island.exitFeed = feed;
+            island.low[0] = island.high[0] = before[0];
+            island.low[1] = island.high[1] = before[1];
+            island.reversible = true;
+            island.needsFeed = false;
+            islands.push_back(island);
+            open = true;
+            feedKnown = false;
+        }
+        else if(run >= 0 && open)
+            islands.back().reversible = false; // lifted inside the cut
+        run = -1;
+
+        if(open){
+            Island& island = islands.back();
+            if(moved){
+                double low[3], high[3];
+                move.boundingBox(low, high);
+                for(int i=0; i<2; ++i){
+                    island.low[i] = min(island.low[i], low[i]);
+                    island.high[i] = max(island.high[i], high[i]);
+                }
+                if(move.type != GCodeMove::Linear || !isPlainMove(code, GCodeState::Linear) ||
+                   high[2] > island.entry[2] + EPSILON)
+                    island.reversible = false;
+            }
+            else
+                island.reversible = false;
+
+            if(!feedKnown && ::strpbrk(code, "Ff"))
+                feedKnown = true;
+            else if(!feedKnown && moved && (move.type == GCodeMove::Linear || move.isArc()))
+                island.needsFeed = feedKnown = true;
+        }
+    }
+}
+
+
+//////  g r o u p  //////
+void TravelOptimizer::Layout::_group(Segment& segment)
+{
+    // islands which overlap (with clearance) are joined, the sweep goes along X
+    const int first = segment.firstIsland, count = segment.lastIsland - segment.firstIsland;
+    vector<int> parent(count), sorted(count);
+    for(int i=0; i < count; ++i)
+        parent[i] = sorted[i] = i;
+    sort(sorted.begin(), sorted.end(), [this, first](int a, int b){
+        return islands[first + a].low[0] < islands[first + b].low[0];
+    });
+
+    auto root = [&parent](int i){
+        while(parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+    for(int a=0; a < count; ++a){
+        const Island& one = islands[first + sorted[a]];
+        for(int b=a+1; b < count; ++b){
+            const Island& other = islands[first + sorted[b]];
+            if(other.low[0] > one.high[0] + CLEARANCE)
+                break;
+            if(other.low[1] <= one.high[1] + CLEARANCE && one.low[1] <= other.high[1] + CLEARANCE){
+                const int ra = root(sorted[a]), rb = root(sorted[b]);
+                parent[max(ra, rb)] = min(ra, rb); // the root is the first island
+            }
+        }
+    }
+
+    segment.firstRegion = static_cast<int>(regions.size());
+    vector<int> region(count, -1);
+    for(int i=0; i < count; ++i){
+        const int r = root(i);
+        if(region[r] < 0){
+            region[r] = static_cast<int>(regions.size());
+            regions.push_back(Region());
+        }
+        regions[region[r]].islands.push_back(first + i);
+    }
+    segment.lastRegion = static_cast<int>(regions.size());
+
+    for(int r = segment.firstRegion; r < segment.lastRegion; ++r){
+        Region& group = regions[r];
+        const Island& head = islands[group.islands.front()];
+        const Island& tail = islands[group.islands.back()];
+        for(int i=0; i<2; ++i){
+            group.entry[i] = head.entry[i];
+            group.exit[i] = tail.exit[i];
+        }
+        group.reversible = (group.islands.size() == 1 && head.reversible);
+        group.symmetric = (distanceXY(group.entry, group.exit) <= EPSILON);
+    }
+}
+
+
+namespace {
+
+// open path from a fixed start through regions with an entry and an exit, to a fixed end or anywhere;
+// visits are region indices, ~region when it is cut backwards
+class Route
+{
+public:
+    struct Node
+    {
+        double entry[2], exit[2]; // mm
+        bool flippable;
+    };
+
+public:
+    Route(const vector<Node>& nodes, const double* start, const double* end) : _nodes(nodes)
+    {
+        _start[0] = start[0];
+        _start[1] = start[1];
+        _fixedEnd = (end != nullptr);
+        _end[0] = end? end[0]: 0.0;
+        _end[1] = end? end[1]: 0.0;
+        _buildNeighbours();
+    }
+
+    double length(const vector<int>& tour) const
+    {
+        double sum = 0.0;
+        for(size_t p=0; p <= tour.size(); ++p)
+            sum += _link(tour, (p == 0)? _start: _exitOf(tour[p-1]), static_cast<int>(p));
+        return sum;
+    }
+
+    // nearest neighbour, randomized by the seed, then 2-opt and or-opt
+    vector<int> solve(unsigned seed, const atomic<bool>* cancel) const
+    {
+        vector<int> tour = _nearestNeighbour(seed);
+        _improve(tour, cancel);
+        return tour;
+    }
+
+private:
+    inline const double* _entryOf(int v) const {return (v >= 0)? _nodes[v].entry: _nodes[~v].exit;}
+    inline const double* _exitOf(int v) const {return (v >= 0)? _nodes[v].exit: _nodes[~v].entry;}
+    inline const double* _exitAt(const vector<int>& tour, int p) const {return (p < 0)? _start: _exitOf(tour[p]);}
+
+    // from a point to the visit at the position, or to the end
+    inline double _link(const vector<int>& tour, const double* from, int p) const
+    {
+        if(p >= static_cast<int>(tour.size()))
+            return _fixedEnd? distanceXY(from, _end): 0.0;
+        return distanceXY(from, _entryOf(tour[p]));
+    }
+
+    void _buildNeighbours();
+    vector<int> _nearestNeighbour(unsigned seed) const;
+    void _improve(vector<int>& tour, const atomic<bool>* cancel) const;
+    bool _twoOpt(vector<int>& tour, vector<int>& position, vector<int>& fixedBefore) const;
+    bool _orOpt(vector<int>& tour, vector<int>& position, vector<int>& fixedBefore) const;
+    // positions from..to-1 have changed
+    void _index(const vector<int>& tour, vector<int>& position, vector<int>& fixedBefore, int from, int to) const;
+
+private:
+    const vector<Node>& _nodes;
+    double _start[2], _end[2];
+    bool _fixedEnd;
+
+    // endpoints 2*node (entry) and 2*node+1 (exit) bucketed on a grid
+    double _origin[2], _cell;
+    int _columns, _rows;
+    vector<vector<int>> _buckets;
+    vector<vector<int>> _neighbours; // of every endpoint, nearest other nodes
+
+    struct Candidate
+    {
+        double distance;
+        int endpoint;
+        bool operator<(const Candidate& other) const {return distance < other.distance;}
+    };
+    // nearest endpoints accepted, nearest first, at most count of them
+    template<typename Accept>
+    void _nearest(const double* p, size_t count, Accept accept, vector<Candidate>& found) const;
+    inline const double* _point(int endpoint) const
+    {
+        return (endpoint & 1)? _nodes[endpoint >> 1].exit: _nodes[endpoint >> 1].entry;
+    }
+};
+
+
+void Route::_buildNeighbours()
+{
+    const int n = static_cast<int>(_nodes.size());
+    double low[2] = {1e30, 1e30}, high[2] = {-1e30, -1e30};
+    for(int e=0; e < 2*n; ++e){
+        for(int i=0; i<2; ++i){
+            low[i] = min(low[i], _point(e)[i]);
+            high[i] = max(high[i], _point(e)[i]);
+        }
+    }
+    // a few endpoints per cell
+    const double area = max((high[0] - low[0]) * (high[1] - low[1]), 1e-6);
+    _cell = max(::sqrt(area / n), 1e-3);
+    _origin[0] = low[0];
+    _origin[1] = low[1];
+    _columns = min(static_cast<int>((high[0] - low[0]) / _cell) + 1, 4096);
+    _rows = min(static_cast<int>((high[1] - low[1]) / _cell) + 1, 4096);
+    _cell = max(_cell, max((high[0] - low[0]) / _columns, (high[1] - low[1]) / _rows) * 1.000001);
+    _buckets.assign(static_cast<size_t>(_columns) * _rows, vector<int>());
+    for(int e=0; e < 2*n; ++e){
+        const int column = min(static_cast<int>((_point(e)[0] - _origin[0]) / _cell), _columns-1);
+        const int row = min(static_cast<int>((_point(e)[1] - _origin[1]) / _cell), _rows-1);
+        _buckets[row*_columns + column].push_back(e);
+    }
+
+    _neighbours.assign(2*n, vector<int>());
+    vector<Candidate> found;
+    vector<bool> listed(n, false);
+    for(int e=0; e < 2*n; ++e){
+        const int self = e >> 1;
+        _nearest(_point(e), 2*TravelOptimizer::NEIGHBOURS, [self](int other){return (other >> 1) != self;}, found);
+        for(const Candidate& c: found){
+            const int node = c.endpoint >> 1;
+            if(!listed[node] && _neighbours[e].size() < static_cast<size_t>(TravelOptimizer::NEIGHBOURS)){
+                listed[node] = true;
+                _neighbours[e].push_back(node);
+            }
+        }
+        for(int node: _neighbours[e])
+            listed[node] = false;
+    }
+}
+
+
+template<typename Accept>
+void Route::_nearest(const double* p, size_t count, Accept accept, vector<Candidate>& found) const
+{
+    found.clear();
+    const int column = max(0, min(static_cast<int>((p[0] - _origin[0]) / _cell), _columns-1));
+    const int row = max(0, min(static_cast<int>((p[1] - _origin[1]) / _cell), _rows-1));
+    const int rings = max(_columns, _rows);
+    for(int ring=0; ring <= rings; ++ring){
+        for(int r = row - ring; r <= row + ring; ++r){
+            if(r < 0 || r >= _rows)
+                continue;
+            const bool edge = (r == row - ring || r == row + ring);
+            for(int c = column - ring; c <= column + ring; c += (edge || ring == 0)? 1: 2*ring){
+                if(c < 0 || c >= _columns)
+                    continue;
+                for(int e: _buckets[r*_columns + c]){
+                    if(accept(e)){
+                        const Candidate candidate = {distanceXY(p, _point(e)), e};
+                        found.push_back(candidate);
+                    }
+                }
+            }
+        }
+        // anything beyond the ring is farther than this
+        const double reach = ring * _cell;
+        if(found.size() >= count){
+            nth_element(found.begin(), found.begin() + (count-1), found.end());
+            if(found[count-1].distance <= reach){
+                found.resize(count);
+                sort(found.begin(), found.end());
+                return;
+            }
+        }
+    }
+    sort(found.begin(), found.end());
+    if(found.size() > count)
+        found.resize(count);
+}
+
+
+//////  n e a r e s t  N e i g h b o u r  //////
+vector<int> Route::_nearestNeighbour(unsigned seed) const
+{
+    const int n = static_cast<int>(_nodes.size());
+    vector<int> tour;
+    tour.reserve(n);
+    vector<bool> visited(n, false);
+    mt19937 random(seed);
+    vector<Candidate> found;
+
+    const double* at = _start;
+    while(static_cast<int>(tour.size()) < n){
+        // entries, or exits of the regions which may be cut backwards
+        _nearest(at, 2, [this, &visited](int e){
+            return !visited[e >> 1] && (!(e & 1) || _nodes[e >> 1].flippable);
+        }, found);
+        const size_t pick = (seed > 0 && found.size() > 1 && random() % 4 == 0)? 1: 0;
+        const int node = found[pick].endpoint >> 1;
+        const int visit = (found[pick].endpoint & 1)? ~node: node;
+        visited[node] = true;
+        tour.push_back(visit);
+        at = _exitOf(visit);
+    }
+    return tour;
+}
+
+
+//////  i m p r o v e  //////
+void Route::_improve(vector<int>& tour, const atomic<bool>* cancel) const
+{
+    vector<int> position(tour.size()), fixedBefore(tour.size() + 1, 0);
+    _index(tour, position, fixedBefore, 0, static_cast<int>(tour.size()));
+    for(int pass=0; pass < TravelOptimizer::MAX_PASSES; ++pass){
+        if(cancel && *cancel)
+            return;
+        const bool shorter = _twoOpt(tour, position, fixedBefore);
+        if(!_orOpt(tour, position, fixedBefore) && !shorter)
+            return;
+    }
+}
+
+
+void Route::_index(const vector<int>& tour, vector<int>& position, vector<int>& fixedBefore, int from, int to) const
+{
+    for(int p = from; p < to; ++p){
+        const int node = (tour[p] >= 0)? tour[p]: ~tour[p];
+        position[node] = p;
+        fixedBefore[p+1] = fixedBefore[p] + (_nodes[node].flippable? 0: 1);
+    }
+}
+
+
+//////  t w o  O p t  //////
+// visits i..j taken backwards, each of them turned around
+bool Route::_twoOpt(vector<int>& tour, vector<int>& position, vector<int>& fixedBefore) const
+{
+    const int n = static_cast<int>(tour.size());
+    bool improved = false;
+    auto gain = [&](int i, int j){
+        if(i > j || fixedBefore[j+1] - fixedBefore[i] > 0)
+            return 0.0;
+        const double* before = _exitAt(tour, i-1);
+        return _link(tour, before, i) + _link(tour, _exitOf(tour[j]), j+1) -
+               distanceXY(before, _exitOf(tour[j])) - _link(tour, _entryOf(tour[i]), j+1);
+    };
+    auto apply = [&](int i, int j){
+        reverse(tour.begin() + i, tour.begin() + j + 1);
+        for(int p=i; p <= j; ++p)
+            tour[p] = ~tour[p];
+        _index(tour, position, fixedBefore, i, j+1);
+        improved = true;
+    };
+
+    for(int i=0; i < n; ++i){
+        // new link from the visit before i to the exit of j, then from the entry of i to the visit after j
+        const double* before = _exitAt(tour, i-1);
+        const vector<int>* near = nullptr;
+        vector<int> fromStart;
+        if(i > 0)
+            near = &_neighbours[(tour[i-1] >= 0)? 2*tour[i-1] + 1: 2*(~tour[i-1])];
+        else{
+            vector<Candidate> found;
+            _nearest(before, TravelOptimizer::NEIGHBOURS, [](int){return true;}, found);
+            for(const Candidate& c: found)
+                fromStart.push_back(c.endpoint >> 1);
+            near = &fromStart;
+        }
+        for(int node: *near){
+            const int j = position[node];
+            if(j >= i && gain(i, j) > EPSILON){
+                apply(i, j);
+                break;
+            }
+        }
+
+        // the same, found from the other side: new link from the entry of k to the visit after i
+        if(i+1 < n){
+            const vector<int>& after = _neighbours[(tour[i+1] >= 0)? 2*tour[i+1]: 2*(~tour[i+1]) + 1];
+            for(int node: after){
+                const int k = position[node];
+                if(k <= i && gain(k, i) > EPSILON){
+                    apply(k, i);
+                    break;
+                }
+            }
+        }
+    }
+    return improved;
+}
+
+
+//////  o r  O p t  //////
+// up to MAX_CHAIN visits moved elsewhere, turned around if they can be
+bool Route::_orOpt(vector<int>& tour, vector<int>& position, vector<int>& fixedBefore) const
+{
+    const int n = static_cast<int>(tour.size());
+    bool improved = false;
+    vector<int> targets;
+    for(int i=0; i < n; ++i){
+        for(int length=1; length <= TravelOptimizer::MAX_CHAIN && i + length <= n; ++length){
+            const int last = i + length - 1;
+            const double* before = _exitAt(tour, i-1);
+            const double removed = _link(tour, before, i) + _link(tour, _exitOf(tour[last]), last+1) -
+                                   _link(tour, before, last+1);
+            if(removed <= EPSILON)
+                continue;
+            const bool flippable = (fixedBefore[last+1] - fixedBefore[i] == 0);
+
+            // after the neighbours of its entry, before the neighbours of its exit, at either end
+            targets.clear();
+            const int head = (tour[i] >= 0)? 2*tour[i]: 2*(~tour[i]) + 1;
+            const int tail = (tour[last] >= 0)? 2*tour[last] + 1: 2*(~tour[last]);
+            for(int node: _neighbours[head])
+                targets.push_back(position[node]);
+            for(int node: _neighbours[tail])
+                targets.push_back(position[node] - 1);
+            if(flippable){
+                for(int node: _neighbours[head ^ 1])
+                    targets.push_back(position[node] - 1);
+                for(int node: _neighbours[tail ^ 1])
+                    targets.push_back(position[node]);
+            }
+            targets.push_back(-1);
+            targets.push_back(n-1);
+
+            double best = EPSILON;
+            int bestAfter = 0;
+            bool bestFlipped = false;
+            for(int after: targets){
+                if(after >= i-1 && after <= last)
+                    continue; // where it is
+                const double* from = _exitAt(tour, after);
+                for(int flipped = 0; flipped <= (flippable? 1: 0); ++flipped){
+                    const double* in = flipped? _exitOf(tour[last]): _entryOf(tour[i]);
+                    const double* out = flipped? _entryOf(tour[i]): _exitOf(tour[last]);
+                    const double added = distanceXY(from, in) + _link(tour, out, after+1) - _link(tour, from, after+1);
+                    if(removed - added > best){
+                        best = removed - added;
+                        bestAfter = after;
+                        bestFlipped = (flipped != 0);
+                    }
+                }
+            }
+            if(best <= EPSILON)
+                continue;
+
+            int first = i, end = last + 1; // of the chain where it goes
+            if(bestAfter > last){
+                rotate(tour.begin() + i, tour.begin() + last + 1, tour.begin() + bestAfter + 1);
+                first = bestAfter + 1 - length;
+                end = bestAfter + 1;
+            }
+            else{
+                rotate(tour.begin() + bestAfter + 1, tour.begin() + i, tour.begin() + last + 1);
+                first = bestAfter + 1;
+                end = first + length;
+            }
+            if(bestFlipped){
+                reverse(tour.begin() + first, tour.begin() + end);
+                for(int p = first; p < end; ++p)
+                    tour[p] = ~tour[p];
+            }
+            _index(tour, position, fixedBefore, min(i, bestAfter + 1), max(last + 1, bestAfter + 1));
+            improved = true;
+            break;
+        }
+    }
+    return improved;
+}
+
+} // namespace
+
+
+//////  p l a n  //////
+TravelOptimizer::Plan TravelOptimizer::plan(const GCodeProgram& program, bool reversal, const atomic<bool>* cancel)
+{
+    Plan plan;
+    plan.signature = HASH_SEED;
+    for(int step=0; step < program.size(); ++step)
+        plan.signature = hashLine(plan.signature, program.codePtr(step));
+
+    Layout layout;
+    layout.analyze(program);
+    plan.regions = static_cast<int>(layout.regions.size());
+
+    const int threads = max(1, QThread::idealThreadCount());
+    for(const Layout::Segment& segment: layout.segments){
+        const int count = segment.lastRegion - segment.firstRegion;
+        vector<Route::Node> nodes(count);
+        for(int r=0; r < count; ++r){
+            const Layout::Region& region = layout.regions[segment.firstRegion + r];
+            for(int i=0; i<2; ++i){
+                nodes[r].entry[i] = region.entry[i];
+                nodes[r].exit[i] = region.exit[i];
+            }
+            nodes[r].flippable = region.symmetric || (reversal && region.reversible);
+        }
+        vector<int> order(count);
+        for(int r=0; r < count; ++r)
+            order[r] = r;
+
+        if(count > 1){
+            const Route route(nodes, segment.start, segment.freeEnd? nullptr: segment.finish);
+            const double original = route.length(order);
+            plan.originalTravel += original;
+
+            // a different start on every thread, the shortest is taken
+            struct Attempt
+            {
+                unsigned seed;
+                std::vector<int> tour;
+                double length;
+            };
+            vector<Attempt> attempts(threads);
+            for(int t=0; t < threads; ++t)
+                attempts[t].seed = t;
+            QtConcurrent::blockingMap(attempts, [&route, cancel](Attempt& attempt){
+                attempt.tour = route.solve(attempt.seed, cancel);
+                attempt.length = route.length(attempt.tour);
+            });
+            if(cancel && *cancel)
+                return Plan();
+
+            const Attempt* best = &attempts.front();
+            for(const Attempt& attempt: attempts){
+                if(attempt.length < best->length)
+                    best = &attempt;
+            }
+            if(best->length < original - EPSILON){
+                order = best->tour;
+                plan.travel += best->length;
+            }
+            else
+                plan.travel += original;
+        }
+
+        for(int visit: order){
+            const int region = segment.firstRegion + ((visit >= 0)? visit: ~visit);
+            const bool backwards = (visit < 0) && layout.regions[region].reversible;
+            plan.order.push_back((visit >= 0)? region: ~region);
+            if(backwards)
+                ++plan.reversed;
+        }
+    }
+
+    if(plan.travel >= plan.originalTravel - EPSILON)
+        return Plan(); // as good as it is
+    return plan;
+}
+
+
+void TravelOptimizer::apply(const GCodeProgram& program, const Plan& plan, GCodeProgram& output)
+{
+    TravelOptimizer optimizer;
+    optimizer.setPlan(plan);
+    optimizer.setOutput(&output);
+    for(int step=0; step < program.size(); ++step)
+        optimizer.push(program.lineNumber(step), program.codePtr(step));
+    optimizer.flush();
+}
+
+
+void TravelOptimizer::reset()
+{
+    GCodeFilter::reset();
+    _input.clear();
+    _steps.clear();
+    _inState.reset();
+    _signature = HASH_SEED;
+    _pos[0] = _pos[1] = _pos[2] = 0.0;
+    _feed = 0.0;
+    _scale = 1.0;
+}
+
+
+//////  p r o c e s s  //////
+void TravelOptimizer::_process(int lineNumber, const char* code)
+{
+    // the order is known when the whole program is
+    const bool moved = _inState.update(code);
+    _steps.push_back(static_cast<unsigned char>(_inState.motionMode() | (moved? MOVES: 0)));
+    _input.append(lineNumber, code);
+    _signature = hashLine(_signature, code);
+}
+
+
+//////  f l u s h  //////
+void TravelOptimizer::flush()
+{
+    Layout layout;
+    bool valid = (_plan.signature == _signature);
+    if(valid){
+        layout.analyze(_input);
+        valid = (static_cast<int>(_plan.order.size()) == static_cast<int>(layout.regions.size()));
+    }
+    // every region of a segment once, in its segment
+    for(size_t s=0, k=0; valid && s < layout.segments.size(); ++s){
+        const Layout::Segment& segment = layout.segments[s];
+        vector<bool> seen(segment.lastRegion - segment.firstRegion, false);
+        for(int r = segment.firstRegion; valid && r < segment.lastRegion; ++r, ++k){
+            const int region = (_plan.order[k] >= 0)? _plan.order[k]: ~_plan.order[k];
+            valid = (region >= segment.firstRegion && region < segment.lastRegion && !seen[region - segment.firstRegion]);
+            if(valid)
+                seen[region - segment.firstRegion] = true;
+        }
+    }
+
+    if(!valid){ // made for another program
+        for(int step=0; step < _input.size(); ++step)
+            _emitStep(step);
+    }
+
+    size_t next = 0; // in the order
+    for(size_t s=0; valid && s < layout.segments.size(); ++s){
+        const Layout::Segment& segment = layout.segments[s];
+        if(segment.firstRegion == segment.lastRegion){
+            for(int step = segment.begin; step < segment.end; ++step)
+                _emitStep(step);
+            continue;
+        }
+
+        _scale = segment.imperial? 25.4: 1.0;
+        for(int step = segment.begin; step < segment.headEnd; ++step)
+            _emitStep(step);
+        for(int i=0; i<3; ++i)
+            _pos[i] = segment.start[i];
+        _feed = segment.startFeed;
+
+        int last = segment.firstIsland - 1; // island cut last, its travel to the next one is still good
+        for(int r = segment.firstRegion; r < segment.lastRegion; ++r, ++next){
+            const int visit = _plan.order[next];
+            const Layout::Region& region = layout.regions[(visit >= 0)? visit: ~visit];
+            if(visit < 0 && region.reversible){
+                const Layout::Island& island = layout.islands[region.islands.front()];
+                _emitBackwards(island.begin, island.end, island.entry[2], segment.safeZ);
+                last = -2;
+                continue;
+            }
+
+            for(int k: region.islands){
+                const Layout::Island& island = layout.islands[k];
+                if(k == last + 1){
+                    for(int step = island.link; step < island.begin; ++step)
+                        _emitStep(step);
+                }
+                else{
+                    _travel(_input.lineNumber(island.begin), island.entry, segment.safeZ);
+                    if(island.needsFeed)
+                        _restoreFeed(_input.lineNumber(island.begin), island.feed);
+                }
+                for(int step = island.begin; step < island.end; ++step)
+                    _emitStep(step);
+                for(int i=0; i<3; ++i)
+                    _pos[i] = island.exit[i];
+                _feed = island.exitFeed;
+                last = k;
+            }
+        }
+
+        // what follows finds the machine where it was left
+        const int lineNumber = _input.lineNumber(max(segment.tailBegin - 1, 0));
+        if(last != segment.lastIsland - 1){
+            if(segment.freeEnd){
+                const double lifted[3] = {_pos[0], _pos[1], max(_pos[2], segment.safeZ)};
+                _travel(lineNumber, lifted, segment.safeZ);
+            }
+            else
+                _travel(lineNumber, segment.finish, segment.safeZ);
+            _restoreFeed(lineNumber, segment.finishFeed);
+        }
+        for(int step = segment.tailBegin; step < segment.end; ++step)
+            _emitStep(step);
+    }
+
+    _input.clear();
+    _steps.clear();
+    GCodeFilter::flush();
+}
+
+
+void TravelOptimizer::_emitStep(int step)
+{
+    // an arc mode restored on a line which does not move would want axis words
+    if(_steps[step] & MOVES)
+        _emitOriginal(_input.lineNumber(step), _input.codePtr(step), _steps[step] & ~MOVES);
+    else
+        _emit(_input.lineNumber(step), _input.codePtr(step));
+}
+
+
+//////  t r a v e l  //////
+// retract to the safe height, rapid in XY and down to the target
+void TravelOptimizer::_travel(int lineNumber, const double* target, double safeZ)
+{
+    char buf[64];
+    if(_pos[2] < safeZ - EPSILON){
+        ::sprintf(buf, "G0Z%.4f", safeZ/_scale);
+        _emitMotion(lineNumber, buf, GCodeState::Rapid);
+        _pos[2] = safeZ;
+    }
+    if(::fabs(target[0] - _pos[0]) > EPSILON || ::fabs(target[1] - _pos[1]) > EPSILON){
+        ::sprintf(buf, "G0X%.4fY%.4f", target[0]/_scale, target[1]/_scale);
+        _emitMotion(lineNumber, buf, GCodeState::Rapid);
+    }
+    if(::fabs(target[2] - _pos[2]) > EPSILON){
+        ::sprintf(buf, "G0Z%.4f", target[2]/_scale);
+        _emitMotion(lineNumber, buf, GCodeState::Rapid);
+    }
+    for(int i=0; i<3; ++i)
+        _pos[i] = target[i];
+}
+
+
+void TravelOptimizer::_restoreFeed(int lineNumber, double feed)
+{
+    if(feed <= 0.0 || ::fabs(feed - _feed) <= EPSILON)
+        return;
+    char buf[32];
+    ::sprintf(buf, "F%g", feed/_scale);
+    _emit(lineNumber, buf);
+    _feed = feed;
+}
+
+
+//////  e m i t  B a c k w a r d s  //////
+// straight feed moves from their end back to their start: down above the end at the feed of the first move,
+// every move at its own feed rate, the plunges become retracts
+void TravelOptimizer::_emitBackwards(int begin, int end, double entryZ, double safeZ)
+{
+    GCodeState state = _input.stateAt(begin);
+    vector<double> points(state.position(), state.position() + 3);
+    vector<double> feeds;
+    vector<int> lines;
+    for(int step = begin; step < end; ++step){
+        GCodeMove move;
+        if(state.update(_input.codePtr(step), &move)){
+            points.insert(points.end(), move.to, move.to + 3);
+            feeds.push_back(move.feed);
+            lines.push_back(_input.lineNumber(step));
+        }
+    }
+    const int moves = static_cast<int>(feeds.size());
+    if(moves == 0)
+        return;
+
+    // the plunges it starts with are retracts backwards, they are rapid
+    int plunges = 0;
+    while(plunges < moves && ::fabs(points[3*plunges+3] - points[3*plunges]) <= EPSILON &&
+          ::fabs(points[3*plunges+4] - points[3*plunges+1]) <= EPSILON && points[3*plunges+5] < points[3*plunges+2])
+        ++plunges;
+
+    const double* exit = &points[3*moves];
+    const double above[3] = {exit[0], exit[1], max(entryZ, exit[2])};
+    _travel(lines.back(), above, safeZ);
+
+    static const char axis[3] = {'X', 'Y', 'Z'};
+    for(int m = moves; m >= 0; --m){
+        // the first one goes down to the end of the cut, the others back to the start of their move
+        const double* target = (m == moves)? exit: &points[3*m];
+        const double feed = (m == moves)? feeds.front(): feeds[m];
+        const int lineNumber = (m == moves)? lines.back(): lines[m];
+
+        char buf[32];
+        string line("G1");
+        for(int k=0; k<3; ++k){
+            if(::fabs(target[k] - _pos[k]) > EPSILON){
+                ::sprintf(buf, "%c%.4f", axis[k], target[k]/_scale);
+                line += buf;
+            }
+        }
+        if(line.size() == 2)
+            continue; // no length
+        if(m < plunges){
+            line[1] = '0';
+            _emitMotion(lineNumber, line, GCodeState::Rapid);
+            for(int k=0; k<3; ++k)
+                _pos[k] = target[k];
+            continue;
+        }
+        if(::fabs(feed - _feed) > EPSILON){
+            ::sprintf(buf, "F%g", feed/_scale);
+            line += buf;
+            _feed = feed;
+        }
+        _emitMotion(lineNumber, line, GCodeState::Linear);
+        for(int k=0; k<3; ++k)
+            _pos[k] = target[k];
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef GSHARPIE_TRAVELOPTIMIZER_H
+#define GSHARPIE_TRAVELOPTIMIZER_H
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gcodefilter.h"
+
+
+// reorders the cut regions of the program for shorter rapid travel: a region is what is cut between
+// two rapid moves in XY, regions which overlap keep their order and nothing is moved across lines changing
+// the spindle, tool, units, coordinate system and such; regions made of straight feed moves may be cut
+// backwards; the travels between the regions are replaced by retract, rapid in XY and approach
+class TravelOptimizer: public GCodeFilter
+{
+public:
+    static const int NEIGHBOURS = 10; // candidates for the new neighbours of a region, 2-opt and or-opt
+    static const int MAX_PASSES = 50; // of the local search over the whole order
+    static const int MAX_CHAIN = 3; // regions moved together, or-opt
+    static constexpr double CLEARANCE = 1.0; // mm, regions closer than this in XY keep their order
+
+    struct Plan
+    {
+        std::vector<int> order; // of the regions, ~region when it is cut backwards
+        std::uint64_t signature; // of the program it was made for
+        int regions, reversed;
+        double travel, originalTravel; // mm, in XY between the regions
+
+        Plan() {signature = 0; regions = reversed = 0; travel = originalTravel = 0.0;}
+    };
+
+public:
+    TravelOptimizer() {reset();}
+
+    // thread-safe, runs on several threads; an empty plan if the order cannot be improved
+    static Plan plan(const GCodeProgram& program, bool reversal, const std::atomic<bool>* cancel=nullptr);
+    // the program filtered with the plan
+    static void apply(const GCodeProgram& program, const Plan& plan, GCodeProgram& output);
+
+    // programs other than the one planned pass unchanged
+    inline void setPlan(const Plan& plan) {_plan = plan;}
+    inline void clearPlan() {_plan = Plan();}
+    inline bool isReady() const {return !_plan.order.empty();}
+
+    const char* name() const override {return "Travel ordering";}
+    void reset() override;
+    void flush() override;
+
+protected:
+    void _process(int lineNumber, const char* code) override;
+
+private:
+    struct Layout; // regions found in the program
+
+    void _emitStep(int step); // as it is in the input
+    void _travel(int lineNumber, const double* target, double safeZ);
+    void _restoreFeed(int lineNumber, double feed);
+    void _emitBackwards(int begin, int end, double entryZ, double safeZ);
+
+private:
+    Plan _plan;
+    GCodeProgram _input; // whole program, until flushed
+    std::vector<unsigned char> _steps; // motion mode of every input step, and whether it moves
+    GCodeState _inState; // of the input stream
+    std::uint64_t _signature; // of the input so far
+
+    // output stream
+    double _pos[3]; // mm
+    double _feed; // mm/min
+    double _scale; // program units to mm
+};
+
+#endif // GSHARPIE_TRAVELOPTIMIZER_H